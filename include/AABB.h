@@ -0,0 +1,66 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include <float.h>
+#include <utility>
+#include "Ray.h"
+
+inline float ffmin(float a, float b) { return a < b ? a : b; }
+inline float ffmax(float a, float b) { return a > b ? a : b; }
+
+class AABB {
+    public:
+        AABB() : _min(FLT_MAX, FLT_MAX, FLT_MAX), _max(-FLT_MAX, -FLT_MAX, -FLT_MAX) {}
+        AABB(const Vector3& a, const Vector3& b) { _min = a; _max = b; }
+
+        Vector3 min() const { return _min; }
+        Vector3 max() const { return _max; }
+        Vector3 centroid() const { return 0.5f*(_min + _max); }
+        bool empty() const { return _min[0] > _max[0]; }
+
+        void expand(const Vector3& p) {
+            for (int a = 0; a < 3; a++) {
+                _min[a] = ffmin(_min[a], p[a]);
+                _max[a] = ffmax(_max[a], p[a]);
+            }
+        }
+        void expand(const AABB& box) {
+            for (int a = 0; a < 3; a++) {
+                _min[a] = ffmin(_min[a], box._min[a]);
+                _max[a] = ffmax(_max[a], box._max[a]);
+            }
+        }
+
+        float surface_area() const {
+            if (empty())
+                return 0.0f;
+            Vector3 d = _max - _min;
+            return 2.0f*(d[0]*d[1] + d[1]*d[2] + d[2]*d[0]);
+        }
+
+        bool hit(const Ray& r, float tmin, float tmax) const {
+            for (int a = 0; a < 3; a++) {
+                float invD = 1.0f / r.direction()[a];
+                float t0 = (_min[a] - r.origin()[a]) * invD;
+                float t1 = (_max[a] - r.origin()[a]) * invD;
+                if (invD < 0.0f)
+                    std::swap(t0, t1);
+                tmin = t0 > tmin ? t0 : tmin;
+                tmax = t1 < tmax ? t1 : tmax;
+                if (tmax <= tmin)
+                    return false;
+            }
+            return true;
+        }
+
+        Vector3 _min;
+        Vector3 _max;
+};
+
+inline AABB surrounding_box(const AABB& box0, const AABB& box1) {
+    AABB box = box0;
+    box.expand(box1);
+    return box;
+}
+
+#endif
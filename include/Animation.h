@@ -0,0 +1,145 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Framebuffer.h"
+#include "ImageIO.h"
+#include "Scene.h"
+
+struct CameraKey {
+    float time;
+    Vector3 lookfrom;
+    Vector3 lookat;
+};
+
+// Camera positions over time: piecewise linear between keyframes, held at the first and
+// last key outside them. Everything but lookfrom and lookat comes from the base view.
+class CameraPath {
+    public:
+        // Keys may be added in any order.
+        void add(const CameraKey& key);
+        bool empty() const { return keys.empty(); }
+        SceneCamera at(float time, const SceneCamera& base) const;
+
+        std::vector<CameraKey> keys;
+};
+
+inline void CameraPath::add(const CameraKey& key) {
+    auto pos = std::upper_bound(keys.begin(), keys.end(), key.time,
+                                [](float t, const CameraKey& k) { return t < k.time; });
+    keys.insert(pos, key);
+}
+
+inline SceneCamera CameraPath::at(float time, const SceneCamera& base) const {
+    SceneCamera view = base;
+    if (keys.empty())
+        return view;
+    auto next = std::upper_bound(keys.begin(), keys.end(), time,
+                                 [](float t, const CameraKey& k) { return t < k.time; });
+    if (next == keys.begin() || next == keys.end()) {
+        const CameraKey& key = next == keys.begin() ? keys.front() : keys.back();
+        view.lookfrom = key.lookfrom;
+        view.lookat = key.lookat;
+        return view;
+    }
+    const CameraKey& a = *(next - 1);
+    const CameraKey& b = *next;
+    float s = (time - a.time) / (b.time - a.time);
+    view.lookfrom = a.lookfrom + s*(b.lookfrom - a.lookfrom);
+    view.lookat = a.lookat + s*(b.lookat - a.lookat);
+    return view;
+}
+
+// One revolution of lookfrom around lookat, about the view's up axis, over 'duration'.
+// A key per degree keeps the chords within 0.01% of the circle.
+inline CameraPath turntable_path(const SceneCamera& view, float duration) {
+    const int steps = 360;
+    Vector3 axis = unit_vector(view.vup);
+    Vector3 arm = view.lookfrom - view.lookat;
+    Vector3 along = dot(arm, axis) * axis;
+    Vector3 x = arm - along;
+    Vector3 y = cross(axis, x);
+    CameraPath path;
+    for (int i = 0; i <= steps; i++) {
+        float angle = 2.0f * 3.14159265f * float(i) / float(steps);
+        CameraKey key;
+        key.time = duration * float(i) / float(steps);
+        key.lookfrom = view.lookat + along + cosf(angle)*x + sinf(angle)*y;
+        key.lookat = view.lookat;
+        path.add(key);
+    }
+    return path;
+}
+
+// True if 'pattern' holds exactly one %d conversion (with optional zero padding and
+// width, e.g. %04d) and no other conversions, so it is safe to pass to snprintf.
+inline bool is_frame_pattern(const char* pattern) {
+    int conversions = 0;
+    for (const char* p = pattern; *p; p++) {
+        if (*p != '%')
+            continue;
+        p++;
+        if (*p == '%')
+            continue;
+        while (*p >= '0' && *p <= '9')
+            p++;
+        if (*p != 'd')
+            return false;
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+inline std::string frame_path(const char* pattern, int frame) {
+    char buffer[4096];
+    snprintf(buffer, sizeof(buffer), pattern, frame);
+    return buffer;
+}
+
+// Saves finished frames on a background thread, so frame k is encoded and written while
+// frame k+1 renders. One frame is in flight at a time: the caller renders into a second
+// framebuffer meanwhile, and submit() first waits for the previous write.
+class FrameWriter {
+    public:
+        FrameWriter() : wait_seconds(0.0) {}
+        ~FrameWriter() { finish(); }
+
+        // Returns false if the previous frame failed to write. 'fb' must stay untouched
+        // until the next submit() or finish().
+        bool submit(const std::string& path, const Framebuffer& fb);
+        // Waits for the frame in flight, if any; false if it failed to write.
+        bool finish();
+
+        double wait_seconds;    // time submit() and finish() spent blocked on a write
+
+    private:
+        std::future<bool> pending;
+        std::string pending_path;
+};
+
+inline bool FrameWriter::submit(const std::string& path, const Framebuffer& fb) {
+    bool ok = finish();
+    pending_path = path;
+    pending = std::async(std::launch::async, [this, &fb]() { return write_image(pending_path.c_str(), fb); });
+    return ok;
+}
+
+inline bool FrameWriter::finish() {
+    if (!pending.valid())
+        return true;
+    auto start = std::chrono::steady_clock::now();
+    bool ok = pending.get();
+    wait_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!ok)
+        std::cout << "Failed to write " << pending_path << std::endl;
+    return ok;
+}
+
+#endif
@@ -0,0 +1,505 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <float.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+#include "Hitable.h"
+#include "SphereSoA.h"
+#include "Stats.h"
+
+// 32 byte node in a depth-first flattened tree: the first child of an interior
+// node is the next node in the array, the second child is at 'offset'.
+struct BVHNode {
+    float bmin[3];
+    float bmax[3];
+    int offset;         // first primitive for leaves, second child for interior nodes
+    uint16_t count;     // primitives in a leaf, 0 for interior nodes
+    uint16_t axis;      // split axis, used to visit the nearer child first
+};
+
+struct BVHBuildStats {
+    double build_ms;
+    int primitives;
+    int nodes;
+    int leaves;
+    int max_depth;
+    size_t bytes;       // nodes, primitive references and SIMD leaf copies
+};
+
+struct BVHBuildPrim {
+    AABB box;
+    Vector3 centroid;
+    int index;          // the caller's primitive number
+};
+
+// Binned surface area heuristic builder, shared by the scene BVH and the triangle BVHs of
+// meshes. build() reorders 'prims' into leaf order and appends the flattened tree to
+// 'nodes'; leaf offsets index the reordered array. 'prim_cost' is the cost of testing
+// one primitive relative to visiting a node; below 1 it favours fuller leaves, for
+// primitives that are tested several at a time.
+class BVHBuilder {
+    public:
+        BVHBuilder(std::vector<BVHNode>& nodes, BVHBuildStats& stats, int max_leaf_size, float prim_cost = 1.0f)
+            : nodes(nodes), stats(stats), max_leaf(max_leaf_size), prim_cost(prim_cost) {}
+
+        void build(std::vector<BVHBuildPrim>& prims) {
+            nodes.reserve(nodes.size() + 2 * prims.size());
+            if (!prims.empty())
+                build(prims, 0, int(prims.size()), 0);
+        }
+
+    private:
+        static const int num_bins = 16;
+        static const int max_sah_depth = 48;
+
+        int build(std::vector<BVHBuildPrim>& prims, int begin, int end, int depth);
+        int make_leaf(int node, int begin, int end);
+
+        std::vector<BVHNode>& nodes;
+        BVHBuildStats& stats;
+        int max_leaf;
+        float prim_cost;
+};
+
+// Walks the nodes overlapping the ray in [t_min, t_max], nearer child first, and calls
+// leaf(node) for every leaf reached. The leaf test may lower t_max, which culls the rest
+// of the walk, and returns true to end it early. Returns the number of nodes visited.
+template <typename LeafTest>
+inline uint64_t traverse_bvh(const BVHNode* nodes, const Ray& r, float t_min, const float& t_max, LeafTest&& leaf) {
+    const Vector3 origin = r.origin();
+    const Vector3 dir = r.direction();
+    const float inv[3] = { 1.0f / dir[0], 1.0f / dir[1], 1.0f / dir[2] };
+    const bool negative[3] = { inv[0] < 0.0f, inv[1] < 0.0f, inv[2] < 0.0f };
+
+    int stack[128];
+    int sp = 0;
+    int current = 0;
+    uint64_t visited = 0;
+
+    for (;;) {
+        const BVHNode& node = nodes[current];
+        visited++;
+
+        float tnear = t_min, tfar = t_max;
+        for (int a = 0; a < 3; a++) {
+            float t0 = (node.bmin[a] - origin[a]) * inv[a];
+            float t1 = (node.bmax[a] - origin[a]) * inv[a];
+            if (negative[a])
+                std::swap(t0, t1);
+            tnear = t0 > tnear ? t0 : tnear;
+            tfar = t1 < tfar ? t1 : tfar;
+        }
+
+        // Widened by the slab test's worst rounding error (Ize 2013), so a ray that grazes
+        // a box exactly at a vertex or edge of a primitive still enters it.
+        if (tnear <= tfar * 1.0000004f) {
+            if (node.count > 0) {
+                if (leaf(node))
+                    break;
+            }
+            else {
+                if (negative[node.axis]) {
+                    stack[sp++] = current + 1;
+                    current = node.offset;
+                }
+                else {
+                    stack[sp++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+
+        if (sp == 0)
+            break;
+        current = stack[--sp];
+    }
+    return visited;
+}
+
+// Bounding volume hierarchy over any set of Hitables with a bounding box, built with a
+// binned surface area heuristic. Takes the same arguments as HitableList and can be used
+// anywhere a HitableList is. When every primitive is a Sphere the leaves are also copied
+// into a SphereSoA in leaf order and intersected with the SIMD kernel.
+//
+// Moving primitives are bounded over [time0, time1] (by default all times), so the tree
+// is valid for rays with times in that interval; pass the camera shutter to get tighter
+// boxes when it is shorter than the motion.
+class BVH: public Hitable  {
+    public:
+        BVH() {}
+        BVH(Hitable **l, int n, int max_leaf_size = 4, bool simd_leaves = true,
+            float time0 = -FLT_MAX, float time1 = FLT_MAX);
+        virtual bool hit(const Ray& r, float tmin, float tmax, hit_record& rec) const;
+        virtual bool occluded(const Ray& r, float tmin, float tmax) const;
+        virtual bool bounding_box(AABB& box) const;
+        virtual void hit_packet(const RayPacket& packet, float t_min, hit_record* recs, bool* hits) const;
+
+        // Recomputes every node's box from the primitives' bounds over [time0, time1],
+        // keeping the tree's topology. Much cheaper than a rebuild for animation frames;
+        // the tree loses quality as primitives drift far from where it was built.
+        void refit(float time0, float time1);
+
+        const BVHBuildStats& stats() const { return build_stats; }
+
+        std::vector<BVHNode> nodes;
+        std::vector<Hitable*> prims;
+        SphereSoA leaf_spheres;
+        bool sphere_leaves;
+
+    private:
+        int max_leaf;
+        BVHBuildStats build_stats;
+};
+
+inline BVH::BVH(Hitable **l, int n, int max_leaf_size, bool simd_leaves, float time0, float time1)
+    : sphere_leaves(false), max_leaf(std::max(1, std::min(max_leaf_size, 255))) {
+    auto start = std::chrono::steady_clock::now();
+    build_stats = BVHBuildStats();
+
+    std::vector<BVHBuildPrim> build_prims;
+    build_prims.reserve(n);
+    for (int i = 0; i < n; i++) {
+        BVHBuildPrim bp;
+        if (!l[i]->swept_box(time0, time1, bp.box))
+            continue;   // unbounded primitives cannot live in a BVH
+        bp.centroid = bp.box.centroid();
+        bp.index = i;
+        build_prims.push_back(bp);
+    }
+
+    BVHBuilder(nodes, build_stats, max_leaf).build(build_prims);
+
+    prims.resize(build_prims.size());
+    for (size_t i = 0; i < build_prims.size(); i++)
+        prims[i] = l[build_prims[i].index];
+
+    if (simd_leaves && !prims.empty()) {
+        leaf_spheres = SphereSoA(prims.data(), int(prims.size()));
+        sphere_leaves = leaf_spheres.size() == int(prims.size());
+        if (!sphere_leaves)
+            leaf_spheres = SphereSoA();
+    }
+
+    build_stats.primitives = int(prims.size());
+    build_stats.nodes = int(nodes.size());
+    build_stats.bytes = nodes.size() * sizeof(BVHNode) + prims.size() * sizeof(Hitable*)
+                      + size_t(leaf_spheres.size()) * (4 * sizeof(float) + sizeof(int));
+    build_stats.build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline int BVHBuilder::make_leaf(int node, int begin, int end) {
+    nodes[node].offset = begin;
+    nodes[node].count = uint16_t(end - begin);
+    stats.leaves++;
+    return node;
+}
+
+inline int BVHBuilder::build(std::vector<BVHBuildPrim>& bp, int begin, int end, int depth) {
+    int node = int(nodes.size());
+    nodes.push_back(BVHNode());
+    stats.max_depth = std::max(stats.max_depth, depth);
+
+    AABB bounds, centroid_bounds;
+    for (int i = begin; i < end; i++) {
+        bounds.expand(bp[i].box);
+        centroid_bounds.expand(bp[i].centroid);
+    }
+    for (int a = 0; a < 3; a++) {
+        nodes[node].bmin[a] = bounds.min()[a];
+        nodes[node].bmax[a] = bounds.max()[a];
+    }
+    nodes[node].count = 0;
+    nodes[node].axis = 0;
+
+    int n = end - begin;
+    if (n == 1)
+        return make_leaf(node, begin, end);
+
+    Vector3 extent = centroid_bounds.max() - centroid_bounds.min();
+    int axis = 0;
+    if (extent[1] > extent[axis]) axis = 1;
+    if (extent[2] > extent[axis]) axis = 2;
+
+    int mid = -1;
+    if (extent[axis] > 0.0f && depth < max_sah_depth) {
+        struct Bin { AABB box; int count = 0; } bins[num_bins];
+        float cmin = centroid_bounds.min()[axis];
+        float scale = num_bins / extent[axis];
+        auto bin_of = [&](const BVHBuildPrim& p) {
+            return std::min(num_bins - 1, int((p.centroid[axis] - cmin) * scale));
+        };
+        for (int i = begin; i < end; i++) {
+            Bin& b = bins[bin_of(bp[i])];
+            b.count++;
+            b.box.expand(bp[i].box);
+        }
+
+        // Sweep from the right to get the right-hand areas, then from the left to evaluate.
+        float right_area[num_bins];
+        int right_count[num_bins];
+        AABB acc;
+        int count = 0;
+        for (int i = num_bins - 1; i > 0; i--) {
+            acc.expand(bins[i].box);
+            count += bins[i].count;
+            right_area[i] = acc.surface_area();
+            right_count[i] = count;
+        }
+
+        float best_cost = FLT_MAX;
+        int best_split = -1;
+        acc = AABB();
+        count = 0;
+        for (int i = 0; i < num_bins - 1; i++) {
+            acc.expand(bins[i].box);
+            count += bins[i].count;
+            if (count == 0 || right_count[i + 1] == 0)
+                continue;
+            float cost = acc.surface_area() * count + right_area[i + 1] * right_count[i + 1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_split = i;
+            }
+        }
+
+        float parent_area = bounds.surface_area();
+        float split_cost = 1.0f + prim_cost * (parent_area > 0.0f ? best_cost / parent_area : float(n));
+        if (n <= max_leaf && (best_split < 0 || split_cost >= prim_cost * float(n)))
+            return make_leaf(node, begin, end);
+
+        if (best_split >= 0) {
+            BVHBuildPrim* m = std::partition(&bp[begin], &bp[0] + end,
+                [&](const BVHBuildPrim& p) { return bin_of(p) <= best_split; });
+            mid = int(m - &bp[0]);
+        }
+    }
+    else if (n <= max_leaf) {
+        return make_leaf(node, begin, end);
+    }
+
+    if (mid <= begin || mid >= end) {
+        // Coincident centroids or a degenerate split: fall back to an object median.
+        mid = begin + n / 2;
+        std::nth_element(&bp[begin], &bp[mid], &bp[0] + end,
+            [axis](const BVHBuildPrim& a, const BVHBuildPrim& b) { return a.centroid[axis] < b.centroid[axis]; });
+    }
+
+    nodes[node].axis = uint16_t(axis);
+    build(bp, begin, mid, depth + 1);
+    int second = build(bp, mid, end, depth + 1);
+    nodes[node].offset = second;
+    return node;
+}
+
+inline void BVH::refit(float time0, float time1) {
+    // Children always follow their parent in the array, so a reverse sweep sees both
+    // children of a node before the node itself.
+    for (int i = int(nodes.size()) - 1; i >= 0; i--) {
+        BVHNode& node = nodes[i];
+        AABB bounds;
+        if (node.count > 0) {
+            for (int k = 0; k < node.count; k++) {
+                AABB box;
+                if (prims[node.offset + k]->swept_box(time0, time1, box))
+                    bounds.expand(box);
+            }
+        }
+        else {
+            const BVHNode* children[2] = { &nodes[i + 1], &nodes[node.offset] };
+            for (const BVHNode* child : children) {
+                bounds.expand(Vector3(child->bmin[0], child->bmin[1], child->bmin[2]));
+                bounds.expand(Vector3(child->bmax[0], child->bmax[1], child->bmax[2]));
+            }
+        }
+        for (int a = 0; a < 3; a++) {
+            node.bmin[a] = bounds.min()[a];
+            node.bmax[a] = bounds.max()[a];
+        }
+    }
+}
+
+inline bool BVH::bounding_box(AABB& box) const {
+    if (nodes.empty())
+        return false;
+    box = AABB(Vector3(nodes[0].bmin[0], nodes[0].bmin[1], nodes[0].bmin[2]),
+               Vector3(nodes[0].bmax[0], nodes[0].bmax[1], nodes[0].bmax[2]));
+    return true;
+}
+
+inline bool BVH::hit(const Ray& r, float t_min, float t_max, hit_record& rec) const {
+    if (nodes.empty())
+        return false;
+
+    bool hit_anything = false;
+    float closest_so_far = t_max;
+    int sphere = -1;
+    uint64_t tested = 0;
+    uint64_t visited = traverse_bvh(nodes.data(), r, t_min, closest_so_far, [&](const BVHNode& node) {
+        if (sphere_leaves) {
+            float t;
+            int i = intersect_spheres(leaf_spheres.cx.data(), leaf_spheres.cy.data(), leaf_spheres.cz.data(),
+                                      leaf_spheres.radius.data(), node.offset, node.offset + node.count,
+                                      r, t_min, closest_so_far, t);
+            if (i >= 0) {
+                hit_anything = true;
+                closest_so_far = t;
+                sphere = i;
+            }
+        }
+        else {
+            for (int i = 0; i < node.count; i++) {
+                if (prims[node.offset + i]->hit(r, t_min, closest_so_far, rec)) {
+                    hit_anything = true;
+                    closest_so_far = rec.t;
+                }
+            }
+        }
+        tested += node.count;
+        return false;
+    });
+    if (sphere >= 0)
+        leaf_spheres.fill_record(sphere, r, closest_so_far, rec);
+
+    PICORAY_COUNT(bvh_traversals, 1);
+    PICORAY_COUNT(bvh_nodes_visited, visited);
+    PICORAY_COUNT(intersection_tests, tested);
+    return hit_anything;
+}
+
+// Same traversal as hit(), but the interval never shrinks and the first leaf with any
+// intersection ends the query.
+inline bool BVH::occluded(const Ray& r, float t_min, float t_max) const {
+    if (nodes.empty())
+        return false;
+
+    bool blocked = false;
+    uint64_t tested = 0;
+    uint64_t visited = traverse_bvh(nodes.data(), r, t_min, t_max, [&](const BVHNode& node) {
+        if (sphere_leaves) {
+            tested += node.count;
+            blocked = leaf_spheres.occluded_range(r, node.offset, node.offset + node.count, t_min, t_max);
+        }
+        else {
+            for (int i = 0; i < node.count && !blocked; i++) {
+                tested++;
+                blocked = prims[node.offset + i]->occluded(r, t_min, t_max);
+            }
+        }
+        return blocked;
+    });
+
+    PICORAY_COUNT(bvh_traversals, 1);
+    PICORAY_COUNT(bvh_nodes_visited, visited);
+    PICORAY_COUNT(intersection_tests, tested);
+    return blocked;
+}
+
+// Packet traversal: every node's slab test runs for all lanes at once (a fixed-width loop
+// the compiler vectorizes) and the packet descends while any lane still overlaps the
+// node. Children are ordered by the direction of the first live ray.
+inline void BVH::hit_packet(const RayPacket& packet, float t_min, hit_record* recs, bool* hits) const {
+    const int W = RayPacket::width;
+    float ox[W], oy[W], oz[W], ix[W], iy[W], iz[W], tfar[W];
+    for (int l = 0; l < W; l++) {
+        bool live = l < packet.count;
+        const Ray& r = packet.rays[live ? l : 0];
+        ox[l] = r.origin()[0];
+        oy[l] = r.origin()[1];
+        oz[l] = r.origin()[2];
+        ix[l] = 1.0f / r.direction()[0];
+        iy[l] = 1.0f / r.direction()[1];
+        iz[l] = 1.0f / r.direction()[2];
+        tfar[l] = live ? packet.t_max[l] : -FLT_MAX;
+        if (live)
+            hits[l] = false;
+    }
+    if (nodes.empty() || packet.count == 0)
+        return;
+
+    const bool negative[3] = { ix[0] < 0.0f, iy[0] < 0.0f, iz[0] < 0.0f };
+    int sphere[W];      // nearest sphere so far per lane, its record filled in at the end
+    for (int l = 0; l < W; l++)
+        sphere[l] = -1;
+    int stack[128];
+    int sp = 0;
+    int current = 0;
+    uint64_t visited = 0, tested = 0;
+
+    for (;;) {
+        const BVHNode& node = nodes[current];
+        visited++;
+
+        int overlap[W];
+        int any = 0;
+        for (int l = 0; l < W; l++) {
+            float tx0 = (node.bmin[0] - ox[l]) * ix[l], tx1 = (node.bmax[0] - ox[l]) * ix[l];
+            float ty0 = (node.bmin[1] - oy[l]) * iy[l], ty1 = (node.bmax[1] - oy[l]) * iy[l];
+            float tz0 = (node.bmin[2] - oz[l]) * iz[l], tz1 = (node.bmax[2] - oz[l]) * iz[l];
+            float tnear = ffmax(ffmax(ffmin(tx0, tx1), ffmin(ty0, ty1)), ffmax(ffmin(tz0, tz1), t_min));
+            float tout = ffmin(ffmin(ffmax(tx0, tx1), ffmax(ty0, ty1)), ffmin(ffmax(tz0, tz1), tfar[l]));
+            overlap[l] = tnear <= tout;
+            any |= overlap[l];
+        }
+
+        if (any) {
+            if (node.count > 0) {
+                for (int l = 0; l < packet.count; l++) {
+                    if (!overlap[l])
+                        continue;
+                    const Ray& r = packet.rays[l];
+                    if (sphere_leaves) {
+                        float t;
+                        int i = intersect_spheres(leaf_spheres.cx.data(), leaf_spheres.cy.data(), leaf_spheres.cz.data(),
+                                                  leaf_spheres.radius.data(), node.offset, node.offset + node.count,
+                                                  r, t_min, tfar[l], t);
+                        if (i >= 0) {
+                            hits[l] = true;
+                            tfar[l] = t;
+                            sphere[l] = i;
+                        }
+                    }
+                    else {
+                        for (int i = 0; i < node.count; i++) {
+                            if (prims[node.offset + i]->hit(r, t_min, tfar[l], recs[l])) {
+                                hits[l] = true;
+                                tfar[l] = recs[l].t;
+                            }
+                        }
+                    }
+                    tested += node.count;
+                }
+            }
+            else {
+                if (negative[node.axis]) {
+                    stack[sp++] = current + 1;
+                    current = node.offset;
+                }
+                else {
+                    stack[sp++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+
+        if (sp == 0)
+            break;
+        current = stack[--sp];
+    }
+    for (int l = 0; l < packet.count; l++) {
+        if (sphere[l] >= 0)
+            leaf_spheres.fill_record(sphere[l], packet.rays[l], tfar[l], recs[l]);
+    }
+
+    PICORAY_COUNT(bvh_traversals, packet.count);
+    PICORAY_COUNT(bvh_nodes_visited, visited);
+    PICORAY_COUNT(intersection_tests, tested);
+}
+
+#endif
@@ -4,22 +4,19 @@
 #define _USE_MATH_DEFINES // TODO: get rid of this
 #include <math.h>
 #include "Ray.h"
-#include "Random.h"
-
-Vector3 random_in_unit_disk() {
-    Vector3 p;
-    do {
-        p = 2.0*Vector3(drand48(),drand48(),0) - Vector3(1,1,0);
-    } while (dot(p,p) >= 1.0);
-    return p;
-}
+#include "Sampler.h"
 
 class Camera {
     public:
-        Camera(Vector3 lookfrom, Vector3 lookat, Vector3 vup, float vfov, float aspect, float aperture, float focus_dist) { // vfov is top to bottom in degrees
+        // vfov is top to bottom in degrees. Rays get a time uniformly drawn from the
+        // shutter interval [t0, t1]; with t0 == t1 every ray is at t0.
+        Camera(Vector3 lookfrom, Vector3 lookat, Vector3 vup, float vfov, float aspect, float aperture, float focus_dist,
+               float t0 = 0.0f, float t1 = 0.0f) {
             lens_radius = aperture / 2;
-            float theta = vfov*M_PI/180;
-            float half_height = tan(theta/2);
+            time0 = t0;
+            time1 = t1;
+            float theta = vfov*float(M_PI)/180.0f;
+            half_height = tanf(theta/2.0f);
             float half_width = aspect * half_height;
             origin = lookfrom;
             w = unit_vector(lookfrom - lookat);
@@ -30,10 +27,14 @@ class Camera {
             vertical = 2*half_height*focus_dist*v;
         }
         Ray getRay(float s, float t) {
-            Vector3 rd = lens_radius*random_in_unit_disk();
+            Vector3 rd = lens_radius*sample_disk(sample_2d());
             Vector3 offset = u * rd.x() + v * rd.y();
-            return Ray(origin + offset, lower_left_corner + s*horizontal + t*vertical - origin - offset); 
+            float time = time1 > time0 ? time0 + sample_1d()*(time1 - time0) : time0;
+            return Ray(origin + offset, lower_left_corner + s*horizontal + t*vertical - origin - offset, time);
         }
+        // Angle a pixel subtends when the image is 'height' pixels tall: the spread of
+        // a camera ray seen as a cone.
+        float pixel_spread(int height) const { return 2.0f * half_height / float(height); }
 
         Vector3 origin;
         Vector3 lower_left_corner;
@@ -41,5 +42,7 @@ class Camera {
         Vector3 vertical;
         Vector3 u, v, w;
         float lens_radius;
+        float half_height;
+        float time0, time1;
 };
 #endif
\ No newline at end of file
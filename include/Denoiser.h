@@ -0,0 +1,121 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include <vector>
+
+#include "Framebuffer.h"
+#include "Integrator.h"
+#include "TileScheduler.h"
+
+// First-hit guide buffers for the denoiser, summed over every sample of a pixel like the
+// framebuffer sums colour, along with the directly seen emission. Depth is kept as
+// inverse distance, so rays that miss average in as 0 and a plane's depth stays linear
+// across the screen.
+class AuxBuffers {
+    public:
+        AuxBuffers(int width, int height);
+
+        int width() const { return w; }
+        int height() const { return h; }
+
+        // Adds the sum of n samples' guide values; 'inverse_depth' is the sum of 1/depth.
+        void add(int x, int y, const Vector3& albedo, const Vector3& normal, const Vector3& emission,
+                 float inverse_depth, int n) {
+            size_t i = size_t(y) * w + x;
+            albedo_sum[i] += albedo;
+            normal_sum[i] += normal;
+            emission_sum[i] += emission;
+            inverse_depth_sum[i] += inverse_depth;
+            counts[i] += n;
+        }
+
+        Vector3 albedo(int x, int y) const { return mean(albedo_sum, x, y); }
+        Vector3 normal(int x, int y) const { return mean(normal_sum, x, y); }
+        Vector3 emission(int x, int y) const { return mean(emission_sum, x, y); }
+        float inverse_depth(int x, int y) const {
+            size_t i = size_t(y) * w + x;
+            return counts[i] ? inverse_depth_sum[i] / float(counts[i]) : 0.0f;
+        }
+
+        // Not safe while workers are writing.
+        void clear();
+        // Only the tile's owner may call this.
+        void clear(const Tile& tile);
+
+    private:
+        Vector3 mean(const std::vector<Vector3>& sums, int x, int y) const {
+            size_t i = size_t(y) * w + x;
+            return counts[i] ? sums[i] / float(counts[i]) : Vector3(0, 0, 0);
+        }
+
+        int w, h;
+        std::vector<Vector3> albedo_sum;
+        std::vector<Vector3> normal_sum;
+        std::vector<Vector3> emission_sum;
+        std::vector<float> inverse_depth_sum;
+        std::vector<uint32_t> counts;
+};
+
+inline AuxBuffers::AuxBuffers(int width, int height)
+    : w(width), h(height), albedo_sum(size_t(width) * height, Vector3(0, 0, 0)),
+      normal_sum(size_t(width) * height, Vector3(0, 0, 0)), emission_sum(size_t(width) * height, Vector3(0, 0, 0)),
+      inverse_depth_sum(size_t(width) * height, 0.0f),
+      counts(size_t(width) * height, 0) {}
+
+inline void AuxBuffers::clear() {
+    std::fill(albedo_sum.begin(), albedo_sum.end(), Vector3(0, 0, 0));
+    std::fill(normal_sum.begin(), normal_sum.end(), Vector3(0, 0, 0));
+    std::fill(emission_sum.begin(), emission_sum.end(), Vector3(0, 0, 0));
+    std::fill(inverse_depth_sum.begin(), inverse_depth_sum.end(), 0.0f);
+    std::fill(counts.begin(), counts.end(), 0u);
+}
+
+inline void AuxBuffers::clear(const Tile& tile) {
+    for (int y = tile.y0; y < tile.y1; y++) {
+        size_t row = size_t(y) * w;
+        for (int x = tile.x0; x < tile.x1; x++) {
+            albedo_sum[row + x] = Vector3(0, 0, 0);
+            normal_sum[row + x] = Vector3(0, 0, 0);
+            emission_sum[row + x] = Vector3(0, 0, 0);
+            inverse_depth_sum[row + x] = 0.0f;
+            counts[row + x] = 0;
+        }
+    }
+}
+
+inline void add_aux_samples(AuxBuffers& aux, int x, int y, const AuxSample* samples, int n) {
+    Vector3 albedo(0, 0, 0), normal(0, 0, 0), emission(0, 0, 0);
+    float inverse_depth = 0.0f;
+    for (int s = 0; s < n; s++) {
+        albedo += samples[s].albedo;
+        normal += samples[s].normal;
+        emission += samples[s].emission;
+        inverse_depth += 1.0f / samples[s].depth;
+    }
+    aux.add(x, y, albedo, normal, emission, inverse_depth, n);
+}
+
+struct DenoiseOptions {
+    DenoiseOptions() : iterations(3), sigma_color(8.0f), sigma_normal(1.0f), sigma_depth(4.0f) {}
+
+    int iterations;         // filter passes, the footprint doubles with each
+    float sigma_color;      // luminance difference allowed, in standard deviations of the noise
+    float sigma_normal;     // normal difference allowed
+    float sigma_depth;      // inverse depth difference allowed, relative to its screen gradient
+};
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010, with the variance-guided
+// colour weight of SVGF). Directly seen emission is taken out and the rest divided by the
+// albedo first, so lights, the background and albedo detail stay sharp and only the
+// lighting is blurred, then each pass applies a 5x5 B3-spline kernel with its taps 2^pass
+// pixels apart. Taps are weighted down by their normal, depth and luminance difference to
+// the centre pixel; luminance differences are measured against the sample variance of the
+// pixels, carried through the passes, so converged pixels are left alone. Rows are
+// filtered one tap at a time over float planes, which the compiler vectorizes, and tiles
+// run in parallel on 'scheduler'.
+//
+// 'in' must hold at least one sample per pixel; 'out' receives the filtered image.
+void denoise(const Framebuffer& in, const AuxBuffers& aux, const DenoiseOptions& options,
+             TileScheduler& scheduler, Framebuffer& out);
+
+#endif
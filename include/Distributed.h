@@ -0,0 +1,89 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "Framebuffer.h"
+#include "Stats.h"
+#include "TileScheduler.h"
+
+// Distributed rendering over local worker processes. The coordinator runs one worker
+// process per TileScheduler thread; each thread sends its tiles to its worker as jobs
+// and adds the returned sample sums to the framebuffer, so work stealing balances the
+// processes exactly as it balances threads. Workers are the same renderer started with
+// the same scene and integrator options, reading jobs on stdin and answering on stdout.
+// Sampling is seeded per pixel, so the image is identical to an in-process render.
+//
+// The protocol is fixed-size binary records in the machine's byte order, which is fine
+// for processes on one host.
+
+// One tile of one frame, with the samples to take per pixel.
+struct TileJob {
+    uint32_t magic;
+    int32_t frame;
+    int32_t tile;
+    int32_t x0, y0, x1, y1;
+    int32_t samples;
+    int32_t sample_offset;
+};
+
+// Worker side: owns stdin and stdout. Everything the renderer logs to stdout is sent to
+// /dev/null from construction on, so it cannot corrupt the result stream.
+class TileWorkerChannel {
+    public:
+        TileWorkerChannel();
+
+        // False once the coordinator has closed the job stream.
+        bool next_job(TileJob& job);
+        // Sends the tile's sample sums from 'fb' along with, and then resets, the render
+        // counters gathered since the last result.
+        bool send_result(const TileJob& job, const Framebuffer& fb);
+
+    private:
+        int in_fd;
+        int out_fd;
+};
+
+// Coordinator side. Worker processes are started on first use, each one running
+// 'command' (argv, program first).
+class TileCoordinator {
+    public:
+        TileCoordinator(const std::vector<std::string>& command, int num_workers);
+        ~TileCoordinator();
+
+        int num_workers() const { return int(workers.size()); }
+
+        // Renders 'job' on worker 'index' and adds the result to 'fb'. A worker that dies,
+        // sends garbage or exceeds the timeout is killed, restarted and given the job
+        // again, up to max_attempts times; false if the tile still did not render. Calls
+        // for different workers may run concurrently.
+        bool run(int index, const TileJob& job, Framebuffer& fb);
+
+        int restarts() const { return restart_count.load(); }
+
+        int max_attempts;
+        double timeout_seconds;     // per job, including a new worker's start-up; 0 waits forever
+        // Testing aid: the first process of worker 0 is told to exit after this many tiles.
+        int crash_after;
+
+    private:
+        struct Worker {
+            int pid;
+            int job_fd;
+            int result_fd;
+            int started;
+        };
+
+        bool spawn(int index);
+        void stop(int index, bool kill_process);
+        bool exchange(int index, const TileJob& job, Framebuffer& fb);
+
+        std::vector<std::string> command;
+        std::vector<Worker> workers;
+        std::atomic<int> restart_count;
+};
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <float.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "Vector3.h"
+#include "TileScheduler.h"
+
+// Packs a linear colour into an opaque ARGB8888 pixel with gamma 2 applied.
+inline uint32_t pack_argb(const Vector3& col) {
+    uint32_t r = uint32_t(255.99f*sqrtf(fminf(fmaxf(col[0], 0.0f), 1.0f)));
+    uint32_t g = uint32_t(255.99f*sqrtf(fminf(fmaxf(col[1], 0.0f), 1.0f)));
+    uint32_t b = uint32_t(255.99f*sqrtf(fminf(fmaxf(col[2], 0.0f), 1.0f)));
+    return (0xffu << 24) | (r << 16) | (g << 8) | b;
+}
+
+inline float luminance(const Vector3& c) {
+    return 0.2126f*c[0] + 0.7152f*c[1] + 0.0722f*c[2];
+}
+
+// ARGB8888 display image, plus the linear sample sums it is the running average of,
+// shared between the render workers and the display thread without locks. A worker owns
+// a tile while writing it and hands it over with publish(); the display thread drains
+// the completion queue with next_dirty() and uploads only those rectangles.
+//
+// The queue is a ring with one slot per tile. A tile is only enqueued when its dirty
+// flag goes from 0 to 1 and the flag is cleared by the consumer after dequeuing, so there
+// are never more entries in flight than there are tiles.
+class Framebuffer {
+    public:
+        Framebuffer(int width, int height, const std::vector<Tile>& tiles);
+
+        int width() const { return w; }
+        int height() const { return h; }
+        int pitch() const { return w * 4; }
+        uint32_t* data() { return pixels.data(); }
+        const uint32_t* data() const { return pixels.data(); }
+        uint32_t* pixel(int x, int y) { return &pixels[size_t(y) * w + x]; }
+        const uint32_t* pixel(int x, int y) const { return &pixels[size_t(y) * w + x]; }
+
+        // Mean of the samples accumulated so far.
+        Vector3 linear_pixel(int x, int y) const {
+            size_t i = size_t(y) * w + x;
+            return counts[i] ? accum[i] / float(counts[i]) : Vector3(0, 0, 0);
+        }
+        int sample_count(int x, int y) const { return int(counts[size_t(y) * w + x]); }
+        // Raw sums behind the mean, as passed to add_samples().
+        const Vector3& sample_sum(int x, int y) const { return accum[size_t(y) * w + x]; }
+        float luminance_sq_sum(int x, int y) const { return accum_sq[size_t(y) * w + x]; }
+
+        void set_pixel(int x, int y, const Vector3& col) {
+            size_t i = size_t(y) * w + x;
+            accum[i] = col;
+            accum_sq[i] = luminance(col) * luminance(col);
+            counts[i] = 1;
+            pixels[i] = pack_argb(col);
+        }
+
+        // Adds the sum of n new samples, and the sum of their squared luminances, and
+        // refreshes the display pixel from the average.
+        void add_samples(int x, int y, const Vector3& sum, float luminance_sq_sum, int n) {
+            size_t i = size_t(y) * w + x;
+            accum[i] += sum;
+            accum_sq[i] += luminance_sq_sum;
+            counts[i] += n;
+            pixels[i] = pack_argb(accum[i] / float(counts[i]));
+        }
+
+        // Standard error of the pixel's mean luminance relative to that mean. Dark pixels
+        // are measured against a floor of 0.01 so they are not refined forever.
+        float relative_error(int x, int y) const;
+
+        // Drops all accumulated samples. Not safe while workers are writing.
+        void clear();
+        // Drops the samples of one tile; only the tile's owner may call this.
+        void clear(const Tile& tile);
+
+        // Producer side, called by the worker that owns the tile.
+        void publish(const Tile& tile);
+        // Consumer side, single display thread only.
+        bool next_dirty(Tile& tile);
+
+        bool is_dirty(int tile_index) const { return dirty[tile_index].load(std::memory_order_acquire) != 0; }
+
+    private:
+        int w, h;
+        std::vector<uint32_t> pixels;
+        std::vector<Vector3> accum;
+        std::vector<float> accum_sq;
+        std::vector<uint32_t> counts;
+        std::vector<Tile> tiles;
+
+        std::unique_ptr<std::atomic<uint8_t>[]> dirty;
+        std::unique_ptr<std::atomic<int>[]> slots;
+        std::atomic<unsigned int> tail;
+        unsigned int head;
+};
+
+inline Framebuffer::Framebuffer(int width, int height, const std::vector<Tile>& t)
+    : w(width), h(height), pixels(size_t(width) * height, 0xff000000u),
+      accum(size_t(width) * height, Vector3(0, 0, 0)), accum_sq(size_t(width) * height, 0.0f),
+      counts(size_t(width) * height, 0), tiles(t),
+      dirty(new std::atomic<uint8_t>[t.size()]), slots(new std::atomic<int>[t.size()]),
+      tail(0), head(0) {
+    for (size_t i = 0; i < tiles.size(); i++) {
+        dirty[i].store(0, std::memory_order_relaxed);
+        slots[i].store(-1, std::memory_order_relaxed);
+    }
+}
+
+inline void Framebuffer::clear() {
+    std::fill(pixels.begin(), pixels.end(), 0xff000000u);
+    std::fill(accum.begin(), accum.end(), Vector3(0, 0, 0));
+    std::fill(accum_sq.begin(), accum_sq.end(), 0.0f);
+    std::fill(counts.begin(), counts.end(), 0u);
+}
+
+inline void Framebuffer::clear(const Tile& tile) {
+    for (int y = tile.y0; y < tile.y1; y++) {
+        size_t row = size_t(y) * w;
+        for (int x = tile.x0; x < tile.x1; x++) {
+            pixels[row + x] = 0xff000000u;
+            accum[row + x] = Vector3(0, 0, 0);
+            accum_sq[row + x] = 0.0f;
+            counts[row + x] = 0;
+        }
+    }
+}
+
+inline float Framebuffer::relative_error(int x, int y) const {
+    size_t i = size_t(y) * w + x;
+    float n = float(counts[i]);
+    if (n < 2.0f)
+        return FLT_MAX;
+    float mean = luminance(accum[i]) / n;
+    float variance = fmaxf(0.0f, (accum_sq[i] / n - mean*mean) * n / (n - 1.0f));
+    return sqrtf(variance / n) / fmaxf(mean, 0.01f);
+}
+
+inline void Framebuffer::publish(const Tile& tile) {
+    if (dirty[tile.index].exchange(1, std::memory_order_acq_rel))
+        return;     // still queued from an earlier publish, the consumer will pick up the new pixels
+    unsigned int pos = tail.fetch_add(1, std::memory_order_relaxed);
+    slots[pos % tiles.size()].store(tile.index, std::memory_order_release);
+}
+
+inline bool Framebuffer::next_dirty(Tile& tile) {
+    if (tiles.empty())
+        return false;
+    std::atomic<int>& slot = slots[head % tiles.size()];
+    int index = slot.load(std::memory_order_acquire);
+    if (index < 0)
+        return false;
+    slot.store(-1, std::memory_order_relaxed);
+    head++;
+    dirty[index].store(0, std::memory_order_release);
+    tile = tiles[index];
+    return true;
+}
+
+#endif
@@ -2,20 +2,46 @@
 #define HITABLE_H 
 
 #include "Ray.h"
-
-class Material;
+#include "AABB.h"
+#include "RayPacket.h"
 
 struct hit_record
 {
     float t;  
     Vector3 p;
     Vector3 normal; 
-    Material *mat_ptr;
+    int material;   // index into the scene's material arena
+    // For texture mapping: the normal in the primitive's own space, which instances leave
+    // untransformed, and the primitive's size (a sphere's radius) in world units, which
+    // relates footprints to texture space. Size 0 means unknown.
+    Vector3 local_normal;
+    float size;
 };
 
 class Hitable  {
     public:
+        virtual ~Hitable() {}
         virtual bool hit(const Ray& r, float t_min, float t_max, hit_record& rec) const = 0;
+        virtual bool bounding_box(AABB& box) const = 0;
+        // Bounds of everywhere the primitive is at times in [t0, t1]. Static primitives
+        // return their box; moving ones can be tighter than bounding_box(), which covers
+        // all times.
+        virtual bool swept_box(float /*t0*/, float /*t1*/, AABB& box) const { return bounding_box(box); }
+
+        // Any-hit query for shadow and occlusion rays: true as soon as anything is found in
+        // (t_min, t_max), without computing surface data. Implementations stop at the first
+        // intersection; the default falls back to hit().
+        virtual bool occluded(const Ray& r, float t_min, float t_max) const {
+            hit_record rec;
+            return hit(r, t_min, t_max, rec);
+        }
+
+        // Closest hit for every live lane of a packet; hits[i] tells whether recs[i] is set.
+        // Acceleration structures override this to share traversal work between the rays.
+        virtual void hit_packet(const RayPacket& packet, float t_min, hit_record* recs, bool* hits) const {
+            for (int i = 0; i < packet.count; i++)
+                hits[i] = hit(packet.rays[i], t_min, packet.t_max[i], recs[i]);
+        }
 };
 
 #endif
\ No newline at end of file
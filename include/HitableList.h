@@ -2,20 +2,24 @@
 #define HITABLELIST_H
 
 #include "Hitable.h"
+#include "Stats.h"
 
 class HitableList: public Hitable  {
     public:
         HitableList() {}
         HitableList(Hitable **l, int n) {list = l; list_size = n; }
         virtual bool hit(const Ray& r, float tmin, float tmax, hit_record& rec) const;
+        virtual bool occluded(const Ray& r, float tmin, float tmax) const;
+        virtual bool bounding_box(AABB& box) const;
         Hitable **list;
         int list_size;
 };
 
-bool HitableList::hit(const Ray& r, float t_min, float t_max, hit_record& rec) const {
+inline bool HitableList::hit(const Ray& r, float t_min, float t_max, hit_record& rec) const {
+        PICORAY_COUNT(intersection_tests, list_size);
         hit_record temp_rec;
         bool hit_anything = false;
-        double closest_so_far = t_max;
+        float closest_so_far = t_max;
         for (int i = 0; i < list_size; i++) {
             if (list[i]->hit(r, t_min, closest_so_far, temp_rec)) {
                 hit_anything = true;
@@ -26,4 +30,26 @@ bool HitableList::hit(const Ray& r, float t_min, float t_max, hit_record& rec) c
         return hit_anything;
 }
 
+inline bool HitableList::occluded(const Ray& r, float t_min, float t_max) const {
+    for (int i = 0; i < list_size; i++) {
+        if (list[i]->occluded(r, t_min, t_max)) {
+            PICORAY_COUNT(intersection_tests, i + 1);
+            return true;
+        }
+    }
+    PICORAY_COUNT(intersection_tests, list_size);
+    return false;
+}
+
+inline bool HitableList::bounding_box(AABB& box) const {
+    box = AABB();
+    for (int i = 0; i < list_size; i++) {
+        AABB temp_box;
+        if (!list[i]->bounding_box(temp_box))
+            return false;
+        box.expand(temp_box);
+    }
+    return list_size > 0;
+}
+
 #endif
\ No newline at end of file
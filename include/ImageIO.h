@@ -0,0 +1,15 @@
+#ifndef IMAGEIO_H
+#define IMAGEIO_H
+
+#include "Framebuffer.h"
+
+// 8-bit gamma corrected output.
+bool write_ppm(const char* path, const Framebuffer& fb);
+bool write_png(const char* path, const Framebuffer& fb);
+// Linear float output, rows stored bottom to top as the format requires.
+bool write_pfm(const char* path, const Framebuffer& fb);
+
+// Picks the writer from the file extension (.ppm, .png or .pfm).
+bool write_image(const char* path, const Framebuffer& fb);
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <vector>
+
+#include "BVH.h"
+#include "Hitable.h"
+#include "Sphere.h"
+#include "Transform.h"
+#include "TriangleMesh.h"
+
+// Geometry shared by any number of Instances: spheres and meshes in a local space of
+// their own, with their own BVH. This is the lower level of a two-level hierarchy, so
+// the memory for a group is paid once however often it is placed.
+class Group: public Hitable  {
+    public:
+        Group() {}
+        Group(const Group&) = delete;
+        Group& operator=(const Group&) = delete;
+
+        void add_sphere(const Vector3& center, float radius, int material) {
+            spheres.push_back(Sphere(center, radius, material));
+        }
+        // Takes the mesh's buffers; its BVH must already be built.
+        void add_mesh(TriangleMesh&& mesh) { meshes.push_back(std::move(mesh)); }
+
+        // Builds the group's BVH. Call once everything is added; the group must not change
+        // afterwards.
+        void build(int max_leaf_size = 4);
+
+        int num_primitives() const { return int(spheres.size() + meshes.size()); }
+        // Primitive, mesh and BVH storage.
+        size_t memory_bytes() const;
+
+        virtual bool hit(const Ray& r, float t_min, float t_max, hit_record& rec) const {
+            return bvh.hit(r, t_min, t_max, rec);
+        }
+        virtual bool occluded(const Ray& r, float t_min, float t_max) const {
+            return bvh.occluded(r, t_min, t_max);
+        }
+        virtual bool bounding_box(AABB& box) const { return bvh.bounding_box(box); }
+
+        std::vector<Sphere> spheres;
+        std::vector<TriangleMesh> meshes;
+
+    private:
+        std::vector<Hitable*> prim_ptrs;
+        BVH bvh;
+};
+
+inline void Group::build(int max_leaf_size) {
+    prim_ptrs.clear();
+    for (Sphere& s : spheres)
+        prim_ptrs.push_back(&s);
+    for (TriangleMesh& m : meshes)
+        prim_ptrs.push_back(&m);
+    bvh = BVH(prim_ptrs.data(), int(prim_ptrs.size()), max_leaf_size);
+}
+
+inline size_t Group::memory_bytes() const {
+    size_t bytes = spheres.capacity() * sizeof(Sphere) + meshes.capacity() * sizeof(TriangleMesh)
+                 + prim_ptrs.capacity() * sizeof(Hitable*) + bvh.stats().bytes;
+    for (const TriangleMesh& m : meshes)
+        bytes += m.memory_bytes();
+    return bytes;
+}
+
+// A Group placed in the scene by an affine map. Rays are taken into the group's space
+// rather than the group into world space, and since the map is affine the hit distance
+// is the same in both, so only the point and normal need mapping back. Only the inverse
+// map, the world box and the map's scale are stored, which keeps an instance under 100
+// bytes.
+class Instance: public Hitable  {
+    public:
+        Instance() {}
+        // 'material' replaces the group's materials on every hit unless it is negative.
+        Instance(const Group* group, const Affine& to_world, int material = -1);
+
+        Affine to_world() const { return to_local.inverse(); }
+
+        virtual bool hit(const Ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual bool occluded(const Ray& r, float t_min, float t_max) const;
+        virtual bool bounding_box(AABB& b) const {
+            b = box;
+            return !box.empty();
+        }
+
+        const Group* group;
+        Affine to_local;
+        AABB box;
+        int material;
+        float scale;    // cube root of the volume scaling, for hit_record::size
+};
+
+inline Instance::Instance(const Group* g, const Affine& to_world, int m)
+    : group(g), to_local(to_world.inverse()), material(m), scale(cbrtf(fabsf(to_world.determinant()))) {
+    AABB local;
+    if (group->bounding_box(local))
+        box = to_world.box(local);
+}
+
+inline bool Instance::hit(const Ray& r, float t_min, float t_max, hit_record& rec) const {
+    Ray local(to_local.point(r.origin()), to_local.vector(r.direction()), r.time());
+    if (!group->hit(local, t_min, t_max, rec))
+        return false;
+    rec.p = r.point_at_parameter(rec.t);
+    rec.normal = unit_vector(to_local.transposed_vector(rec.normal));
+    rec.size *= scale;
+    if (material >= 0)
+        rec.material = material;
+    return true;
+}
+
+inline bool Instance::occluded(const Ray& r, float t_min, float t_max) const {
+    Ray local(to_local.point(r.origin()), to_local.vector(r.direction()), r.time());
+    return group->occluded(local, t_min, t_max);
+}
+
+#endif
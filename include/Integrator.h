@@ -0,0 +1,425 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include <float.h>
+#include <algorithm>
+#include <vector>
+
+#include "Hitable.h"
+#include "Material.h"
+#include "Scene.h"
+#include "Sampler.h"
+#include "Stats.h"
+
+// Sky gradient seen by rays that leave the scene, or black for scenes lit only by their
+// emissive materials.
+inline Vector3 background(const Ray& r, const Scene& scene) {
+    if (!scene.sky)
+        return Vector3(0, 0, 0);
+    Vector3 unit_direction = unit_vector(r.direction());
+    float t = 0.5f*(unit_direction.y() + 1.0f);
+    return (1.0f-t)*Vector3(1.0f, 1.0f, 1.0f) + t*Vector3(0.5f, 0.7f, 1.0f);
+}
+
+// What a camera ray sees, for guiding the denoiser: the albedo, normal and distance of
+// its first hit, and the light it sees there directly, which the denoiser leaves out of
+// the filtering. Rays that escape report the background as albedo, no normal and a
+// distance of 1e30; lights report white.
+struct AuxSample {
+    Vector3 albedo;
+    Vector3 normal;
+    Vector3 emission;
+    float depth;
+};
+
+// Glass and perfect mirrors show the scene behind them rather than a surface of their
+// own, so integrators that can follow them replace the albedo and normal with those of
+// the next vertex, tinted by the mirror, and keep the first hit's distance.
+inline bool guide_through(const Material& m) {
+    return m.type == MATERIAL_METAL && m.fuzz == 0.0f;
+}
+
+// 'first' is set for the camera ray's own hit; 'tint' is the path throughput so far.
+inline void record_aux(AuxSample& aux, const Ray& r, const hit_record* rec, const Scene& scene,
+                       const Vector3& tint = Vector3(1, 1, 1), bool first = true) {
+    if (!rec) {
+        aux.albedo = tint * background(r, scene);
+        aux.normal = Vector3(0, 0, 0);
+        aux.emission = Vector3(0, 0, 0);
+        if (first)
+            aux.depth = 1e30f;
+        return;
+    }
+    Material m = scene.shade(r, *rec);
+    bool white = m.type == MATERIAL_DIELECTRIC || is_emissive(m);
+    aux.albedo = tint * (white ? Vector3(1, 1, 1) : m.albedo);
+    aux.normal = rec->normal;
+    aux.emission = is_emissive(m) ? tint * emitted(m) : Vector3(0, 0, 0);
+    if (first)
+        aux.depth = rec->t * r.direction().length();
+}
+
+inline Vector3 color(const Ray& r, const Scene& scene, int depth) {
+    if (depth > 0)
+        PICORAY_COUNT(secondary_rays, 1);
+    hit_record rec;
+    if (scene.world()->hit(r, 0.001f, FLT_MAX , rec)) { 
+        if (is_emissive(scene.material(rec.material))) {
+            count_path_depth(depth);
+            return emitted(scene.material(rec.material));
+        }
+        Ray scattered;
+        Vector3 attenuation;
+        start_bounce(depth);
+        if (depth < 50 && scatter(scene.shade(r, rec), r, rec, attenuation, scattered)) {
+             return attenuation*color(scattered, scene, depth+1);
+        }
+        else {
+            count_path_depth(depth);
+            return Vector3(0,0,0);
+        }
+    }
+    else {
+        count_path_depth(depth);
+        return background(r, scene);
+    }
+}
+
+inline float power_heuristic(float pdf, float other_pdf) {
+    return pdf*pdf / (pdf*pdf + other_pdf*other_pdf);
+}
+
+// Density, over solid angle at p, of sample_sphere_light() directions; 0 from inside.
+inline float sphere_light_pdf(const Sphere& light, const Vector3& p) {
+    float dist2 = (light.center - p).squared_length();
+    float r2 = light.radius*light.radius;
+    if (dist2 <= r2)
+        return 0.0f;
+    float cos_max = sqrtf(1.0f - r2/dist2);
+    // 1 - cos_max without the cancellation for small or distant lights.
+    float one_minus_cos = (r2/dist2) / (1.0f + cos_max);
+    return 1.0f / (2.0f*3.14159265f*one_minus_cos);
+}
+
+// Picks a direction from p towards the sphere, uniformly over the cone it subtends.
+inline bool sample_sphere_light(const Sphere& light, const Vector3& p, Vector3& direction, float& pdf) {
+    Vector3 d = light.center - p;
+    float dist2 = d.squared_length();
+    float r2 = light.radius*light.radius;
+    if (dist2 <= r2)
+        return false;
+    float cos_max = sqrtf(1.0f - r2/dist2);
+    float one_minus_cos = (r2/dist2) / (1.0f + cos_max);
+    Sample2D sample = sample_2d();
+    float z = 1.0f - sample.u*one_minus_cos;
+    float phi = 2.0f*3.14159265f*sample.v;
+    float s = sqrtf(fmaxf(0.0f, 1.0f - z*z));
+    Vector3 w = d / sqrtf(dist2);
+    Vector3 a = fabsf(w.x()) > 0.9f ? Vector3(0, 1, 0) : Vector3(1, 0, 0);
+    Vector3 v = unit_vector(cross(w, a));
+    Vector3 u = cross(w, v);
+    direction = cosf(phi)*s*u + sinf(phi)*s*v + z*w;
+    pdf = 1.0f / (2.0f*3.14159265f*one_minus_cos);
+    return true;
+}
+
+// The light sphere a hit on an emissive material landed on. Hit records do not carry
+// the primitive, so this matches the hit point against the (few) lights.
+inline const Sphere* find_light(const Scene& scene, const hit_record& rec) {
+    for (int index : scene.lights()) {
+        const Sphere& light = scene.spheres[index];
+        float r = fabsf(light.radius);
+        if (light.material == rec.material && fabsf((rec.p - light.center).length() - r) <= 1e-3f*fmaxf(r, 1.0f))
+            return &light;
+    }
+    return nullptr;
+}
+
+// Next-event estimate at a lambertian hit: one shadow ray towards a randomly chosen light,
+// weighted against BSDF sampling with the power heuristic. Returns radiance before the
+// path throughput is applied. Lights are static, the shadow ray is traced at 'time' so
+// moving occluders are where the path saw them.
+inline Vector3 sample_direct(const Scene& scene, const Material& m, const hit_record& rec, float time) {
+    const std::vector<int>& lights = scene.lights();
+    int pick = std::min(int(sample_1d() * lights.size()), int(lights.size()) - 1);
+    const Sphere& light = scene.spheres[lights[pick]];
+    Vector3 direction;
+    float light_pdf;
+    if (!sample_sphere_light(light, rec.p, direction, light_pdf))
+        return Vector3(0, 0, 0);
+    float cosine = dot(rec.normal, direction);
+    if (cosine <= 0.0f)
+        return Vector3(0, 0, 0);
+
+    Ray shadow(rec.p, direction, time);
+    hit_record light_rec;
+    if (!light.hit(shadow, 0.001f, FLT_MAX, light_rec))
+        return Vector3(0, 0, 0);
+    PICORAY_COUNT(shadow_rays, 1);
+    if (scene.world()->occluded(shadow, 0.001f, light_rec.t * (1.0f - 1e-4f)))
+        return Vector3(0, 0, 0);
+
+    light_pdf /= float(lights.size());
+    float bsdf_pdf = scatter_pdf_lambertian(rec, direction);
+    float weight = power_heuristic(light_pdf, bsdf_pdf);
+    return (weight * bsdf_pdf / light_pdf) * m.albedo * emitted(scene.material(light.material));
+}
+
+// Estimates the radiance arriving along a camera ray.
+class Integrator {
+    public:
+        virtual ~Integrator() {}
+        virtual const char* name() const = 0;
+        // 'aux', when given, receives the guide values of the ray's first hit.
+        virtual Vector3 radiance(const Ray& r, const Scene& scene, AuxSample* aux = nullptr) const = 0;
+
+        // Batched entry point for integrators that trace many rays together. The tile
+        // renderer only uses it when streamed() is true. 'keys' are the camera samples the
+        // rays were made for; 'aux' is null or holds n entries.
+        virtual bool streamed() const { return false; }
+        virtual void radiance_stream(const Ray* rays, const SampleKey* keys, int n, const Scene& scene, Vector3* out,
+                                     AuxSample* aux = nullptr) const {
+            for (int i = 0; i < n; i++) {
+                start_sample(keys[i]);
+                out[i] = radiance(rays[i], scene, aux ? &aux[i] : nullptr);
+            }
+        }
+};
+
+// The original recursive color(), fixed at 50 bounces. Kept as the reference result.
+class RecursiveIntegrator : public Integrator {
+    public:
+        virtual const char* name() const { return "recursive"; }
+        virtual Vector3 radiance(const Ray& r, const Scene& scene, AuxSample* aux = nullptr) const;
+};
+
+// color() does not expose its first hit, so the guide values cost one more ray here.
+inline Vector3 RecursiveIntegrator::radiance(const Ray& r, const Scene& scene, AuxSample* aux) const {
+    if (aux) {
+        hit_record rec;
+        bool hit = scene.world()->hit(r, 0.001f, FLT_MAX, rec);
+        record_aux(*aux, r, hit ? &rec : nullptr, scene);
+    }
+    return color(r, scene, 0);
+}
+
+// Iterative path tracer: carries the path throughput instead of recursing and, from
+// rr_depth bounces on, ends paths with Russian roulette on the throughput so long
+// bounce chains that barely contribute stop early. Survivors are reweighted, so the
+// estimate stays unbiased.
+//
+// When the scene has lights and 'nee' is set, every lambertian hit also samples a light
+// directly (next-event estimation), and emission found by the BSDF-sampled ray is
+// weighted against that with multiple importance sampling. Metal and dielectric bounces
+// are treated as specular: they get no light sample and see emission at full weight.
+class PathIntegrator : public Integrator {
+    public:
+        PathIntegrator(int depth = 50, int rr = 3, bool nee = true) : max_depth(depth), rr_depth(rr), nee(nee) {}
+        virtual const char* name() const { return "path"; }
+        virtual Vector3 radiance(const Ray& r, const Scene& scene, AuxSample* aux = nullptr) const;
+
+        int max_depth;
+        int rr_depth;
+        bool nee;
+};
+
+inline Vector3 PathIntegrator::radiance(const Ray& r, const Scene& scene, AuxSample* aux) const {
+    const Hitable* world = scene.world();
+    bool sample_lights = nee && !scene.lights().empty();
+    Vector3 result(0.0f, 0.0f, 0.0f);
+    Vector3 throughput(1.0f, 1.0f, 1.0f);
+    Ray ray = r;
+    hit_record rec;
+    float bsdf_pdf = 0.0f;  // density 'ray' was sampled with; 0 for camera rays and specular bounces
+    bool guiding = aux != nullptr;
+    for (int depth = 0; ; depth++) {
+        if (depth > 0)
+            PICORAY_COUNT(secondary_rays, 1);
+        start_bounce(depth);
+        bool hit = world->hit(ray, 0.001f, FLT_MAX, rec);
+        if (guiding) {
+            record_aux(*aux, ray, hit ? &rec : nullptr, scene, throughput, depth == 0);
+            guiding = hit && guide_through(scene.material(rec.material));
+        }
+        if (!hit) {
+            count_path_depth(depth);
+            return result + throughput * background(ray, scene);
+        }
+
+        Material material = scene.shade(ray, rec);
+        if (is_emissive(material)) {
+            float weight = 1.0f;
+            if (sample_lights && bsdf_pdf > 0.0f) {
+                const Sphere* light = find_light(scene, rec);
+                if (light)
+                    weight = power_heuristic(bsdf_pdf, sphere_light_pdf(*light, ray.origin()) / float(scene.lights().size()));
+            }
+            count_path_depth(depth);
+            return result + weight * throughput * emitted(material);
+        }
+        if (sample_lights && material.type == MATERIAL_LAMBERTIAN)
+            result += throughput * sample_direct(scene, material, rec, ray.time());
+
+        Ray scattered;
+        Vector3 attenuation;
+        if (depth >= max_depth || !scatter(material, ray, rec, attenuation, scattered)) {
+            count_path_depth(depth);
+            return result;
+        }
+        bsdf_pdf = material.type == MATERIAL_LAMBERTIAN ? scatter_pdf_lambertian(rec, unit_vector(scattered.direction())) : 0.0f;
+        throughput *= attenuation;
+        ray = scattered;
+
+        if (depth >= rr_depth) {
+            float p = fminf(0.95f, fmaxf(throughput[0], fmaxf(throughput[1], throughput[2])));
+            if (sample_1d() >= p) {
+                count_path_depth(depth + 1);
+                return result;
+            }
+            throughput /= p;
+        }
+    }
+}
+
+// Ambient occlusion: the fraction of cosine-weighted directions above the first hit that
+// are open out to 'distance', traced with any-hit occlusion rays. Camera rays that miss
+// see the background.
+class AOIntegrator : public Integrator {
+    public:
+        AOIntegrator(int samples = 8, float distance = 1.0f) : samples(samples), distance(distance) {}
+        virtual const char* name() const { return "ao"; }
+        virtual Vector3 radiance(const Ray& r, const Scene& scene, AuxSample* aux = nullptr) const;
+
+        int samples;
+        float distance;
+};
+
+inline Vector3 AOIntegrator::radiance(const Ray& r, const Scene& scene, AuxSample* aux) const {
+    const Hitable* world = scene.world();
+    hit_record rec;
+    bool hit = world->hit(r, 0.001f, FLT_MAX, rec);
+    if (aux) {
+        record_aux(*aux, r, hit ? &rec : nullptr, scene);
+        if (hit)
+            aux->emission = Vector3(0, 0, 0);   // lights are shaded like any other surface
+    }
+    if (!hit)
+        return background(r, scene);
+
+    int open = 0;
+    start_bounce(0);
+    for (int s = 0; s < samples; s++) {
+        Vector3 direction = unit_vector(sample_cosine_hemisphere(sample_2d(), rec.normal));
+        PICORAY_COUNT(shadow_rays, 1);
+        if (!world->occluded(Ray(rec.p, direction, r.time()), 0.001f, distance))
+            open++;
+    }
+    count_path_depth(1);
+    float v = float(open) / float(samples);
+    return Vector3(v, v, v);
+}
+
+// Wavefront version of PathIntegrator. All rays of a batch advance one bounce at a time:
+// they are intersected in packets of RayPacket::width, then the hits are sorted by
+// material so each material's scatter code runs over a contiguous group, and the
+// surviving secondary rays are repacked in that order for the next bounce. Lights are
+// not sampled directly; emission is only found by the BSDF-sampled rays.
+class StreamIntegrator : public PathIntegrator {
+    public:
+        StreamIntegrator(int depth = 50, int rr = 3) : PathIntegrator(depth, rr, false) {}
+        virtual const char* name() const { return "stream"; }
+        virtual bool streamed() const { return true; }
+        virtual void radiance_stream(const Ray* rays, const SampleKey* keys, int n, const Scene& scene, Vector3* out,
+                                     AuxSample* aux = nullptr) const;
+};
+
+inline void StreamIntegrator::radiance_stream(const Ray* rays, const SampleKey* keys, int n, const Scene& scene,
+                                              Vector3* out, AuxSample* aux) const {
+    struct PathState {
+        Ray ray;
+        Vector3 throughput;
+        int pixel;
+        bool guiding;   // still filling aux[pixel], see guide_through()
+    };
+
+    std::vector<PathState> paths(n), next;
+    std::vector<hit_record> recs(n);
+    std::vector<int> order;
+    next.reserve(n);
+    order.reserve(n);
+    for (int i = 0; i < n; i++) {
+        paths[i].ray = rays[i];
+        paths[i].throughput = Vector3(1.0f, 1.0f, 1.0f);
+        paths[i].pixel = i;
+        paths[i].guiding = aux != nullptr;
+        out[i] = Vector3(0, 0, 0);
+    }
+
+    for (int depth = 0; !paths.empty(); depth++) {
+        int count = int(paths.size());
+        if (depth > 0)
+            PICORAY_COUNT(secondary_rays, count);
+        order.clear();
+        for (int first = 0; first < count; first += RayPacket::width) {
+            RayPacket packet;
+            for (int i = first; i < count && packet.count < RayPacket::width; i++)
+                packet.add(paths[i].ray);
+            bool hits[RayPacket::width];
+            scene.world()->hit_packet(packet, 0.001f, &recs[first], hits);
+            for (int l = 0; l < packet.count; l++) {
+                PathState& path = paths[first + l];
+                if (path.guiding) {
+                    record_aux(aux[path.pixel], path.ray, hits[l] ? &recs[first + l] : nullptr, scene,
+                               path.throughput, depth == 0);
+                    path.guiding = hits[l] && guide_through(scene.material(recs[first + l].material));
+                }
+                if (!hits[l]) {
+                    out[path.pixel] += path.throughput * background(path.ray, scene);
+                    count_path_depth(depth);
+                }
+                else if (is_emissive(scene.material(recs[first + l].material))) {
+                    out[path.pixel] += path.throughput * emitted(scene.material(recs[first + l].material));
+                    count_path_depth(depth);
+                }
+                else if (depth < max_depth) {
+                    order.push_back(first + l);
+                }
+                else {
+                    count_path_depth(depth);
+                }
+            }
+        }
+
+        std::sort(order.begin(), order.end(),
+            [&recs](int a, int b) { return recs[a].material < recs[b].material; });
+
+        next.clear();
+        for (int index : order) {
+            PathState path = paths[index];
+            // Samples are a function of the path's key and bounce, so the result does not
+            // depend on the order the material sort happens to put the paths in.
+            resume_sample(keys[path.pixel], depth);
+            Ray scattered;
+            Vector3 attenuation;
+            if (!scatter(scene.shade(path.ray, recs[index]), path.ray, recs[index], attenuation, scattered)) {
+                count_path_depth(depth);
+                continue;
+            }
+            path.throughput *= attenuation;
+            if (depth >= rr_depth) {
+                float p = fminf(0.95f, fmaxf(path.throughput[0], fmaxf(path.throughput[1], path.throughput[2])));
+                if (sample_1d() >= p) {
+                    count_path_depth(depth + 1);
+                    continue;
+                }
+                path.throughput /= p;
+            }
+            path.ray = scattered;
+            next.push_back(path);
+        }
+
+        paths.swap(next);
+    }
+}
+
+#endif
@@ -1,110 +1,181 @@
 #ifndef MATERIAL_H
 #define MATERIAL_H
 
-struct hit_record;
+#include <stdint.h>
 
-#include "Random.h"
+#include "Sampler.h"
+#include "Stats.h"
 #include "Ray.h"
 #include "Hitable.h"
 
-float schlick(float cosine, float ref_idx) {
-    float r0 = (1-ref_idx) / (1+ref_idx);
+inline float schlick(float cosine, float ref_idx) {
+    float r0 = (1.0f - ref_idx) / (1.0f + ref_idx);
     r0 = r0*r0;
-    return r0 + (1-r0)*pow((1 - cosine),5);
+    float c = 1.0f - cosine;
+    float c2 = c*c;
+    return r0 + (1.0f - r0)*c2*c2*c;
 }
 
-bool refract(const Vector3& v, const Vector3& n, float ni_over_nt, Vector3& refracted) {
+inline bool refract(const Vector3& v, const Vector3& n, float ni_over_nt, Vector3& refracted) {
     Vector3 uv = unit_vector(v);
     Vector3 un = unit_vector(n);
 
     float dt = dot(uv, un);
-    float discriminant = 1.0 - ni_over_nt*ni_over_nt*(1-dt*dt);
-    if (discriminant > 0) {
-        refracted = ni_over_nt*(uv - dt*un) - sqrt(discriminant)*un;
+    float discriminant = 1.0f - ni_over_nt*ni_over_nt*(1.0f - dt*dt);
+    if (discriminant > 0.0f) {
+        refracted = ni_over_nt*(uv - dt*un) - sqrtf(discriminant)*un;
         return true;
     }
     else
         return false;
 }
 
-Vector3 reflect(const Vector3& v, const Vector3& n) {
+inline Vector3 reflect(const Vector3& v, const Vector3& n) {
      return v - 2*dot(v,n)*n;
 }
 
-Vector3 random_in_unit_sphere() {
-    Vector3 p;
-    do {
-        p = 2.0*Vector3(drand48(),drand48(),drand48()) - Vector3(1,1,1);
-    } while (p.squared_length() >= 1.0);
-    return p;
-}
-
-class Material  {
-    public:
-        virtual bool scatter(const Ray& r_in, const hit_record& rec, Vector3& attenuation, Ray& scattered) const = 0;
+enum MaterialType : uint8_t {
+    MATERIAL_LAMBERTIAN,
+    MATERIAL_METAL,
+    MATERIAL_DIELECTRIC,
+    MATERIAL_DIFFUSE_LIGHT
 };
 
-class lambertian : public Material {
-    public:
-        lambertian(const Vector3& a) : albedo(a) {}
-        virtual bool scatter(const Ray& r_in, const hit_record& rec, Vector3& attenuation, Ray& scattered) const  {
-             Vector3 target = rec.p + rec.normal + random_in_unit_sphere();
-             scattered = Ray(rec.p, target-rec.p);
-             attenuation = albedo;
-             return true;
-        }
-
-        Vector3 albedo;
-};
+// Indexed by MaterialType, null terminated.
+inline const char* const material_type_names[] = { "lambertian", "metal", "dielectric", "diffuse_light", nullptr };
 
-class metal : public Material {
-    public:
-        metal(const Vector3& a, float f) : albedo(a) { if (f < 1) fuzz = f; else fuzz = 1; }
-        virtual bool scatter(const Ray& r_in, const hit_record& rec, Vector3& attenuation, Ray& scattered) const  {
-            Vector3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-            scattered = Ray(rec.p, reflected + fuzz*random_in_unit_sphere());
-            attenuation = albedo;
-            return (dot(scattered.direction(), rec.normal) > 0);
-        }
-        Vector3 albedo;
-        float fuzz;
+// Plain material record, stored by value in the scene's material arena and referenced
+// from primitives and hit records by index. scatter() switches on the type tag.
+struct Material {
+    MaterialType type;
+    float fuzz;         // metal
+    float ref_idx;      // dielectric
+    Vector3 albedo;     // lambertian, metal; emitted radiance for diffuse_light
+    int texture;        // lambertian, metal: index into the scene's textures, -1 for none
 };
 
-class dielectric : public Material {
-    public:
-        dielectric(float ri) : ref_idx(ri) {}
-        virtual bool scatter(const Ray& r_in, const hit_record& rec, Vector3& attenuation, Ray& scattered) const  {
-             Vector3 outward_normal;
-             Vector3 reflected = reflect(r_in.direction(), rec.normal);
-             float ni_over_nt;
-             attenuation = Vector3(1.0, 1.0, 1.0);
-             Vector3 refracted;
-             float reflect_prob;
-             float cosine;
-             if (dot(r_in.direction(), rec.normal) > 0) {
-                  outward_normal = -rec.normal;
-                  ni_over_nt = ref_idx;
-                    //cosine = ref_idx * dot(r_in.direction(), rec.normal) / r_in.direction().length();
-                  cosine = dot(r_in.direction(), rec.normal) / r_in.direction().length();
-                  cosine = sqrt(1 - ref_idx*ref_idx*(1-cosine*cosine));
-             }
-             else {
-                  outward_normal = rec.normal;
-                  ni_over_nt = 1.0f / ref_idx;
-                  cosine = -dot(r_in.direction(), rec.normal) / r_in.direction().length();
-             }
-             if (refract(r_in.direction(), outward_normal, ni_over_nt, refracted))
-                reflect_prob = schlick(cosine, ref_idx);
-             else
-                reflect_prob = 1.0;
-             if (drand48() < reflect_prob)
-                scattered = Ray(rec.p, reflected);
-             else
-                scattered = Ray(rec.p, refracted);
-             return true;
-        }
-
-        float ref_idx;
-};
+// 'texture', when not -1, multiplies the albedo of lambertian and metal materials.
+inline Material lambertian(const Vector3& a, int texture = -1) {
+    Material m;
+    m.type = MATERIAL_LAMBERTIAN;
+    m.fuzz = 0.0f;
+    m.ref_idx = 1.0f;
+    m.albedo = a;
+    m.texture = texture;
+    return m;
+}
+
+inline Material metal(const Vector3& a, float f, int texture = -1) {
+    Material m;
+    m.type = MATERIAL_METAL;
+    m.fuzz = f < 1 ? f : 1;
+    m.ref_idx = 1.0f;
+    m.albedo = a;
+    m.texture = texture;
+    return m;
+}
+
+inline Material dielectric(float ri) {
+    Material m;
+    m.type = MATERIAL_DIELECTRIC;
+    m.fuzz = 0.0f;
+    m.ref_idx = ri;
+    m.albedo = Vector3(1.0f, 1.0f, 1.0f);
+    m.texture = -1;
+    return m;
+}
+
+// Emits the same radiance in every direction, from both sides, and reflects nothing.
+inline Material diffuse_light(const Vector3& radiance) {
+    Material m;
+    m.type = MATERIAL_DIFFUSE_LIGHT;
+    m.fuzz = 0.0f;
+    m.ref_idx = 1.0f;
+    m.albedo = radiance;
+    m.texture = -1;
+    return m;
+}
+
+inline bool is_emissive(const Material& m) {
+    return m.type == MATERIAL_DIFFUSE_LIGHT;
+}
+
+inline Vector3 emitted(const Material& m) {
+    return is_emissive(m) ? m.albedo : Vector3(0, 0, 0);
+}
+
+// Widening of the ray cone (see Ray) at a diffuse bounce. Rays leave in every direction,
+// so this is only a nominal value, wide enough that textures seen through a bounce are
+// looked up at coarse, cheap mip levels.
+const float lambertian_spread = 0.5f;
+
+// Lambertian reflection samples a cosine-weighted direction, whose density over the
+// hemisphere is scatter_pdf_lambertian().
+inline bool scatter_lambertian(const Material& m, const Ray& r_in, const hit_record& rec, Vector3& attenuation, Ray& scattered) {
+    scattered = Ray(rec.p, sample_cosine_hemisphere(sample_2d(), rec.normal), r_in.time());
+    attenuation = m.albedo;
+    return true;
+}
+
+inline float scatter_pdf_lambertian(const hit_record& rec, const Vector3& unit_direction) {
+    float cosine = dot(rec.normal, unit_direction);
+    return cosine > 0.0f ? cosine / 3.14159265f : 0.0f;
+}
+
+inline bool scatter_metal(const Material& m, const Ray& r_in, const hit_record& rec, Vector3& attenuation, Ray& scattered) {
+    Vector3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
+    Sample2D s = sample_2d();
+    scattered = Ray(rec.p, reflected + m.fuzz*sample_ball(s, sample_1d()), r_in.time());
+    attenuation = m.albedo;
+    return (dot(scattered.direction(), rec.normal) > 0);
+}
+
+inline bool scatter_dielectric(const Material& m, const Ray& r_in, const hit_record& rec, Vector3& attenuation, Ray& scattered) {
+    float ref_idx = m.ref_idx;
+    Vector3 outward_normal;
+    Vector3 reflected = reflect(r_in.direction(), rec.normal);
+    float ni_over_nt;
+    attenuation = Vector3(1.0f, 1.0f, 1.0f);
+    Vector3 refracted(0, 0, 0);
+    float reflect_prob;
+    float cosine;
+    if (dot(r_in.direction(), rec.normal) > 0) {
+        outward_normal = -rec.normal;
+        ni_over_nt = ref_idx;
+        //cosine = ref_idx * dot(r_in.direction(), rec.normal) / r_in.direction().length();
+        cosine = dot(r_in.direction(), rec.normal) / r_in.direction().length();
+        cosine = sqrtf(1.0f - ref_idx*ref_idx*(1.0f - cosine*cosine));
+    }
+    else {
+        outward_normal = rec.normal;
+        ni_over_nt = 1.0f / ref_idx;
+        cosine = -dot(r_in.direction(), rec.normal) / r_in.direction().length();
+    }
+    if (refract(r_in.direction(), outward_normal, ni_over_nt, refracted))
+        reflect_prob = schlick(cosine, ref_idx);
+    else
+        reflect_prob = 1.0f;
+    if (sample_1d() < reflect_prob)
+        scattered = Ray(rec.p, reflected, r_in.time());
+    else
+        scattered = Ray(rec.p, refracted, r_in.time());
+    return true;
+}
+
+inline bool scatter(const Material& m, const Ray& r_in, const hit_record& rec, Vector3& attenuation, Ray& scattered) {
+    PICORAY_COUNT(scatters[m.type], 1);
+    bool scattering;
+    switch (m.type) {
+        case MATERIAL_LAMBERTIAN: scattering = scatter_lambertian(m, r_in, rec, attenuation, scattered); break;
+        case MATERIAL_METAL: scattering = scatter_metal(m, r_in, rec, attenuation, scattered); break;
+        case MATERIAL_DIELECTRIC: scattering = scatter_dielectric(m, r_in, rec, attenuation, scattered); break;
+        default: return false;
+    }
+    // The scattered ray's cone starts as wide as the incoming one's footprint and spreads
+    // by the material's roughness more than it did; fuzz is 0 for dielectrics.
+    scattered.width = r_in.footprint(rec.t);
+    scattered.spread = r_in.spread + (m.type == MATERIAL_LAMBERTIAN ? lambertian_spread : m.fuzz);
+    return scattering;
+}
 
 #endif
\ No newline at end of file
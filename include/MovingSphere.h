@@ -0,0 +1,57 @@
+#ifndef MOVINGSPHERE_H
+#define MOVINGSPHERE_H
+
+#include "Sphere.h"
+
+// Sphere whose center moves linearly from center0 at time0 to center1 at time1, and
+// rests at the end points outside that interval. Rays are intersected against the
+// sphere where it is at the ray's time.
+class MovingSphere: public Hitable  {
+    public:
+        MovingSphere() {}
+        MovingSphere(Vector3 cen0, Vector3 cen1, float t0, float t1, float r, int m)
+            : center0(cen0), center1(cen1), time0(t0), time1(t1), radius(r), material(m) {}
+        virtual bool hit(const Ray& r, float tmin, float tmax, hit_record& rec) const;
+        virtual bool occluded(const Ray& r, float tmin, float tmax) const;
+        virtual bool bounding_box(AABB& box) const;
+        virtual bool swept_box(float t0, float t1, AABB& box) const;
+
+        Vector3 center(float time) const;
+        Sphere at(float time) const { return Sphere(center(time), radius, material); }
+
+        Vector3 center0, center1;
+        float time0, time1;
+        float radius;
+        int material;
+};
+
+inline Vector3 MovingSphere::center(float time) const {
+    if (time <= time0)
+        return center0;
+    if (time >= time1)
+        return center1;
+    return center0 + ((time - time0) / (time1 - time0))*(center1 - center0);
+}
+
+inline bool MovingSphere::hit(const Ray& r, float t_min, float t_max, hit_record& rec) const {
+    return at(r.time()).hit(r, t_min, t_max, rec);
+}
+
+inline bool MovingSphere::occluded(const Ray& r, float t_min, float t_max) const {
+    return at(r.time()).occluded(r, t_min, t_max);
+}
+
+// The motion is linear, so the boxes at the two ends of an interval bound it.
+inline bool MovingSphere::swept_box(float t0, float t1, AABB& box) const {
+    AABB end;
+    at(t0).bounding_box(box);
+    at(t1).bounding_box(end);
+    box.expand(end);
+    return true;
+}
+
+inline bool MovingSphere::bounding_box(AABB& box) const {
+    return swept_box(time0, time1, box);
+}
+
+#endif
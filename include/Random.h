@@ -1,12 +1,102 @@
 #ifndef RANDOM_H
 #define RANDOM_H
 
-#include <random>
-#include <iostream>
-std:: default_random_engine generator;
-std::uniform_real_distribution<double> distr(0.0, 1.0);
+#include <stdint.h>
 
-double drand48(){
-    return distr(generator);
+// splitmix64 finalizer, used to turn structured keys into well mixed seeds.
+inline uint64_t mix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
 }
+
+// PCG32 (XSH-RR): 64-bit state, 32-bit output, selectable stream.
+class Pcg32 {
+    public:
+        Pcg32(uint64_t initstate = 0x853c49e6748fea9bull, uint64_t stream = 0xda3e39cb94b95bdbull) { seed(initstate, stream); }
+
+        void seed(uint64_t initstate, uint64_t stream) {
+            state = 0;
+            inc = (stream << 1) | 1;
+            next_uint();
+            state += initstate;
+            next_uint();
+        }
+
+        uint32_t next_uint() {
+            uint64_t old = state;
+            state = old * 6364136223846793005ull + inc;
+            uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+            uint32_t rot = uint32_t(old >> 59);
+            return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+        }
+
+        // Uniform in [0, 1) with 24 bits of precision.
+        float next_float() { return float(next_uint() >> 8) * (1.0f / 16777216.0f); }
+
+        uint64_t state;
+        uint64_t inc;
+};
+
+// One generator per thread: no shared state between render workers.
+inline thread_local Pcg32 rng;
+
+inline float random_float() {
+    return rng.next_float();
+}
+
+// Reseeds the calling thread's generator from the sample's coordinates, so an image is
+// the same whatever the thread count or the order tiles are rendered in.
+inline void seed_random(uint32_t frame, uint32_t pixel, uint32_t sample) {
+    rng.seed(mix64((uint64_t(frame) << 32 | pixel) ^ mix64(sample)), frame);
+}
+
+// Eight Pcg32 generators stepped in lock step on plain arrays. The multiply-add and the
+// output permutation vectorize, so a batch of samples (e.g. the pixel jitter of a ray
+// stream) is drawn several per instruction. A lane seeded with (initstate, stream) gives
+// the same numbers as a Pcg32 seeded with them.
+class Pcg32Lanes {
+    public:
+        static const int width = 8;
+
+        void seed(const uint64_t* initstate, const uint64_t* stream) {
+            for (int l = 0; l < width; l++) {
+                state[l] = 0;
+                inc[l] = (stream[l] << 1) | 1;
+            }
+            step();
+            for (int l = 0; l < width; l++)
+                state[l] += initstate[l];
+            step();
+        }
+
+        // Fills out[0..width) as Pcg32::next_float() would, one number per lane.
+        void next_floats(float* out) {
+            for (int l = 0; l < width; l++) {
+                uint64_t old = state[l];
+                state[l] = old * 6364136223846793005ull + inc[l];
+                uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+                uint32_t rot = uint32_t(old >> 59);
+                uint32_t x = (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+                out[l] = float(x >> 8) * (1.0f / 16777216.0f);
+            }
+        }
+
+        // Lane l as a scalar generator, to carry on drawing from where the batch left it.
+        void get(int l, Pcg32& g) const {
+            g.state = state[l];
+            g.inc = inc[l];
+        }
+
+    private:
+        void step() {
+            for (int l = 0; l < width; l++)
+                state[l] = state[l] * 6364136223846793005ull + inc[l];
+        }
+
+        uint64_t state[width];
+        uint64_t inc[width];
+};
+
 #endif
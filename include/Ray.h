@@ -6,13 +6,22 @@ class Ray
 {
     public:
         Ray() {}
-        Ray(const Vector3& a, const Vector3& b) { A = a; B = b; }  
+        Ray(const Vector3& a, const Vector3& b, float ti = 0.0f) { A = a; B = b; tm = ti; width = 0.0f; spread = 0.0f; }
         Vector3 origin() const       { return A; }
         Vector3 direction() const    { return B; }
+        float time() const           { return tm; }     // instant within the shutter interval
         Vector3 point_at_parameter(float t) const { return A + t*B; }
+        // Width of the ray's footprint after travelling to parameter t. Texture lookups
+        // use it to pick a mip level.
+        float footprint(float t) const { return width + spread * t * B.length(); }
 
         Vector3 A;
         Vector3 B;
+        float tm;
+        // The ray as a cone, an isotropic stand-in for ray differentials: 'width' across at
+        // the origin, growing by 'spread' per unit of distance. Both are 0 unless set.
+        float width;
+        float spread;
 };
 
 #endif 
\ No newline at end of file
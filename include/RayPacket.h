@@ -0,0 +1,24 @@
+#ifndef RAYPACKET_H
+#define RAYPACKET_H
+
+#include <float.h>
+#include "Ray.h"
+
+// Up to 'width' rays traced together. Lanes at or beyond 'count' are unused.
+struct RayPacket {
+    static const int width = 8;
+
+    RayPacket() : count(0) {}
+
+    void add(const Ray& r, float tmax = FLT_MAX) {
+        rays[count] = r;
+        t_max[count] = tmax;
+        count++;
+    }
+
+    int count;
+    Ray rays[width];
+    float t_max[width];
+};
+
+#endif
@@ -0,0 +1,218 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "Camera.h"
+#include "Scene.h"
+#include "BVH.h"
+#include "Denoiser.h"
+#include "Integrator.h"
+#include "Framebuffer.h"
+#include "TileScheduler.h"
+#include "Random.h"
+#include "Sampler.h"
+#include "Stats.h"
+
+// Adaptive sampling state shared by all workers. A pixel stops receiving samples once
+// it has min_samples and its relative error (see Framebuffer::relative_error) is below
+// threshold, so later passes only spend samples where the image is still noisy.
+struct AdaptiveSampling {
+    AdaptiveSampling(float t, int min, int num_tiles) : threshold(t), min_samples(min), tile_samples(num_tiles, 0) {}
+
+    float threshold;
+    int min_samples;
+    // Samples taken per tile. Each entry is only written by the worker that owns the tile.
+    std::vector<uint64_t> tile_samples;
+};
+
+// Wall time per tile and per pixel, summed over every pass. Like tile_samples, each entry
+// is only written by the worker that owns the tile.
+struct RenderProfile {
+    RenderProfile(int width, int height, int num_tiles)
+        : width(width), tile_seconds(num_tiles, 0.0), pixel_seconds(size_t(width) * height, 0.0f) {}
+
+    float& pixel(int x, int y) { return pixel_seconds[size_t(y) * width + x]; }
+
+    int width;
+    std::vector<double> tile_seconds;
+    std::vector<float> pixel_seconds;
+};
+
+struct worker_data {
+    int full_width;
+    int full_height;
+    int samples;
+    int sample_offset;  // index of the first sample in this pass, for progressive rendering
+    int frame;
+
+    Camera* camera;
+    const Scene* scene;
+    const Integrator* integrator;
+    const Sampler* sampler;         // null for independent samples
+
+    Framebuffer* framebuffer;
+    AdaptiveSampling* adaptive;     // null to sample every pixel
+    RenderProfile* profile;         // null to skip timing
+    AuxBuffers* aux;                // null to skip the denoiser's guide buffers
+};
+
+inline bool pixel_active(const worker_data& data, int x, int y) {
+    if (!data.adaptive || data.framebuffer->sample_count(x, y) < data.adaptive->min_samples)
+        return true;
+    return data.framebuffer->relative_error(x, y) > data.adaptive->threshold;
+}
+
+// Streamed integrators get every camera sample of the tile in one batch. Each camera ray
+// is made as in render_tile_scalar(), from its own key, so the image does not depend on
+// the tile size or the order samples are taken in.
+inline int render_tile_stream(const worker_data& data, const Tile& tile) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<int> px, py;
+    for (int y = tile.y0; y < tile.y1; y++) {
+        for (int x = tile.x0; x < tile.x1; x++) {
+            if (pixel_active(data, x, y)) {
+                px.push_back(x);
+                py.push_back(y);
+            }
+        }
+    }
+
+    int n = int(px.size()) * data.samples;
+    std::vector<Ray> rays(n);
+    std::vector<SampleKey> keys(n);
+    std::vector<Vector3> result(n);
+    std::vector<AuxSample> aux(data.aux ? n : 0);
+
+    for (int k = 0; k < n; k++) {
+        SampleKey& key = keys[k];
+        key.x = px[k / data.samples];
+        key.y = py[k / data.samples];
+        key.frame = uint32_t(data.frame);
+        key.index = uint32_t(data.sample_offset + k % data.samples);
+    }
+    // The jitter is drawn a batch of samples at a time. The camera draws its lens and
+    // shutter samples from the same cursor, so each ray is made after its own sample is
+    // put back on it.
+    Pcg32Lanes lanes;
+    for (int k0 = 0; k0 < n; k0 += Pcg32Lanes::width) {
+        int count = n - k0 < Pcg32Lanes::width ? n - k0 : Pcg32Lanes::width;
+        Sample2D jitter[Pcg32Lanes::width];
+        start_camera_samples(&keys[k0], count, lanes, jitter);
+        for (int l = 0; l < count; l++) {
+            const SampleKey& key = keys[k0 + l];
+            resume_camera_sample(key, lanes, l);
+            float u = (float(key.x) + jitter[l].u) / float(data.full_width);
+            float v = (float(data.full_height - 1 - key.y) + jitter[l].v) / float(data.full_height);
+            rays[k0 + l] = data.camera->getRay(u, v);
+        }
+    }
+    float spread = data.camera->pixel_spread(data.full_height);
+    for (int k = 0; k < n; k++)
+        rays[k].spread = spread;
+
+    PICORAY_COUNT(primary_rays, n);
+    data.integrator->radiance_stream(rays.data(), keys.data(), n, *data.scene, result.data(),
+                                     data.aux ? aux.data() : nullptr);
+
+    for (int p = 0; p < int(px.size()); p++) {
+        Vector3 col(0, 0, 0);
+        float lum_sq = 0.0f;
+        for (int s = 0; s < data.samples; s++) {
+            const Vector3& c = result[p * data.samples + s];
+            col += c;
+            lum_sq += luminance(c) * luminance(c);
+        }
+        data.framebuffer->add_samples(px[p], py[p], col, lum_sq, data.samples);
+        if (data.aux)
+            add_aux_samples(*data.aux, px[p], py[p], &aux[p * data.samples], data.samples);
+    }
+
+    // The whole tile is traced at once, so its pixels share the time evenly.
+    if (data.profile && !px.empty()) {
+        float per_pixel = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count() / px.size();
+        for (size_t p = 0; p < px.size(); p++)
+            data.profile->pixel(px[p], py[p]) += per_pixel;
+    }
+    return n;
+}
+
+inline int render_tile_scalar(const worker_data& data, const Tile& tile) {
+    int taken = 0;
+    float spread = data.camera->pixel_spread(data.full_height);
+    for (int y = tile.y0; y < tile.y1; y++) {
+        int j = data.full_height - 1 - y;
+        for (int i = tile.x0; i < tile.x1; i++) {
+            if (!pixel_active(data, i, y))
+                continue;
+            std::chrono::steady_clock::time_point start;
+            if (data.profile)
+                start = std::chrono::steady_clock::now();
+            Vector3 col(0, 0, 0);
+            float lum_sq = 0.0f;
+            SampleKey key = { i, y, uint32_t(data.frame), 0 };
+            for (int s = 0; s < data.samples; s++) {
+                key.index = uint32_t(data.sample_offset + s);
+                start_sample(key);
+                Sample2D jitter = sample_2d();
+                float u = (float(i) + jitter.u) / float(data.full_width);
+                float v = (float(j) + jitter.v) / float(data.full_height);
+                Ray r = data.camera->getRay(u, v);
+                r.spread = spread;
+                PICORAY_COUNT(primary_rays, 1);
+                AuxSample aux;
+                Vector3 c = data.integrator->radiance(r, *data.scene, data.aux ? &aux : nullptr);
+                col += c;
+                lum_sq += luminance(c) * luminance(c);
+                if (data.aux)
+                    add_aux_samples(*data.aux, i, y, &aux, 1);
+            }
+            data.framebuffer->add_samples(i, y, col, lum_sq, data.samples);
+            taken += data.samples;
+            if (data.profile)
+                data.profile->pixel(i, y) += std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+    return taken;
+}
+
+inline void render_tile(const worker_data& data, const Tile& tile) {
+    auto start = std::chrono::steady_clock::now();
+    set_sampler(data.sampler);
+    int taken = data.integrator->streamed() ? render_tile_stream(data, tile) : render_tile_scalar(data, tile);
+    if (data.adaptive)
+        data.adaptive->tile_samples[tile.index] += taken;
+    if (data.profile) {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        data.profile->tile_seconds[tile.index] += seconds;
+    }
+    if (taken > 0)
+        data.framebuffer->publish(tile);
+    flush_render_counters();
+}
+
+// Colours the per-pixel cost of a profile into 'heatmap', from black through red and
+// yellow to white. The scale saturates at the 99th percentile so a few outliers do not
+// wash out the rest.
+inline void make_heatmap(const RenderProfile& profile, Framebuffer& heatmap) {
+    std::vector<float> sorted(profile.pixel_seconds);
+    size_t k = sorted.size() * 99 / 100;
+    float scale = 0.0f;
+    if (!sorted.empty()) {
+        std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+        scale = sorted[k];
+    }
+    if (scale <= 0.0f)
+        scale = 1.0f;
+    for (int y = 0; y < heatmap.height(); y++) {
+        for (int x = 0; x < heatmap.width(); x++) {
+            float t = fminf(profile.pixel_seconds[size_t(y) * profile.width + x] / scale, 1.0f) * 3.0f;
+            Vector3 c(fminf(t, 1.0f), fminf(fmaxf(t - 1.0f, 0.0f), 1.0f), fmaxf(t - 2.0f, 0.0f));
+            heatmap.set_pixel(x, y, c*c);   // undo the display gamma so the ramp stays linear
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,479 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "Random.h"
+#include "Vector3.h"
+
+struct Sample2D {
+    float u, v;
+};
+
+// One camera sample: the pixel, the frame and the sample's number within the pixel,
+// counted over every pass.
+struct SampleKey {
+    int x, y;
+    uint32_t frame;
+    uint32_t index;
+};
+
+// A sample's dimensions are handed out in order. The camera takes the first ones
+// (pixel jitter, lens, shutter time) and every bounce starts a block of its own, so
+// bounce n of each sample draws from the same dimensions whatever the earlier bounces
+// used up.
+const uint32_t camera_dimensions = 5;
+const uint32_t bounce_dimensions = 8;
+
+// Sample values as a pure function of the sample and the dimension, so images do not
+// depend on thread count, tile order or the order streamed paths are shaded in.
+// 'seed' is a hash of the pixel and frame, see start_sample().
+class Sampler {
+    public:
+        virtual ~Sampler() {}
+        virtual const char* name() const = 0;
+        virtual float get_1d(const SampleKey& key, uint64_t seed, uint32_t dimension) const = 0;
+        // Uses up 'dimension' and 'dimension + 1'.
+        virtual Sample2D get_2d(const SampleKey& key, uint64_t seed, uint32_t dimension) const = 0;
+};
+
+// 64 random bits for one dimension of a pixel.
+inline uint64_t dimension_seed(uint64_t seed, uint32_t dimension) {
+    return mix64(seed + uint64_t(dimension) * 0xd1b54a32d192ed03ull);
+}
+
+// The top 24 bits as a float in [0, 1).
+inline float bits_to_float(uint32_t bits) {
+    return float(bits >> 8) * (1.0f / 16777216.0f);
+}
+
+inline uint32_t reverse_bits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// Element i of a random permutation of [0, n) picked by 'seed', without a table
+// (Kensler 2013, "Correlated Multi-Jittered Sampling").
+inline uint32_t permute(uint32_t i, uint32_t n, uint32_t seed) {
+    uint32_t w = n - 1;
+    w |= w >> 1; w |= w >> 2; w |= w >> 4; w |= w >> 8; w |= w >> 16;
+    do {
+        i ^= seed; i *= 0xe170893du; i ^= seed >> 16; i ^= (i & w) >> 4;
+        i ^= seed >> 8; i *= 0x0929eb3fu; i ^= seed >> 23; i ^= (i & w) >> 1;
+        i *= 1 | seed >> 27; i *= 0x6935fa69u; i ^= (i & w) >> 11; i *= 0x74dcb303u;
+        i ^= (i & w) >> 2; i *= 0x9e501cc3u; i ^= (i & w) >> 2; i *= 0xc860a3dfu;
+        i &= w; i ^= i >> 5;
+    } while (i >= n);
+    return (i + seed) % n;
+}
+
+// Owen scrambling (Burley 2020, "Practical Hash-based Owen Scrambling"): each bit of x
+// is flipped or not depending on the bits below it. Applied to a bit-reversed fixed
+// point value, that is the nested uniform scramble of the value.
+inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+// The first two dimensions of the Sobol sequence, in reversed bit order: bit i is the
+// 2^-(i+1) digit. The first is the index itself; the second multiplies it by the Pascal
+// matrix mod 2, whose entry (i, j) is set when the bits of i are a subset of those of
+// j, so it is a superset sum over the bit positions, done five levels at a time.
+inline uint32_t sobol_second_reversed(uint32_t y) {
+    y ^= (y >> 1) & 0x55555555u;
+    y ^= (y >> 2) & 0x33333333u;
+    y ^= (y >> 4) & 0x0f0f0f0fu;
+    y ^= (y >> 8) & 0x00ff00ffu;
+    y ^= (y >> 16) & 0x0000ffffu;
+    return y;
+}
+
+// Sample 'index' of a (0, 2)-sequence: Owen-scrambled Sobol points, visited in an order
+// shuffled by an Owen scramble of the index, which maps any aligned power-of-two block
+// of indices onto another one (Burley 2020). 'seeds' picks the shuffle and scrambles.
+inline Sample2D scrambled_sobol_2d(uint32_t index, uint64_t seeds) {
+    uint32_t shuffled = reverse_bits(laine_karras_permutation(reverse_bits(index), uint32_t(seeds)));
+    uint32_t x = laine_karras_permutation(shuffled, uint32_t(seeds >> 32));
+    uint32_t y = laine_karras_permutation(sobol_second_reversed(shuffled), uint32_t(mix64(seeds)));
+    Sample2D s = { bits_to_float(reverse_bits(x)), bits_to_float(reverse_bits(y)) };
+    return s;
+}
+
+inline float scrambled_sobol_1d(uint32_t index, uint64_t seeds) {
+    uint32_t shuffled = reverse_bits(laine_karras_permutation(reverse_bits(index), uint32_t(seeds)));
+    return bits_to_float(reverse_bits(laine_karras_permutation(shuffled, uint32_t(seeds >> 32))));
+}
+
+// Jittered strata. Every dimension gets its own random assignment of the pixel's
+// samples to strata: spp intervals in 1D, a grid of about sqrt(spp) squared cells in
+// 2D. Samples past the strata (the rest of a non-square count in 2D, or anything past
+// spp) are plain uniform.
+class StratifiedSampler : public Sampler {
+    public:
+        StratifiedSampler(int samples_per_pixel)
+            : spp(uint32_t(samples_per_pixel > 0 ? samples_per_pixel : 1)),
+              nx(uint32_t(sqrtf(float(spp)) + 0.5f)) {
+            while (nx * nx > spp)
+                nx--;
+            ny = spp / nx;
+        }
+        virtual const char* name() const { return "stratified"; }
+        virtual float get_1d(const SampleKey& key, uint64_t seed, uint32_t dimension) const;
+        virtual Sample2D get_2d(const SampleKey& key, uint64_t seed, uint32_t dimension) const;
+
+    private:
+        uint32_t spp;
+        uint32_t nx, ny;
+};
+
+inline float StratifiedSampler::get_1d(const SampleKey& key, uint64_t seed, uint32_t dimension) const {
+    uint64_t h = dimension_seed(seed, dimension);
+    float jitter = bits_to_float(uint32_t(mix64(h ^ key.index)));
+    if (key.index >= spp)
+        return jitter;
+    return fminf((float(permute(key.index, spp, uint32_t(h))) + jitter) / float(spp), 0x1.fffffep-1f);
+}
+
+inline Sample2D StratifiedSampler::get_2d(const SampleKey& key, uint64_t seed, uint32_t dimension) const {
+    uint64_t h = dimension_seed(seed, dimension);
+    uint64_t bits = mix64(h ^ key.index);
+    Sample2D s = { bits_to_float(uint32_t(bits)), bits_to_float(uint32_t(bits >> 32)) };
+    uint32_t cells = nx * ny;
+    if (key.index >= cells)
+        return s;
+    uint32_t cell = permute(key.index, cells, uint32_t(h));
+    s.u = fminf((float(cell % nx) + s.u) / float(nx), 0x1.fffffep-1f);
+    s.v = fminf((float(cell / nx) + s.v) / float(ny), 0x1.fffffep-1f);
+    return s;
+}
+
+// The Halton sequence, one prime base per dimension, with random digit scrambling:
+// each digit position of each dimension maps its digits through a random permutation,
+// after a random shift drawn per pixel. The permutations break up the lines the higher
+// bases fall on when plotted against each other, the shifts decorrelate the pixels,
+// and every base-b^k block of samples stays stratified. Dimensions past the table are
+// plain uniform.
+class HaltonSampler : public Sampler {
+    public:
+        static const int max_dimensions = 128;
+
+        HaltonSampler();
+        virtual const char* name() const { return "halton"; }
+        virtual float get_1d(const SampleKey& key, uint64_t seed, uint32_t dimension) const;
+        virtual Sample2D get_2d(const SampleKey& key, uint64_t seed, uint32_t dimension) const {
+            Sample2D s = { get_1d(key, seed, dimension), get_1d(key, seed, dimension + 1) };
+            return s;
+        }
+
+    private:
+        uint32_t primes[max_dimensions];
+        // The permutations of dimension d, one per digit position, are 'primes[d]'
+        // entries each from permutations[offsets[d]].
+        uint32_t offsets[max_dimensions];
+        std::vector<uint16_t> permutations;
+};
+
+inline HaltonSampler::HaltonSampler() {
+    int count = 0;
+    for (uint32_t n = 2; count < max_dimensions; n++) {
+        bool prime = true;
+        for (int i = 0; i < count && primes[i] * primes[i] <= n; i++) {
+            if (n % primes[i] == 0) {
+                prime = false;
+                break;
+            }
+        }
+        if (prime)
+            primes[count++] = n;
+    }
+
+    Pcg32 random(0x4a17);
+    for (int d = 0; d < max_dimensions; d++) {
+        uint32_t base = primes[d];
+        offsets[d] = uint32_t(permutations.size());
+        // Same digit count as get_1d(), so the same float arithmetic.
+        float inv_base = 1.0f / float(base);
+        for (float scale = inv_base; scale > 1.0f / 16777216.0f; scale *= inv_base) {
+            size_t first = permutations.size();
+            for (uint32_t i = 0; i < base; i++)
+                permutations.push_back(uint16_t(i));
+            for (uint32_t i = base - 1; i > 0; i--)
+                std::swap(permutations[first + i], permutations[first + random.next_uint() % (i + 1)]);
+        }
+    }
+}
+
+inline float HaltonSampler::get_1d(const SampleKey& key, uint64_t seed, uint32_t dimension) const {
+    uint64_t h = dimension_seed(seed, dimension);
+    if (dimension >= uint32_t(max_dimensions))
+        return bits_to_float(uint32_t(mix64(h ^ key.index)));
+    uint32_t base = primes[dimension];
+    if (base == 2)
+        return bits_to_float(reverse_bits(key.index) ^ uint32_t(h));
+
+    // Digits are taken until they no longer change a float; the zero digits past the
+    // index are shifted and permuted too. Each digit's shift is the top of a 32-bit LCG
+    // step scaled to the base, which avoids dividing the random bits.
+    uint32_t index = key.index;
+    uint32_t state = uint32_t(h);
+    const uint16_t* permutation = &permutations[offsets[dimension]];
+    float inv_base = 1.0f / float(base), scale = inv_base, result = 0.0f;
+    for (; scale > 1.0f / 16777216.0f; permutation += base) {
+        state = state * 747796405u + 2891336453u;
+        uint32_t next = index / base;
+        uint32_t digit = index - next * base + uint32_t((uint64_t(state) * base) >> 32);
+        index = next;
+        result += float(permutation[digit >= base ? digit - base : digit]) * scale;
+        scale *= inv_base;
+    }
+    return fminf(result, 0x1.fffffep-1f);
+}
+
+// Owen-scrambled Sobol points, padded: every pair of dimensions is the first two Sobol
+// dimensions, a (0, 2)-sequence, with its own scramble and its own shuffle of the sample
+// order, so any power-of-two count of samples is stratified in each pair and there is
+// no dimension limit (Burley 2020).
+class SobolSampler : public Sampler {
+    public:
+        virtual const char* name() const { return "sobol"; }
+        virtual float get_1d(const SampleKey& key, uint64_t seed, uint32_t dimension) const {
+            return scrambled_sobol_1d(key.index, dimension_seed(seed, dimension));
+        }
+        virtual Sample2D get_2d(const SampleKey& key, uint64_t seed, uint32_t dimension) const {
+            return scrambled_sobol_2d(key.index, dimension_seed(seed, dimension));
+        }
+};
+
+// Side of the tiling blue-noise mask, see blue_noise_mask().
+const int blue_noise_size = 64;
+
+// Blue-noise dithered sampling (Georgiev and Fajardo 2016): the same Sobol points in
+// every pixel, toroidally shifted by a blue-noise mask read at an offset per dimension.
+// Neighbouring pixels then get very different values, so at low sample counts the
+// error is high frequency, which looks finer and denoises better than white noise.
+class BlueNoiseSampler : public Sampler {
+    public:
+        BlueNoiseSampler();
+        virtual const char* name() const { return "bluenoise"; }
+        virtual float get_1d(const SampleKey& key, uint64_t seed, uint32_t dimension) const;
+        virtual Sample2D get_2d(const SampleKey& key, uint64_t seed, uint32_t dimension) const;
+
+    private:
+        // The mask at the pixel, offset by the low 12 bits of 'h'.
+        float shift(const SampleKey& key, uint64_t h) const {
+            int x = (key.x + int(h & 63)) & (blue_noise_size - 1);
+            int y = (key.y + int((h >> 6) & 63)) & (blue_noise_size - 1);
+            return mask[y * blue_noise_size + x];
+        }
+
+        const float* mask;
+};
+
+// Ranks of a blue_noise_size squared void-and-cluster pattern (Ulichney 1993), scaled
+// into (0, 1). Made on first use; safe to call from several threads.
+const float* blue_noise_mask();
+
+inline BlueNoiseSampler::BlueNoiseSampler() : mask(blue_noise_mask()) {}
+
+// The scrambles only depend on the frame, so every pixel gets the same points.
+inline float BlueNoiseSampler::get_1d(const SampleKey& key, uint64_t, uint32_t dimension) const {
+    uint64_t h = dimension_seed(key.frame, dimension);
+    float u = scrambled_sobol_1d(key.index, h) + shift(key, mix64(h));
+    return u >= 1.0f ? u - 1.0f : u;
+}
+
+inline Sample2D BlueNoiseSampler::get_2d(const SampleKey& key, uint64_t, uint32_t dimension) const {
+    uint64_t h = dimension_seed(key.frame, dimension);
+    uint64_t offsets = mix64(h ^ 0x5bd1e995u);
+    Sample2D s = scrambled_sobol_2d(key.index, h);
+    s.u += shift(key, offsets);
+    s.v += shift(key, offsets >> 12);
+    if (s.u >= 1.0f)
+        s.u -= 1.0f;
+    if (s.v >= 1.0f)
+        s.v -= 1.0f;
+    return s;
+}
+
+// Names for --sampler, null terminated. "independent" is no Sampler at all: draws come
+// from the thread's generator, reseeded per sample and bounce.
+inline const char* const sampler_names[] = { "independent", "stratified", "halton", "sobol", "bluenoise", nullptr };
+
+// Returns null for "independent" and for unknown names; 'known' tells them apart.
+inline Sampler* make_sampler(const char* name, int samples_per_pixel, bool& known) {
+    known = true;
+    if (!strcmp(name, "stratified"))
+        return new StratifiedSampler(samples_per_pixel);
+    if (!strcmp(name, "halton"))
+        return new HaltonSampler();
+    if (!strcmp(name, "sobol"))
+        return new SobolSampler();
+    if (!strcmp(name, "bluenoise"))
+        return new BlueNoiseSampler();
+    known = !strcmp(name, "independent");
+    return nullptr;
+}
+
+// The calling thread's current sample, which the camera, materials and integrators
+// draw from through sample_1d() and sample_2d().
+struct SampleCursor {
+    const Sampler* sampler = nullptr;
+    SampleKey key = { 0, 0, 0, 0 };
+    uint64_t seed = 0;
+    uint32_t dimension = 0;
+};
+
+inline thread_local SampleCursor sample_cursor;
+
+// Null draws independent uniform numbers from rng.
+inline void set_sampler(const Sampler* sampler) {
+    sample_cursor.sampler = sampler;
+}
+
+inline void reseed_sample_random() {
+    SampleCursor& c = sample_cursor;
+    rng.seed(mix64(c.seed ^ mix64(uint64_t(c.key.index) << 32 | c.dimension)), c.key.frame);
+}
+
+// The 'seed' samplers are given: a hash of the pixel and the frame.
+inline uint64_t pixel_seed(const SampleKey& key) {
+    return mix64(uint64_t(key.frame) << 40 ^ uint64_t(uint32_t(key.y)) << 20 ^ uint32_t(key.x));
+}
+
+// Starts drawing sample 'key' from 'dimension' on. Without a sampler the generator is
+// reseeded from both.
+inline void start_sample(const SampleKey& key, uint32_t dimension = 0) {
+    SampleCursor& c = sample_cursor;
+    c.key = key;
+    c.seed = pixel_seed(key);
+    c.dimension = dimension;
+    if (!c.sampler)
+        reseed_sample_random();
+}
+
+// Moves on to the dimensions of bounce 'depth'.
+inline void start_bounce(int depth) {
+    sample_cursor.dimension = camera_dimensions + uint32_t(depth) * bounce_dimensions;
+}
+
+// Picks sample 'key' up again at bounce 'depth', for integrators that interleave the
+// bounces of many paths. Without a sampler the generator is reseeded for the bounce,
+// so what a path draws does not depend on the order paths are shaded in.
+inline void resume_sample(const SampleKey& key, int depth) {
+    start_sample(key, camera_dimensions + uint32_t(depth) * bounce_dimensions);
+}
+
+inline float sample_1d() {
+    SampleCursor& c = sample_cursor;
+    if (!c.sampler)
+        return random_float();
+    return c.sampler->get_1d(c.key, c.seed, c.dimension++);
+}
+
+inline Sample2D sample_2d() {
+    SampleCursor& c = sample_cursor;
+    if (!c.sampler) {
+        Sample2D s;
+        s.u = random_float();
+        s.v = random_float();
+        return s;
+    }
+    Sample2D s = c.sampler->get_2d(c.key, c.seed, c.dimension);
+    c.dimension += 2;
+    return s;
+}
+
+// start_sample() and sample_2d(), the pixel jitter, for up to Pcg32Lanes::width camera
+// samples at once. Without a sampler their generators are seeded and stepped together
+// in 'lanes'. resume_camera_sample() then puts sample k back on the cursor, so the
+// camera goes on drawing exactly what it would after start_sample() and sample_2d().
+inline void start_camera_samples(const SampleKey* keys, int count, Pcg32Lanes& lanes, Sample2D* jitter) {
+    if (sample_cursor.sampler) {
+        for (int k = 0; k < count; k++) {
+            start_sample(keys[k]);
+            jitter[k] = sample_2d();
+        }
+        return;
+    }
+    const int W = Pcg32Lanes::width;
+    uint64_t initstate[W] = {}, stream[W] = {};
+    for (int k = 0; k < count; k++) {
+        initstate[k] = mix64(pixel_seed(keys[k]) ^ mix64(uint64_t(keys[k].index) << 32));
+        stream[k] = keys[k].frame;
+    }
+    float u[W], v[W];
+    lanes.seed(initstate, stream);
+    lanes.next_floats(u);
+    lanes.next_floats(v);
+    for (int k = 0; k < count; k++) {
+        jitter[k].u = u[k];
+        jitter[k].v = v[k];
+    }
+}
+
+inline void resume_camera_sample(const SampleKey& key, const Pcg32Lanes& lanes, int k) {
+    SampleCursor& c = sample_cursor;
+    if (c.sampler) {
+        start_sample(key, 2);   // after the jitter's two dimensions
+        return;
+    }
+    c.key = key;
+    c.seed = pixel_seed(key);
+    c.dimension = 0;
+    lanes.get(k, rng);
+}
+
+// Direct maps from the unit square, in place of rejection sampling: they use a fixed
+// number of dimensions and carry the strata of well spread samples over.
+
+// Shirley and Chiu's concentric map onto the unit disk in the xy plane.
+inline Vector3 sample_disk(const Sample2D& s) {
+    float a = 2.0f*s.u - 1.0f, b = 2.0f*s.v - 1.0f;
+    if (a == 0.0f && b == 0.0f)
+        return Vector3(0, 0, 0);
+    float r, phi;
+    if (fabsf(a) > fabsf(b)) {
+        r = a;
+        phi = (3.14159265f/4.0f) * (b/a);
+    }
+    else {
+        r = b;
+        phi = (3.14159265f/2.0f) - (3.14159265f/4.0f) * (a/b);
+    }
+    return Vector3(r*cosf(phi), r*sinf(phi), 0.0f);
+}
+
+// Uniform over the unit sphere's surface.
+inline Vector3 sample_sphere(const Sample2D& s) {
+    float z = 1.0f - 2.0f*s.u;
+    float r = sqrtf(fmaxf(0.0f, 1.0f - z*z));
+    float phi = 2.0f*3.14159265f*s.v;
+    return Vector3(r*cosf(phi), r*sinf(phi), z);
+}
+
+// Uniform inside the unit ball.
+inline Vector3 sample_ball(const Sample2D& s, float radius_sample) {
+    return cbrtf(radius_sample) * sample_sphere(s);
+}
+
+// A direction cosine-weighted over the hemisphere around the unit vector n, not
+// normalized: n plus a point on the unit sphere. This needs no basis around n, which
+// makes it cheaper than lifting a disk sample.
+inline Vector3 sample_cosine_hemisphere(const Sample2D& s, const Vector3& n) {
+    Vector3 direction = n + sample_sphere(s);
+    return direction.squared_length() < 1e-12f ? n : direction;
+}
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <memory>
+#include <vector>
+
+#include "Hitable.h"
+#include "HitableList.h"
+#include "Instance.h"
+#include "Material.h"
+#include "MovingSphere.h"
+#include "Sphere.h"
+#include "Texture.h"
+#include "TextureCache.h"
+#include "TriangleMesh.h"
+
+// Camera constructor parameters minus the aspect ratio, which comes from the image size.
+struct SceneCamera {
+    SceneCamera() : lookfrom(13.f, 2.f, 3.f), lookat(0.f, 0.f, 0.f), vup(0.f, 1.f, 0.f),
+                    vfov(20.f), aperture(0.1f), focus_dist(10.f), time0(0.f), time1(0.f) {}
+
+    Vector3 lookfrom;
+    Vector3 lookat;
+    Vector3 vup;
+    float vfov;
+    float aperture;
+    float focus_dist;
+    float time0, time1;     // shutter open and close; equal for no motion blur
+};
+
+// Owns everything a render needs: primitives and materials in contiguous arenas, with
+// primitives referring to materials by index, plus the acceleration structure built over
+// them. Destroying or clear()ing a scene releases all of it.
+class Scene {
+    public:
+        Scene() : sky(true) {}
+        Scene(const Scene&) = delete;
+        Scene& operator=(const Scene&) = delete;
+
+        int add_material(const Material& m);
+        int add_texture(const Texture& t);
+        void add_sphere(const Vector3& center, float radius, int material);
+        void add_moving_sphere(const Vector3& center0, const Vector3& center1, float time0, float time1,
+                               float radius, int material);
+        // Takes the mesh's buffers; its BVH must already be built.
+        void add_mesh(TriangleMesh&& mesh);
+        // Takes ownership of the group and builds it; returns its index for add_instance().
+        int add_group(Group* group);
+        void add_instance(int group, const Affine& to_world, int material = -1);
+
+        // Pointers into the primitive arenas, static spheres first, then moving spheres,
+        // meshes and instances, for building acceleration structures. They stay valid
+        // until the next add_*() or clear(). Groups are only reached through instances.
+        Hitable** primitives();
+        int num_primitives() const {
+            return int(spheres.size() + moving_spheres.size() + meshes.size() + instances.size());
+        }
+        // Triangles stored, counting those of a group once however often it is instanced.
+        size_t num_triangles() const;
+
+        // Takes ownership of the structure rays are traced against, usually a BVH or a
+        // HitableList over primitives(). The scene is complete at this point, so this is
+        // also where the emissive spheres are collected into lights().
+        void set_accelerator(Hitable* a);
+        const Hitable* world() const { return accel.get(); }
+
+        // Indices of the static spheres with an emissive material. Other emitters still
+        // light the scene, but only through rays that happen to hit them.
+        const std::vector<int>& lights() const { return light_list; }
+
+        const Material& material(int index) const { return materials[index]; }
+        // The material at a hit with its texture, if any, applied to the albedo.
+        Material shade(const Ray& r, const hit_record& rec) const;
+
+        // Bytes held by the primitive, material and texture arenas, meshes included. Texture
+        // images are counted by texture_cache.stats() instead.
+        size_t memory_bytes() const;
+
+        // Drops all primitives, materials, textures and the accelerator but keeps the arena
+        // capacity, so building many scenes in a row does not reallocate.
+        void clear();
+
+        SceneCamera camera;
+        bool sky;       // rays that escape see the sky gradient, or black if false
+        std::vector<Material> materials;
+        std::vector<Texture> textures;
+        TextureCache texture_cache;     // the images of image textures
+        std::vector<Sphere> spheres;
+        std::vector<MovingSphere> moving_spheres;
+        std::vector<TriangleMesh> meshes;
+        std::vector<std::unique_ptr<Group>> groups;     // instances point into these
+        std::vector<Instance> instances;
+
+    private:
+        std::vector<Hitable*> prim_ptrs;
+        std::vector<int> light_list;
+        std::unique_ptr<Hitable> accel;
+};
+
+inline int Scene::add_material(const Material& m) {
+    materials.push_back(m);
+    return int(materials.size()) - 1;
+}
+
+inline int Scene::add_texture(const Texture& t) {
+    textures.push_back(t);
+    return int(textures.size()) - 1;
+}
+
+inline Material Scene::shade(const Ray& r, const hit_record& rec) const {
+    Material m = materials[rec.material];
+    if (m.texture >= 0)
+        m.albedo *= texture_value(textures[m.texture], texture_cache, r, rec);
+    return m;
+}
+
+inline void Scene::add_sphere(const Vector3& center, float radius, int material) {
+    spheres.push_back(Sphere(center, radius, material));
+}
+
+inline void Scene::add_moving_sphere(const Vector3& center0, const Vector3& center1, float time0, float time1,
+                                     float radius, int material) {
+    moving_spheres.push_back(MovingSphere(center0, center1, time0, time1, radius, material));
+}
+
+inline void Scene::add_mesh(TriangleMesh&& mesh) {
+    meshes.push_back(std::move(mesh));
+}
+
+inline int Scene::add_group(Group* group) {
+    group->build();
+    groups.emplace_back(group);
+    return int(groups.size()) - 1;
+}
+
+inline void Scene::add_instance(int group, const Affine& to_world, int material) {
+    instances.push_back(Instance(groups[group].get(), to_world, material));
+}
+
+inline size_t Scene::num_triangles() const {
+    size_t n = 0;
+    for (const TriangleMesh& m : meshes)
+        n += m.num_triangles();
+    for (const std::unique_ptr<Group>& g : groups) {
+        for (const TriangleMesh& m : g->meshes)
+            n += m.num_triangles();
+    }
+    return n;
+}
+
+inline void Scene::set_accelerator(Hitable* a) {
+    accel.reset(a);
+    light_list.clear();
+    for (size_t i = 0; i < spheres.size(); i++) {
+        if (is_emissive(materials[spheres[i].material]))
+            light_list.push_back(int(i));
+    }
+}
+
+inline Hitable** Scene::primitives() {
+    prim_ptrs.resize(num_primitives());
+    for (size_t i = 0; i < spheres.size(); i++)
+        prim_ptrs[i] = &spheres[i];
+    for (size_t i = 0; i < moving_spheres.size(); i++)
+        prim_ptrs[spheres.size() + i] = &moving_spheres[i];
+    size_t next = spheres.size() + moving_spheres.size();
+    for (size_t i = 0; i < meshes.size(); i++)
+        prim_ptrs[next++] = &meshes[i];
+    for (size_t i = 0; i < instances.size(); i++)
+        prim_ptrs[next++] = &instances[i];
+    return prim_ptrs.data();
+}
+
+inline size_t Scene::memory_bytes() const {
+    size_t bytes = materials.capacity() * sizeof(Material) + textures.capacity() * sizeof(Texture) + spheres.capacity() * sizeof(Sphere)
+         + moving_spheres.capacity() * sizeof(MovingSphere) + prim_ptrs.capacity() * sizeof(Hitable*);
+    for (const TriangleMesh& m : meshes)
+        bytes += m.memory_bytes();
+    for (const std::unique_ptr<Group>& g : groups)
+        bytes += sizeof(Group) + g->memory_bytes();
+    return bytes + instances.capacity() * sizeof(Instance);
+}
+
+inline void Scene::clear() {
+    camera = SceneCamera();
+    sky = true;
+    accel.reset();
+    light_list.clear();
+    prim_ptrs.clear();
+    spheres.clear();
+    moving_spheres.clear();
+    meshes.clear();
+    instances.clear();
+    groups.clear();
+    materials.clear();
+    textures.clear();
+    texture_cache.clear();
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef SCENEIO_H
+#define SCENEIO_H
+
+#include "Animation.h"
+#include "Scene.h"
+
+// Text scenes (.scene) have one entry per line; '#' starts a comment:
+//
+//   camera <lookfrom x y z> <lookat x y z> <vup x y z> <vfov> <aperture> <focus_dist>
+//   shutter <open time> <close time>
+//   checker <r g b> <r g b> <cells per unit>
+//   image <file.ppm or file.pfm>
+//   lambertian <r g b> [texture]
+//   metal <r g b> <fuzz> [texture]
+//   dielectric <refractive index>
+//   diffuse_light <r g b radiance>
+//   sky <0 or 1>
+//   sphere <x y z> <radius> <material>
+//   moving_sphere <x0 y0 z0> <x1 y1 z1> <time0> <time1> <radius> <material>
+//   mesh <file.obj> <material>
+//   group
+//   end
+//   instance <group> <material> <3x4 row-major matrix>
+//
+// Materials are numbered from 0 in the order they appear and primitives refer to them by
+// that number; textures are numbered the same way and multiply the albedo of the
+// materials that name one. Mesh and image paths are relative to the scene file and may
+// not contain blanks; saving writes them relative to the new file. Images are only read
+// as far as their headers here, their texels being left to the scene's TextureCache.
+//
+// The sphere and mesh entries between 'group' and 'end' make up a group, numbered from 0
+// like materials, which is placed only through instances: the matrix maps the group's
+// space to the world, and a material of -1 keeps the group's own materials.
+bool load_scene_text(const char* path, Scene& scene);
+bool save_scene_text(const char* path, const Scene& scene);
+
+// Binary scenes (.pscn) are a fixed header followed by the material and sphere arenas as
+// flat records in the writer's byte order (checked on load), so loading maps the file
+// and copies them into the arenas in one pass, without parsing. They cannot hold meshes,
+// instances or textures.
+bool load_scene_binary(const char* path, Scene& scene);
+bool save_scene_binary(const char* path, const Scene& scene);
+
+// Pick the format from the file extension. Loading replaces everything in the scene,
+// including its accelerator. Errors are reported on std::cout.
+bool load_scene(const char* path, Scene& scene);
+bool save_scene(const char* path, const Scene& scene);
+
+bool is_scene_file(const char* path);
+
+// Wavefront OBJ meshes: v, vn and f entries are read and everything else (texture
+// coordinates, groups, materials) is skipped. Faces may use any of the v, v/vt, v//vn and
+// v/vt/vn forms with absolute or negative indices; polygons are split into fans. Shading
+// normals are kept only if every face has them. The file is parsed in place from its
+// mapping, in one pass after a quick one that sizes the buffers exactly, and the mesh's
+// BVH is built before returning. Replaces the mesh's geometry and keeps its material.
+bool load_obj(const char* path, TriangleMesh& mesh);
+
+// Camera paths are text files of keyframes, one per line, in any time order:
+//
+//   key <time> <lookfrom x y z> <lookat x y z>
+bool load_camera_path(const char* path, CameraPath& camera_path);
+
+#endif
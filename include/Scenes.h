@@ -0,0 +1,251 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include <algorithm>
+#include <vector>
+
+#include "Random.h"
+#include "Scene.h"
+
+// With 'moving' set, the small diffuse spheres bounce up by a random height while the
+// shutter is open, as in the motion blur scene of Ray Tracing: The Next Week. With
+// 'instanced' set, the small spheres that stay put are instances of one shared unit
+// sphere instead.
+inline void random_scene(Scene& scene, bool moving = false, bool instanced = false) {
+    // Own generator with a fixed seed: the scene is the same on every run and thread.
+    Pcg32 scene_rng(1);
+    auto scene_random = [&scene_rng]() { return scene_rng.next_float(); };
+    scene.clear();
+    int glass = scene.add_material(dielectric(1.5f));
+    scene.add_sphere(Vector3(0,-1000,0), 1000, scene.add_material(lambertian(Vector3(0.5, 0.5, 0.5))));
+    int unit_sphere = -1;
+    if (instanced) {
+        Group* group = new Group();
+        group->add_sphere(Vector3(0, 0, 0), 1.0f, glass);
+        unit_sphere = scene.add_group(group);
+    }
+    auto add_small_sphere = [&](const Vector3& center, int material) {
+        if (instanced)
+            scene.add_instance(unit_sphere, Affine::translation(center) * Affine::scaling(0.2f), material);
+        else
+            scene.add_sphere(center, 0.2f, material);
+    };
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            float choose_mat = scene_random();
+            Vector3 center(a+0.9*scene_random(),0.2,b+0.9*scene_random()); 
+            if ((center-Vector3(4,0.2,0)).length() > 0.9) { 
+                if (choose_mat < 0.8) {  // diffuse
+                    int m = scene.add_material(lambertian(Vector3(scene_random()*scene_random(), scene_random()*scene_random(), scene_random()*scene_random())));
+                    if (moving)
+                        scene.add_moving_sphere(center, center + Vector3(0, 0.5f*scene_random(), 0), 0.0f, 1.0f, 0.2f, m);
+                    else
+                        add_small_sphere(center, m);
+                }
+                else if (choose_mat < 0.95) { // metal
+                    add_small_sphere(center,
+                            scene.add_material(metal(Vector3(0.5f*(1.f + scene_random()), 0.5f*(1.f + scene_random()), 0.5f*(1.f + scene_random())),  0.5f*scene_random())));
+                }
+                else {  // glass
+                    add_small_sphere(center, glass);
+                }
+            }
+        }
+    }
+
+    scene.add_sphere(Vector3(0.f, 1.f, 0.f), 1.0f, glass);
+    scene.add_sphere(Vector3(-4.f, 1.f, 0.f), 1.0f, scene.add_material(lambertian(Vector3(0.4f, 0.2f, 0.1f))));
+    scene.add_sphere(Vector3(4.f, 1.f, 0.f), 1.0f, scene.add_material(metal(Vector3(0.7f, 0.6f, 0.5f), 0.0f)));
+    if (moving)
+        scene.camera.time1 = 1.0f;
+}
+
+inline void motion_scene(Scene& scene) {
+    random_scene(scene, true);
+}
+
+inline void instanced_scene(Scene& scene) {
+    random_scene(scene, false, true);
+}
+
+inline void simple_scene(Scene& scene) {
+    scene.clear();
+    scene.camera.lookfrom = Vector3(-2.f, 2.f, 1.f);
+    scene.camera.lookat = Vector3(0.f, 0.f, -1.f);
+    scene.camera.focus_dist = (scene.camera.lookfrom - scene.camera.lookat).length();
+    scene.camera.aperture = 0.0f;
+    int glass = scene.add_material(dielectric(1.5));
+    scene.add_sphere(Vector3(0,0,-1), 0.5, scene.add_material(lambertian(Vector3(0.1, 0.2, 0.5))));
+    scene.add_sphere(Vector3(0,-100.5,-1), 100, scene.add_material(lambertian(Vector3(0.8, 0.8, 0.0))));
+    scene.add_sphere(Vector3(1,0,-1), 0.5, scene.add_material(metal(Vector3(0.8, 0.6, 0.2), 0.0)));
+    scene.add_sphere(Vector3(-1,0,-1), 0.5, glass);
+    scene.add_sphere(Vector3(-1,0,-1), -0.45, glass);
+}
+
+// Night version of the simple scene: no sky, lit only by two small spheres, so almost
+// all light arrives through the light sampling of the path integrator.
+inline void lights_scene(Scene& scene) {
+    scene.clear();
+    scene.sky = false;
+    scene.camera.lookfrom = Vector3(-2.f, 2.f, 1.f);
+    scene.camera.lookat = Vector3(0.f, 0.f, -1.f);
+    scene.camera.focus_dist = (scene.camera.lookfrom - scene.camera.lookat).length();
+    scene.camera.aperture = 0.0f;
+    int glass = scene.add_material(dielectric(1.5));
+    scene.add_sphere(Vector3(0,0,-1), 0.5, scene.add_material(lambertian(Vector3(0.1, 0.2, 0.5))));
+    scene.add_sphere(Vector3(0,-100.5,-1), 100, scene.add_material(lambertian(Vector3(0.8, 0.8, 0.0))));
+    scene.add_sphere(Vector3(1,0,-1), 0.5, scene.add_material(metal(Vector3(0.8, 0.6, 0.2), 0.3)));
+    scene.add_sphere(Vector3(-1,0,-1), 0.5, glass);
+    scene.add_sphere(Vector3(-1,0,-1), -0.45, glass);
+    scene.add_sphere(Vector3(0.5,1.2,-0.3), 0.1, scene.add_material(diffuse_light(Vector3(40, 36, 30))));
+    scene.add_sphere(Vector3(-1.5,0.8,-2), 0.15, scene.add_material(diffuse_light(Vector3(6, 8, 16))));
+}
+
+// Latitude and longitude lines over cells of colour, linear RGB with the top row first:
+// fine, high contrast detail that shows up any aliasing in texture filtering.
+inline std::vector<float> grid_image(int width, int height) {
+    const Vector3 palette[6] = { Vector3(0.8f, 0.1f, 0.1f), Vector3(0.9f, 0.6f, 0.1f), Vector3(0.2f, 0.6f, 0.2f),
+                                 Vector3(0.1f, 0.4f, 0.8f), Vector3(0.5f, 0.2f, 0.7f), Vector3(0.7f, 0.7f, 0.7f) };
+    std::vector<float> rgb(size_t(width) * height * 3);
+    int cell = std::max(1, height / 16);
+    int line = std::max(1, height / 512);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            Vector3 c = x % cell < line || y % cell < line ? Vector3(1.0f, 1.0f, 1.0f)
+                                                           : palette[(x / cell + 2 * (y / cell)) % 6];
+            float* out = &rgb[3 * (size_t(y) * width + x)];
+            out[0] = c[0];
+            out[1] = c[1];
+            out[2] = c[2];
+        }
+    }
+    return rgb;
+}
+
+// The simple scene with textures: a checkered floor, and the diffuse and metal spheres
+// wrapped in a generated 2048 x 1024 grid image that goes through the texture cache.
+inline void textured_scene(Scene& scene) {
+    scene.clear();
+    scene.camera.lookfrom = Vector3(-2.f, 2.f, 1.f);
+    scene.camera.lookat = Vector3(0.f, 0.f, -1.f);
+    scene.camera.focus_dist = (scene.camera.lookfrom - scene.camera.lookat).length();
+    scene.camera.aperture = 0.0f;
+    int grid = scene.add_texture(image_texture(scene.texture_cache.add_image(2048, 1024, grid_image(2048, 1024), "grid")));
+    int checker = scene.add_texture(checker_texture(Vector3(0.8f, 0.8f, 0.8f), Vector3(0.1f, 0.25f, 0.1f), 4.0f));
+    int glass = scene.add_material(dielectric(1.5));
+    scene.add_sphere(Vector3(0,0,-1), 0.5, scene.add_material(lambertian(Vector3(1, 1, 1), grid)));
+    scene.add_sphere(Vector3(0,-100.5,-1), 100, scene.add_material(lambertian(Vector3(1, 1, 1), checker)));
+    scene.add_sphere(Vector3(1,0,-1), 0.5, scene.add_material(metal(Vector3(0.9, 0.8, 0.6), 0.05, grid)));
+    scene.add_sphere(Vector3(-1,0,-1), 0.5, glass);
+    scene.add_sphere(Vector3(-1,0,-1), -0.45, glass);
+}
+
+// Closed torus around the y axis through 'center', 'rings' quads around the tube and
+// 'segments' along it, two triangles each. Vertices are shared across the seams, so the
+// surface has no cracks; 'smooth' adds per-vertex normals, indexed like the positions.
+inline TriangleMesh torus_mesh(const Vector3& center, float major_radius, float minor_radius,
+                               int segments, int rings, bool smooth, int material) {
+    TriangleMesh mesh;
+    mesh.material = material;
+    mesh.positions.reserve(size_t(segments) * rings);
+    for (int i = 0; i < segments; i++) {
+        float phi = 2.0f * 3.14159265f * float(i) / float(segments);
+        Vector3 ring_dir(cosf(phi), 0.0f, sinf(phi));
+        for (int j = 0; j < rings; j++) {
+            float theta = 2.0f * 3.14159265f * float(j) / float(rings);
+            Vector3 n = cosf(theta) * ring_dir + Vector3(0.0f, sinf(theta), 0.0f);
+            mesh.positions.push_back(center + major_radius * ring_dir + minor_radius * n);
+            if (smooth)
+                mesh.normals.push_back(n);
+        }
+    }
+    mesh.indices.reserve(size_t(segments) * rings * 6);
+    for (int i = 0; i < segments; i++) {
+        for (int j = 0; j < rings; j++) {
+            uint32_t a = uint32_t(i * rings + j);
+            uint32_t b = uint32_t(((i + 1) % segments) * rings + j);
+            uint32_t c = uint32_t(((i + 1) % segments) * rings + (j + 1) % rings);
+            uint32_t d = uint32_t(i * rings + (j + 1) % rings);
+            uint32_t quad[6] = { a, d, c, a, c, b };
+            mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+        }
+    }
+    mesh.build();
+    return mesh;
+}
+
+// The simple scene's spheres swapped for tessellated tori: a diffuse one with smooth
+// normals, a faceted metal one and a glass one, 'detail' segments around each.
+inline void mesh_scene(Scene& scene, int detail = 96) {
+    scene.clear();
+    scene.camera.lookfrom = Vector3(-2.f, 2.f, 1.f);
+    scene.camera.lookat = Vector3(0.f, 0.f, -1.f);
+    scene.camera.focus_dist = (scene.camera.lookfrom - scene.camera.lookat).length();
+    scene.camera.aperture = 0.0f;
+    scene.add_sphere(Vector3(0,-100.5,-1), 100, scene.add_material(lambertian(Vector3(0.8, 0.8, 0.0))));
+    int diffuse = scene.add_material(lambertian(Vector3(0.1, 0.2, 0.5)));
+    int gold = scene.add_material(metal(Vector3(0.8, 0.6, 0.2), 0.0));
+    int glass = scene.add_material(dielectric(1.5));
+    scene.add_mesh(torus_mesh(Vector3(0,-0.3,-1), 0.35f, 0.2f, detail, detail / 2, true, diffuse));
+    scene.add_mesh(torus_mesh(Vector3(1,-0.3,-1), 0.35f, 0.2f, detail / 4, detail / 8, false, gold));
+    scene.add_mesh(torus_mesh(Vector3(-1,-0.3,-1), 0.35f, 0.2f, detail, detail / 2, true, glass));
+}
+
+// A side x side grid of trees, bushes and the odd metal ring, each placed at a random
+// spot in its cell with a random turn and size. There are only three groups, so memory
+// grows with the number of instances at under 100 bytes each plus the top-level BVH.
+inline void forest_scene(Scene& scene, int side = 1000) {
+    Pcg32 scene_rng(1);
+    auto scene_random = [&scene_rng]() { return scene_rng.next_float(); };
+    scene.clear();
+    scene.camera.lookfrom = Vector3(0.f, 3.f, 0.f);
+    scene.camera.lookat = Vector3(12.f, 0.5f, 9.f);
+    scene.camera.vfov = 50.f;
+    scene.camera.aperture = 0.0f;
+    scene.camera.focus_dist = (scene.camera.lookat - scene.camera.lookfrom).length();
+    scene.add_sphere(Vector3(0,-100000,0), 100000, scene.add_material(lambertian(Vector3(0.35, 0.3, 0.2))));
+
+    // A fir of stacked spheres on a trunk, 1 unit tall at scale 1.
+    int bark = scene.add_material(lambertian(Vector3(0.3, 0.2, 0.1)));
+    int needles = scene.add_material(lambertian(Vector3(0.1, 0.35, 0.1)));
+    Group* fir = new Group();
+    for (int i = 0; i < 4; i++)
+        fir->add_sphere(Vector3(0.0f, 0.05f + 0.1f*i, 0.0f), 0.05f, bark);
+    fir->add_sphere(Vector3(0.0f, 0.45f, 0.0f), 0.25f, needles);
+    fir->add_sphere(Vector3(0.0f, 0.7f, 0.0f), 0.18f, needles);
+    fir->add_sphere(Vector3(0.0f, 0.9f, 0.0f), 0.1f, needles);
+    int tree = scene.add_group(fir);
+
+    Group* ball = new Group();
+    ball->add_sphere(Vector3(0.0f, 0.0f, 0.0f), 1.0f, needles);
+    int bush = scene.add_group(ball);
+
+    Group* torus = new Group();
+    torus->add_mesh(torus_mesh(Vector3(0, 0, 0), 1.0f, 0.3f, 48, 24, true, bark));
+    int ring = scene.add_group(torus);
+
+    int bush_colors[4];
+    for (int i = 0; i < 4; i++)
+        bush_colors[i] = scene.add_material(lambertian(Vector3(0.1f + 0.3f*scene_random(), 0.3f + 0.3f*scene_random(), 0.1f)));
+    int chrome = scene.add_material(metal(Vector3(0.8f, 0.8f, 0.85f), 0.05f));
+
+    const float spacing = 1.5f;
+    scene.instances.reserve(size_t(side) * side);
+    for (int i = 0; i < side; i++) {
+        for (int j = 0; j < side; j++) {
+            Vector3 spot(spacing * (i + 0.2f + 0.6f*scene_random()), 0.0f, spacing * (j + 0.2f + 0.6f*scene_random()));
+            Affine turn = Affine::rotation(Vector3(0, 1, 0), 360.0f * scene_random());
+            float kind = scene_random(), size = 0.6f + 0.8f*scene_random();
+            if (kind < 0.75f)
+                scene.add_instance(tree, Affine::translation(spot) * turn * Affine::scaling(1.5f * size));
+            else if (kind < 0.98f)
+                scene.add_instance(bush, Affine::translation(spot) * Affine::scaling(Vector3(0.3f, 0.2f, 0.3f) * size),
+                                   bush_colors[int(4.0f * scene_random()) & 3]);
+            else
+                scene.add_instance(ring, Affine::translation(spot + Vector3(0, 0.3f*size, 0)) * turn
+                                   * Affine::rotation(Vector3(1, 0, 0), 70.0f) * Affine::scaling(0.3f * size), chrome);
+        }
+    }
+}
+
+#endif
@@ -6,38 +6,67 @@
 class Sphere: public Hitable  {
     public:
         Sphere() {}
-        Sphere(Vector3 cen, float r, Material *m) : center(cen), radius(r), mat_ptr(m)  {};
+        Sphere(Vector3 cen, float r, int m) : center(cen), radius(r), material(m)  {};
         virtual bool hit(const Ray& r, float tmin, float tmax, hit_record& rec) const;
+        virtual bool occluded(const Ray& r, float tmin, float tmax) const;
+        virtual bool bounding_box(AABB& box) const;
         Vector3 center;
         float radius;
-        Material *mat_ptr;
+        int material;
 };
 
-bool Sphere::hit(const Ray& r, float t_min, float t_max, hit_record& rec) const {
+inline bool Sphere::hit(const Ray& r, float t_min, float t_max, hit_record& rec) const {
     Vector3 oc = r.origin() - center;
     float a = dot(r.direction(), r.direction());
     float b = dot(oc, r.direction());
     float c = dot(oc, oc) - radius*radius;
     float discriminant = b*b - a*c;
-    if (discriminant > 0) {
-        float temp = (-b - sqrt(discriminant))/a;
+    if (discriminant > 0.0f) {
+        float root = sqrtf(discriminant);
+        float temp = (-b - root)/a;
         if (temp < t_max && temp > t_min) {
             rec.t = temp;
             rec.p = r.point_at_parameter(rec.t);
             rec.normal = (rec.p - center) / radius;
-            rec.mat_ptr = mat_ptr;
+            rec.material = material;
+            rec.local_normal = rec.normal;
+            rec.size = fabsf(radius);
             return true;
         }
-        temp = (-b + sqrt(discriminant)) / a;
+        temp = (-b + root) / a;
         if (temp < t_max && temp > t_min) {
             rec.t = temp;
             rec.p = r.point_at_parameter(rec.t);
             rec.normal = (rec.p - center) / radius;
-            rec.mat_ptr = mat_ptr;
+            rec.material = material;
+            rec.local_normal = rec.normal;
+            rec.size = fabsf(radius);
             return true;
         }
     }
     return false;
 }
 
+inline bool Sphere::occluded(const Ray& r, float t_min, float t_max) const {
+    Vector3 oc = r.origin() - center;
+    float a = dot(r.direction(), r.direction());
+    float b = dot(oc, r.direction());
+    float c = dot(oc, oc) - radius*radius;
+    float discriminant = b*b - a*c;
+    if (discriminant <= 0.0f)
+        return false;
+    float root = sqrtf(discriminant);
+    float temp = (-b - root)/a;
+    if (temp < t_max && temp > t_min)
+        return true;
+    temp = (-b + root)/a;
+    return temp < t_max && temp > t_min;
+}
+
+inline bool Sphere::bounding_box(AABB& box) const {
+    float r = fabsf(radius);
+    box = AABB(center - Vector3(r, r, r), center + Vector3(r, r, r));
+    return true;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,118 @@
+#ifndef SPHERESOA_H
+#define SPHERESOA_H
+
+#include <vector>
+
+#include "Hitable.h"
+#include "Sphere.h"
+#include "Stats.h"
+
+// Nearest-hit kernel over spheres [begin, end) of a structure-of-arrays. Returns the
+// index of the nearest sphere hit in (t_min, t_max), or -1, and its distance in 't'.
+typedef int (*SphereKernel)(const float* cx, const float* cy, const float* cz, const float* radius,
+                            int begin, int end, const Ray& r, float t_min, float t_max, float& t);
+
+struct SphereKernelInfo {
+    const char* name;
+    int width;
+    SphereKernel fn;
+};
+
+// The kernel in use, the widest one the running CPU supports unless overridden.
+const SphereKernelInfo& sphere_kernel();
+// Accepts "auto", "scalar", "sse", "avx2" or "avx512"; fails if the CPU lacks support.
+// Not thread-safe, call before rendering starts.
+bool set_sphere_kernel(const char* name);
+
+// Runs the active kernel, or the scalar one when the range is narrower than a vector,
+// since small BVH leaves do not amortize the lane setup and reduction.
+int intersect_spheres(const float* cx, const float* cy, const float* cz, const float* radius,
+                      int begin, int end, const Ray& r, float t_min, float t_max, float& t);
+
+// Spheres stored as contiguous center/radius arrays with per-sphere material indices,
+// intersected several at a time by the SIMD kernel instead of one virtual call each.
+class SphereSoA: public Hitable  {
+    public:
+        SphereSoA() {}
+        // Takes the Sphere objects out of a list; anything else is ignored.
+        SphereSoA(Hitable **l, int n);
+
+        void add(const Vector3& center, float r, int m);
+        int size() const { return int(radius.size()); }
+
+        virtual bool hit(const Ray& r, float tmin, float tmax, hit_record& rec) const;
+        virtual bool occluded(const Ray& r, float tmin, float tmax) const;
+        virtual bool bounding_box(AABB& box) const;
+
+        bool hit_range(const Ray& r, int begin, int end, float tmin, float tmax, hit_record& rec) const;
+        // Fills 'rec' for sphere i, hit by 'r' at t. Traversals that find closer hits one
+        // leaf after another keep only the index and t, and call this once at the end.
+        void fill_record(int i, const Ray& r, float t, hit_record& rec) const;
+        bool occluded_range(const Ray& r, int begin, int end, float tmin, float tmax) const;
+
+        std::vector<float> cx, cy, cz;
+        std::vector<float> radius;
+        std::vector<int> material;
+};
+
+inline SphereSoA::SphereSoA(Hitable **l, int n) {
+    for (int i = 0; i < n; i++) {
+        const Sphere* s = dynamic_cast<const Sphere*>(l[i]);
+        if (s)
+            add(s->center, s->radius, s->material);
+    }
+}
+
+inline void SphereSoA::add(const Vector3& center, float r, int m) {
+    cx.push_back(center[0]);
+    cy.push_back(center[1]);
+    cz.push_back(center[2]);
+    radius.push_back(r);
+    material.push_back(m);
+}
+
+inline bool SphereSoA::hit_range(const Ray& r, int begin, int end, float t_min, float t_max, hit_record& rec) const {
+    float t;
+    int i = intersect_spheres(cx.data(), cy.data(), cz.data(), radius.data(), begin, end, r, t_min, t_max, t);
+    if (i < 0)
+        return false;
+    fill_record(i, r, t, rec);
+    return true;
+}
+
+inline void SphereSoA::fill_record(int i, const Ray& r, float t, hit_record& rec) const {
+    Vector3 center(cx[i], cy[i], cz[i]);
+    rec.t = t;
+    rec.p = r.point_at_parameter(t);
+    rec.normal = (rec.p - center) / radius[i];
+    rec.material = material[i];
+    rec.local_normal = rec.normal;
+    rec.size = fabsf(radius[i]);
+}
+
+inline bool SphereSoA::hit(const Ray& r, float t_min, float t_max, hit_record& rec) const {
+    PICORAY_COUNT(intersection_tests, size());
+    return hit_range(r, 0, size(), t_min, t_max, rec);
+}
+
+inline bool SphereSoA::occluded_range(const Ray& r, int begin, int end, float t_min, float t_max) const {
+    float t;
+    return intersect_spheres(cx.data(), cy.data(), cz.data(), radius.data(), begin, end, r, t_min, t_max, t) >= 0;
+}
+
+inline bool SphereSoA::occluded(const Ray& r, float t_min, float t_max) const {
+    PICORAY_COUNT(intersection_tests, size());
+    return occluded_range(r, 0, size(), t_min, t_max);
+}
+
+inline bool SphereSoA::bounding_box(AABB& box) const {
+    box = AABB();
+    for (int i = 0; i < size(); i++) {
+        float rad = fabsf(radius[i]);
+        box.expand(Vector3(cx[i] - rad, cy[i] - rad, cz[i] - rad));
+        box.expand(Vector3(cx[i] + rad, cy[i] + rad, cz[i] + rad));
+    }
+    return size() > 0;
+}
+
+#endif
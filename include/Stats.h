@@ -0,0 +1,111 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <ostream>
+
+// Render counters. Each thread bumps its own plain copy with PICORAY_COUNT and workers
+// fold it into the process-wide atomics once per tile, so counting costs no shared
+// writes in the hot loops. Building with PICORAY_STATS=0 turns every PICORAY_COUNT into
+// a no-op.
+#ifndef PICORAY_STATS
+#define PICORAY_STATS 1
+#endif
+
+#if PICORAY_STATS
+#define PICORAY_COUNT(field, n) (render_counters.field += (n))
+#else
+#define PICORAY_COUNT(field, n) ((void)(n))
+#endif
+
+struct RenderCounters {
+    static const int max_material_types = 8;
+    static const int depth_bins = 64;  // the last bin also holds longer paths
+
+    uint64_t primary_rays;
+    uint64_t secondary_rays;
+    uint64_t shadow_rays;
+    uint64_t bvh_traversals;
+    uint64_t bvh_nodes_visited;
+    uint64_t intersection_tests;
+    uint64_t texture_lookups;
+    uint64_t scatters[max_material_types];  // by MaterialType
+    uint64_t path_depth[depth_bins];        // bounces taken by each finished path
+};
+
+inline thread_local RenderCounters render_counters = {};
+
+inline void count_path_depth([[maybe_unused]] int depth) {
+    PICORAY_COUNT(path_depth[depth < RenderCounters::depth_bins ? depth : RenderCounters::depth_bins - 1], 1);
+}
+
+// Process-wide totals, one atomic per counter.
+class RenderStats {
+    public:
+        RenderStats() { reset(); }
+
+        void add(const RenderCounters& c);
+        RenderCounters totals() const;
+        void reset();
+
+    private:
+        static const int num_fields = sizeof(RenderCounters) / sizeof(uint64_t);
+        std::atomic<uint64_t> fields[num_fields];
+};
+
+inline RenderStats render_stats;
+
+inline void flush_render_counters() {
+#if PICORAY_STATS
+    render_stats.add(render_counters);
+    render_counters = RenderCounters();
+#endif
+}
+
+inline void RenderStats::add(const RenderCounters& c) {
+    const uint64_t* v = reinterpret_cast<const uint64_t*>(&c);
+    for (int i = 0; i < num_fields; i++) {
+        if (v[i])
+            fields[i].fetch_add(v[i], std::memory_order_relaxed);
+    }
+}
+
+inline RenderCounters RenderStats::totals() const {
+    RenderCounters c;
+    uint64_t* v = reinterpret_cast<uint64_t*>(&c);
+    for (int i = 0; i < num_fields; i++)
+        v[i] = fields[i].load(std::memory_order_relaxed);
+    return c;
+}
+
+inline void RenderStats::reset() {
+    for (int i = 0; i < num_fields; i++)
+        fields[i].store(0, std::memory_order_relaxed);
+}
+
+// Writes the counters as a JSON object, without a trailing newline.
+inline void write_counters_json(std::ostream& out, const RenderCounters& c, const char* const* material_names) {
+    out << "{\"primary_rays\": " << c.primary_rays
+        << ", \"secondary_rays\": " << c.secondary_rays
+        << ", \"shadow_rays\": " << c.shadow_rays
+        << ", \"bvh_traversals\": " << c.bvh_traversals
+        << ", \"bvh_nodes_visited\": " << c.bvh_nodes_visited
+        << ", \"intersection_tests\": " << c.intersection_tests
+        << ", \"texture_lookups\": " << c.texture_lookups
+        << ", \"scatters\": {";
+    bool first = true;
+    for (int i = 0; i < RenderCounters::max_material_types && material_names[i]; i++) {
+        out << (first ? "" : ", ") << "\"" << material_names[i] << "\": " << c.scatters[i];
+        first = false;
+    }
+    int last = RenderCounters::depth_bins - 1;
+    while (last > 0 && !c.path_depth[last])
+        last--;
+    out << "}, \"path_depth\": [";
+    for (int i = 0; i <= last; i++)
+        out << (i ? ", " : "") << c.path_depth[i];
+    out << "]}";
+}
+
+#endif
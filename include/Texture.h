@@ -0,0 +1,62 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <math.h>
+#include <stdint.h>
+
+#include "Hitable.h"
+#include "Ray.h"
+#include "TextureCache.h"
+
+enum TextureType : uint8_t {
+    TEXTURE_CHECKER,
+    TEXTURE_IMAGE
+};
+
+// Indexed by TextureType, null terminated.
+inline const char* const texture_type_names[] = { "checker", "image", nullptr };
+
+// Plain texture record, stored by value in the scene's texture arena and referenced from
+// materials by index. Its value at a hit multiplies the material's albedo.
+struct Texture {
+    TextureType type;
+    Vector3 color0, color1;     // checker
+    float scale;                // checker cells per unit of length
+    int image;                  // index into the scene's TextureCache
+};
+
+// A solid checkerboard in world space, alternating between 'a' and 'b'.
+inline Texture checker_texture(const Vector3& a, const Vector3& b, float scale) {
+    Texture t;
+    t.type = TEXTURE_CHECKER;
+    t.color0 = a;
+    t.color1 = b;
+    t.scale = scale;
+    t.image = -1;
+    return t;
+}
+
+// An image wrapped around spheres by latitude and longitude.
+inline Texture image_texture(int image) {
+    Texture t;
+    t.type = TEXTURE_IMAGE;
+    t.color0 = t.color1 = Vector3(1.0f, 1.0f, 1.0f);
+    t.scale = 1.0f;
+    t.image = image;
+    return t;
+}
+
+// Longitude and latitude of a unit direction as image coordinates: the +y pole along the
+// top edge, v = 1 at the -y pole, and u running once around from the -x axis.
+inline void sphere_uv(const Vector3& n, float& u, float& v) {
+    u = (atan2f(-n.z(), n.x()) + 3.14159265f) * (0.5f / 3.14159265f);
+    v = acosf(fminf(fmaxf(n.y(), -1.0f), 1.0f)) * (1.0f / 3.14159265f);
+}
+
+// The ray's footprint at the hit picks the filter width. A checker fades to the average
+// of its colours as the footprint grows past half a cell, rather than aliasing. For an
+// image, the footprint over the primitive's size is an angle on the sphere, of which the
+// image's height spans pi, and grazing hits stretch it by 1/cos.
+Vector3 texture_value(const Texture& t, const TextureCache& cache, const Ray& r, const hit_record& rec);
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Vector3.h"
+
+struct TextureCacheStats {
+    uint64_t requests;      // tiles asked of the shared cache by the per-thread ones
+    uint64_t hits;          // requests for tiles already resident
+    uint64_t tiles_loaded;  // level 0 tiles read from their image
+    uint64_t tiles_built;   // mip tiles filtered down from the level below
+    uint64_t evictions;
+    uint64_t bytes_loaded;  // image bytes read or copied
+    double load_seconds;    // spent reading level 0 tiles
+    size_t resident_bytes;
+    size_t peak_bytes;
+    size_t budget_bytes;
+};
+
+// Image textures, read in square tiles of linear RGB as lookups need them and kept under
+// a memory budget. Only headers are read when an image is added, so a scene can reference
+// far more texels than fit in memory. Mip levels are never stored whole either: a tile of
+// level l is filtered from the four tiles below it the first time it is needed, so
+// making it reads up to 4^l tiles of the image.
+//
+// Eviction is GreedyDual: every tile has a priority of the cache's clock plus the cost of
+// making it again, refreshed when it is used, and the lowest priority goes first and
+// moves the clock up to it. Without costs that is LRU; with them, coarse tiles outlast
+// fine ones until they have gone unused for long enough, instead of being evicted and
+// rebuilt from the whole image again and again under a small budget.
+//
+// lookup() is safe to call from any number of threads. Each thread keeps its last few
+// tiles of each cache, so the budget can be exceeded by up to thread_tiles tiles per
+// rendering thread while tiles evicted from the shared cache are still in use.
+class TextureCache {
+    public:
+        static const int tile_size = 64;
+        static const int thread_tiles = 32;
+        static const size_t tile_bytes = size_t(tile_size) * tile_size * 3 * sizeof(float);
+        // Below this, what a single thread keeps of its own, tiles are evicted while still
+        // in use and reloaded over and over.
+        static const size_t min_budget = thread_tiles * tile_bytes;
+
+        explicit TextureCache(size_t budget_bytes = size_t(256) << 20);
+        ~TextureCache();
+        TextureCache(const TextureCache&) = delete;
+        TextureCache& operator=(const TextureCache&) = delete;
+
+        // Registers a .ppm (8 or 16 bit, sRGB encoded) or .pfm (linear) file and reads its
+        // header. Returns the image's index, or -1 after printing why it cannot be used.
+        int add_file(const std::string& path);
+        // Registers an image already in memory, 'width' * 'height' linear RGB triples with
+        // the top row first. Its tiles go through the cache like those of a file.
+        int add_image(int width, int height, std::vector<float> rgb, const std::string& name);
+
+        int num_images() const { return int(images.size()); }
+        // The file an image was read from, or the name an in-memory one was given.
+        const std::string& path(int image) const;
+        bool has_file(int image) const;
+        int width(int image) const;
+        int height(int image) const;
+        int levels(int image) const;
+
+        // Colour at (u, v), with (0, 0) the top left corner of the image, u wrapping around
+        // and v clamped, filtered over a footprint 'width' across in units of the image's
+        // height: bilinearly within the two mip levels nearest that size, linearly between.
+        Vector3 lookup(int image, float u, float v, float width) const;
+
+        // Evicts down to the new budget straight away.
+        void set_budget(size_t bytes);
+        TextureCacheStats stats() const;
+        void reset_stats();
+
+        // Drops every image and tile.
+        void clear();
+
+    private:
+        struct Image;
+        struct Tile {
+            Vector3 texel(int x, int y) const {
+                const float* p = &rgb[3 * (size_t(y) * width + x)];
+                return Vector3(p[0], p[1], p[2]);
+            }
+
+            int width, height;
+            std::vector<float> rgb;
+        };
+        typedef std::shared_ptr<const Tile> TilePtr;
+        struct Entry {
+            TilePtr tile;
+            std::set<std::pair<double, uint64_t>>::iterator order;
+        };
+
+        Vector3 bilinear(int image, int level, float u, float v) const;
+        Vector3 texel(int image, int level, int x, int y) const;
+        // Through this thread's cache. The tile stays valid until the thread's next call.
+        const Tile& thread_tile(int image, int level, int tx, int ty) const;
+        TilePtr tile(int image, int level, int tx, int ty) const;
+        TilePtr load_tile(int image, int level, int tx, int ty) const;
+        TilePtr read_tile(const Image& im, int tx, int ty) const;
+        // 'keep' is the tile just inserted, whose loader is about to use it.
+        void evict_locked(uint64_t keep) const;
+
+        std::vector<std::unique_ptr<Image>> images;
+        // Tells this cache's tiles apart in the per-thread caches; changes on clear().
+        uint64_t id;
+
+        mutable std::mutex mutex;
+        mutable std::unordered_map<uint64_t, Entry> resident;
+        mutable std::set<std::pair<double, uint64_t>> order;   // by priority, then key
+        mutable double clock;
+        mutable TextureCacheStats counters;
+};
+
+#endif
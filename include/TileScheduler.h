@@ -0,0 +1,198 @@
+#ifndef TILESCHEDULER_H
+#define TILESCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A rectangular block of the frame, [x0, x1) x [y0, y1) with y = 0 at the top row.
+struct Tile {
+    int index;
+    int x0, y0;
+    int x1, y1;
+};
+
+// Splits a frame into tiles and renders them on a persistent pool of worker threads.
+// Every worker owns a deque seeded with a contiguous run of tiles; it pops from the
+// front of its own deque and, once that is empty, steals from the back of the others.
+class TileScheduler {
+    public:
+        typedef std::function<void(const Tile& tile, int thread_index)> TileFunction;
+        typedef std::function<void(const Tile& tile)> TileCallback;
+
+        TileScheduler(int width, int height, int tile_size = 32, int num_threads = 0);
+        ~TileScheduler();
+
+        // The tiling the scheduler uses, in row-major order, without starting any threads.
+        static std::vector<Tile> make_tiles(int width, int height, int tile_size);
+
+        // Queues every tile of the frame and returns immediately. 'completed' runs on the
+        // worker thread right after 'render' returns for a tile.
+        void start(TileFunction render, TileCallback completed = TileCallback());
+        void wait();
+        void cancel();
+
+        bool finished() const { return tiles_done.load() == int(tiles.size()); }
+        bool cancelled() const { return cancel_flag.load(std::memory_order_relaxed); }
+        int tiles_completed() const { return tiles_done.load(); }
+        int num_tiles() const { return int(tiles.size()); }
+        int num_threads() const { return int(threads.size()); }
+        const std::vector<Tile>& get_tiles() const { return tiles; }
+
+    private:
+        struct WorkQueue {
+            std::mutex lock;
+            std::deque<int> tiles;
+        };
+
+        bool next_tile(int thread_index, int& tile);
+        void worker(int thread_index);
+
+        std::vector<Tile> tiles;
+        std::vector<std::thread> threads;
+        std::vector<WorkQueue> queues;
+
+        TileFunction render_fn;
+        TileCallback completed_fn;
+
+        std::mutex state_lock;
+        std::condition_variable wake;
+        std::condition_variable idle;
+        unsigned int generation;
+        int busy;
+        bool shutdown;
+
+        std::atomic<int> tiles_done;
+        std::atomic<bool> cancel_flag;
+};
+
+inline TileScheduler::TileScheduler(int width, int height, int tile_size, int num_threads)
+    : queues(num_threads > 0 ? num_threads : std::max(1u, std::thread::hardware_concurrency())),
+      generation(0), busy(0), shutdown(false), tiles_done(0), cancel_flag(false) {
+    tiles = make_tiles(width, height, tile_size);
+    for (int i = 0; i < int(queues.size()); i++)
+        threads.emplace_back(&TileScheduler::worker, this, i);
+}
+
+inline std::vector<Tile> TileScheduler::make_tiles(int width, int height, int tile_size) {
+    std::vector<Tile> tiles;
+    tile_size = std::max(1, tile_size);
+    for (int y = 0; y < height; y += tile_size) {
+        for (int x = 0; x < width; x += tile_size) {
+            Tile tile;
+            tile.index = int(tiles.size());
+            tile.x0 = x;
+            tile.y0 = y;
+            tile.x1 = std::min(x + tile_size, width);
+            tile.y1 = std::min(y + tile_size, height);
+            tiles.push_back(tile);
+        }
+    }
+    return tiles;
+}
+
+inline TileScheduler::~TileScheduler() {
+    cancel();
+    wait();
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        shutdown = true;
+    }
+    wake.notify_all();
+    for (std::thread& t : threads)
+        t.join();
+}
+
+inline void TileScheduler::start(TileFunction render, TileCallback completed) {
+    wait();
+
+    render_fn = render;
+    completed_fn = completed;
+    tiles_done = 0;
+    cancel_flag = false;
+
+    // Contiguous runs keep each worker on neighbouring tiles until it has to steal.
+    int n = int(queues.size());
+    for (int q = 0; q < n; q++) {
+        int first = int(tiles.size()) * q / n;
+        int last = int(tiles.size()) * (q + 1) / n;
+        std::lock_guard<std::mutex> guard(queues[q].lock);
+        queues[q].tiles.clear();
+        for (int t = first; t < last; t++)
+            queues[q].tiles.push_back(t);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        busy = n;
+        generation++;
+    }
+    wake.notify_all();
+}
+
+inline void TileScheduler::wait() {
+    std::unique_lock<std::mutex> guard(state_lock);
+    idle.wait(guard, [this] { return busy == 0; });
+}
+
+inline void TileScheduler::cancel() {
+    cancel_flag = true;
+}
+
+inline bool TileScheduler::next_tile(int thread_index, int& tile) {
+    {
+        WorkQueue& own = queues[thread_index];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tiles.empty()) {
+            tile = own.tiles.front();
+            own.tiles.pop_front();
+            return true;
+        }
+    }
+
+    int n = int(queues.size());
+    for (int i = 1; i < n; i++) {
+        WorkQueue& victim = queues[(thread_index + i) % n];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tiles.empty()) {
+            tile = victim.tiles.back();
+            victim.tiles.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void TileScheduler::worker(int thread_index) {
+    unsigned int seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard(state_lock);
+            wake.wait(guard, [&] { return shutdown || generation != seen; });
+            if (shutdown)
+                return;
+            seen = generation;
+        }
+
+        int t;
+        while (!cancelled() && next_tile(thread_index, t)) {
+            render_fn(tiles[t], thread_index);
+            tiles_done.fetch_add(1);
+            if (completed_fn)
+                completed_fn(tiles[t]);
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(state_lock);
+            if (--busy == 0)
+                idle.notify_all();
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <math.h>
+
+#include "AABB.h"
+
+// Affine map p -> A p + t, stored as the top three rows of a 4x4 matrix.
+struct Affine {
+    Affine() {
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++)
+                m[i][j] = i == j ? 1.0f : 0.0f;
+        }
+    }
+
+    static Affine translation(const Vector3& t);
+    static Affine scaling(const Vector3& s);
+    static Affine scaling(float s) { return scaling(Vector3(s, s, s)); }
+    // Counter-clockwise about 'axis' when looking down it.
+    static Affine rotation(const Vector3& axis, float degrees);
+
+    Vector3 point(const Vector3& p) const {
+        return Vector3(m[0][0]*p[0] + m[0][1]*p[1] + m[0][2]*p[2] + m[0][3],
+                       m[1][0]*p[0] + m[1][1]*p[1] + m[1][2]*p[2] + m[1][3],
+                       m[2][0]*p[0] + m[2][1]*p[1] + m[2][2]*p[2] + m[2][3]);
+    }
+    Vector3 vector(const Vector3& v) const {
+        return Vector3(m[0][0]*v[0] + m[0][1]*v[1] + m[0][2]*v[2],
+                       m[1][0]*v[0] + m[1][1]*v[1] + m[1][2]*v[2],
+                       m[2][0]*v[0] + m[2][1]*v[1] + m[2][2]*v[2]);
+    }
+    // The transposed linear part. Applied by the inverse of a map, it carries normals
+    // through the map.
+    Vector3 transposed_vector(const Vector3& v) const {
+        return Vector3(m[0][0]*v[0] + m[1][0]*v[1] + m[2][0]*v[2],
+                       m[0][1]*v[0] + m[1][1]*v[1] + m[2][1]*v[2],
+                       m[0][2]*v[0] + m[1][2]*v[1] + m[2][2]*v[2]);
+    }
+
+    // Box around the mapped corners of 'box'.
+    AABB box(const AABB& box) const;
+    // Computed in double precision; the map must not be singular.
+    Affine inverse() const;
+    float determinant() const;
+
+    float m[3][4];
+};
+
+// Applies b first, then a.
+inline Affine operator*(const Affine& a, const Affine& b) {
+    Affine c;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            c.m[i][j] = a.m[i][0]*b.m[0][j] + a.m[i][1]*b.m[1][j] + a.m[i][2]*b.m[2][j];
+            if (j == 3)
+                c.m[i][j] += a.m[i][3];
+        }
+    }
+    return c;
+}
+
+inline Affine Affine::translation(const Vector3& t) {
+    Affine a;
+    for (int i = 0; i < 3; i++)
+        a.m[i][3] = t[i];
+    return a;
+}
+
+inline Affine Affine::scaling(const Vector3& s) {
+    Affine a;
+    for (int i = 0; i < 3; i++)
+        a.m[i][i] = s[i];
+    return a;
+}
+
+inline Affine Affine::rotation(const Vector3& axis, float degrees) {
+    Vector3 u = unit_vector(axis);
+    float angle = degrees * (3.14159265f / 180.0f);
+    float c = cosf(angle), s = sinf(angle), k = 1.0f - c;
+    Affine a;
+    a.m[0][0] = c + u[0]*u[0]*k;      a.m[0][1] = u[0]*u[1]*k - u[2]*s; a.m[0][2] = u[0]*u[2]*k + u[1]*s;
+    a.m[1][0] = u[1]*u[0]*k + u[2]*s; a.m[1][1] = c + u[1]*u[1]*k;      a.m[1][2] = u[1]*u[2]*k - u[0]*s;
+    a.m[2][0] = u[2]*u[0]*k - u[1]*s; a.m[2][1] = u[2]*u[1]*k + u[0]*s; a.m[2][2] = c + u[2]*u[2]*k;
+    return a;
+}
+
+inline AABB Affine::box(const AABB& b) const {
+    AABB result;
+    for (int corner = 0; corner < 8; corner++) {
+        Vector3 p((corner & 1) ? b.max()[0] : b.min()[0],
+                  (corner & 2) ? b.max()[1] : b.min()[1],
+                  (corner & 4) ? b.max()[2] : b.min()[2]);
+        result.expand(point(p));
+    }
+    return result;
+}
+
+inline float Affine::determinant() const {
+    return m[0][0] * (m[1][1]*m[2][2] - m[1][2]*m[2][1])
+         - m[0][1] * (m[1][0]*m[2][2] - m[1][2]*m[2][0])
+         + m[0][2] * (m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+}
+
+inline Affine Affine::inverse() const {
+    double a[3][3];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++)
+            a[i][j] = m[i][j];
+    }
+    // Adjugate over the determinant, then the translation undone by the inverse.
+    double inv[3][3];
+    inv[0][0] = a[1][1]*a[2][2] - a[1][2]*a[2][1];
+    inv[0][1] = a[0][2]*a[2][1] - a[0][1]*a[2][2];
+    inv[0][2] = a[0][1]*a[1][2] - a[0][2]*a[1][1];
+    inv[1][0] = a[1][2]*a[2][0] - a[1][0]*a[2][2];
+    inv[1][1] = a[0][0]*a[2][2] - a[0][2]*a[2][0];
+    inv[1][2] = a[0][2]*a[1][0] - a[0][0]*a[1][2];
+    inv[2][0] = a[1][0]*a[2][1] - a[1][1]*a[2][0];
+    inv[2][1] = a[0][1]*a[2][0] - a[0][0]*a[2][1];
+    inv[2][2] = a[0][0]*a[1][1] - a[0][1]*a[1][0];
+    double det = a[0][0]*inv[0][0] + a[0][1]*inv[1][0] + a[0][2]*inv[2][0];
+
+    Affine r;
+    for (int i = 0; i < 3; i++) {
+        double t = 0.0;
+        for (int j = 0; j < 3; j++) {
+            inv[i][j] /= det;
+            r.m[i][j] = float(inv[i][j]);
+            t -= inv[i][j] * m[j][3];
+        }
+        r.m[i][3] = float(t);
+    }
+    return r;
+}
+
+#endif
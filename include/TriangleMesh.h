@@ -0,0 +1,265 @@
+#ifndef TRIANGLEMESH_H
+#define TRIANGLEMESH_H
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "BVH.h"
+#include "Hitable.h"
+#include "Stats.h"
+
+// Indexed triangle mesh with one material. Vertices are stored once and shared through
+// 32-bit indices, so a closed mesh costs about 6 bytes of positions and 12 of indices
+// per triangle plus its BVH. The mesh carries its own BVH over the triangles and is a
+// single primitive to the scene's accelerator.
+//
+// Triangles face the side their vertices wind counter-clockwise around, and as with
+// spheres the normal is not flipped towards the ray, so dielectric meshes need to be
+// closed and consistently wound.
+class TriangleMesh: public Hitable  {
+    public:
+        TriangleMesh() : material(0), load_ms(0.0) {}
+
+        // Builds the BVH and reorders the triangles into its leaf order. Call after filling
+        // the buffers and before tracing; the buffers must not change afterwards.
+        void build(int max_leaf_size = lanes);
+
+        int num_triangles() const { return int(indices.size() / 3); }
+        int num_vertices() const { return int(positions.size()); }
+        bool has_normals() const { return !normals.empty(); }
+        const BVHBuildStats& stats() const { return build_stats; }
+        // Vertex, index and BVH storage.
+        size_t memory_bytes() const;
+
+        virtual bool hit(const Ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual bool occluded(const Ray& r, float t_min, float t_max) const;
+        virtual bool bounding_box(AABB& box) const;
+
+        std::vector<Vector3> positions;
+        std::vector<Vector3> normals;           // optional per-vertex shading normals
+        std::vector<uint32_t> indices;          // three positions per triangle
+        // Three normals per triangle; empty if the normals are indexed like the positions,
+        // which build() detects.
+        std::vector<uint32_t> normal_indices;
+        int material;
+        std::string path;       // file the mesh was loaded from, empty if built in code
+        double load_ms;         // time spent reading that file, including the BVH build
+
+        // Triangles tested together by the intersection kernel.
+        static const int lanes = 8;
+
+    private:
+        // Ray set up for the watertight test of Woop, Benthin and Wald (2013): the axis
+        // the direction is largest along becomes z and a shear maps the ray onto it, so
+        // every triangle is tested in the same 2D space and an edge shared by two
+        // triangles gets bit-identical edge functions in both.
+        struct ShearedRay {
+            int kx, ky, kz;
+            float sx, sy, sz;
+        };
+
+        ShearedRay shear(const Ray& r) const;
+        // Tests triangles [first, first + n), n <= lanes. Lanes that miss get t = FLT_MAX;
+        // u, v and w are the unnormalized barycentrics of the hits.
+        void intersect(const Ray& r, const ShearedRay& s, int first, int n, float t_min, float t_max,
+                       float* t, float* u, float* v, float* w) const;
+
+        std::vector<BVHNode> nodes;
+        BVHBuildStats build_stats;
+};
+
+inline void TriangleMesh::build(int max_leaf_size) {
+    auto start = std::chrono::steady_clock::now();
+    build_stats = BVHBuildStats();
+    nodes.clear();
+
+    int n = num_triangles();
+    std::vector<BVHBuildPrim> build_prims(n);
+    for (int i = 0; i < n; i++) {
+        BVHBuildPrim& bp = build_prims[i];
+        bp.box = AABB();
+        for (int k = 0; k < 3; k++)
+            bp.box.expand(positions[indices[3*i + k]]);
+        bp.centroid = bp.box.centroid();
+        bp.index = i;
+    }
+    // A batch of 'lanes' triangles costs about as much as two node visits.
+    BVHBuilder(nodes, build_stats, std::max(1, std::min(max_leaf_size, 255)), 2.0f / lanes).build(build_prims);
+
+    // Leaves then refer to runs of consecutive triangles, with no index table between.
+    std::vector<uint32_t> sorted(indices.size());
+    for (int i = 0; i < n; i++) {
+        for (int k = 0; k < 3; k++)
+            sorted[3*i + k] = indices[3*build_prims[i].index + k];
+    }
+    indices.swap(sorted);
+    if (!normal_indices.empty()) {
+        for (int i = 0; i < n; i++) {
+            for (int k = 0; k < 3; k++)
+                sorted[3*i + k] = normal_indices[3*build_prims[i].index + k];
+        }
+        normal_indices.swap(sorted);
+        if (normal_indices == indices)
+            std::vector<uint32_t>().swap(normal_indices);
+    }
+    nodes.shrink_to_fit();
+
+    build_stats.primitives = n;
+    build_stats.nodes = int(nodes.size());
+    build_stats.bytes = nodes.size() * sizeof(BVHNode);
+    build_stats.build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline size_t TriangleMesh::memory_bytes() const {
+    return positions.capacity() * sizeof(Vector3) + normals.capacity() * sizeof(Vector3)
+         + indices.capacity() * sizeof(uint32_t) + normal_indices.capacity() * sizeof(uint32_t)
+         + nodes.capacity() * sizeof(BVHNode);
+}
+
+inline bool TriangleMesh::bounding_box(AABB& box) const {
+    if (nodes.empty())
+        return false;
+    box = AABB(Vector3(nodes[0].bmin[0], nodes[0].bmin[1], nodes[0].bmin[2]),
+               Vector3(nodes[0].bmax[0], nodes[0].bmax[1], nodes[0].bmax[2]));
+    return true;
+}
+
+inline TriangleMesh::ShearedRay TriangleMesh::shear(const Ray& r) const {
+    const Vector3 d = r.direction();
+    ShearedRay s;
+    s.kz = fabsf(d[0]) > fabsf(d[1]) ? (fabsf(d[0]) > fabsf(d[2]) ? 0 : 2) : (fabsf(d[1]) > fabsf(d[2]) ? 1 : 2);
+    s.kx = s.kz == 2 ? 0 : s.kz + 1;
+    s.ky = s.kx == 2 ? 0 : s.kx + 1;
+    // Keep the winding, and so the sign of the determinant, independent of the direction.
+    if (d[s.kz] < 0.0f)
+        std::swap(s.kx, s.ky);
+    s.sx = d[s.kx] / d[s.kz];
+    s.sy = d[s.ky] / d[s.kz];
+    s.sz = 1.0f / d[s.kz];
+    return s;
+}
+
+// The vertices are gathered into one array per coordinate first, so the test itself is a
+// fixed-width, branch-free loop over the lanes that the compiler vectorizes. Unused lanes
+// are zero, which makes their determinant zero and rejects them.
+inline void TriangleMesh::intersect(const Ray& r, const ShearedRay& s, int first, int n, float t_min, float t_max,
+                                    float* t, float* u, float* v, float* w) const {
+    const Vector3 o = r.origin();
+    float ax[lanes], ay[lanes], az[lanes], bx[lanes], by[lanes], bz[lanes], cx[lanes], cy[lanes], cz[lanes];
+    for (int l = 0; l < lanes; l++) {
+        if (l < n) {
+            const uint32_t* tri = &indices[3 * size_t(first + l)];
+            const Vector3 a = positions[tri[0]] - o;
+            const Vector3 b = positions[tri[1]] - o;
+            const Vector3 c = positions[tri[2]] - o;
+            ax[l] = a[s.kx]; ay[l] = a[s.ky]; az[l] = a[s.kz];
+            bx[l] = b[s.kx]; by[l] = b[s.ky]; bz[l] = b[s.kz];
+            cx[l] = c[s.kx]; cy[l] = c[s.ky]; cz[l] = c[s.kz];
+        }
+        else {
+            ax[l] = ay[l] = az[l] = bx[l] = by[l] = bz[l] = cx[l] = cy[l] = cz[l] = 0.0f;
+        }
+    }
+
+    for (int l = 0; l < lanes; l++) {
+        const float Ax = ax[l] - s.sx*az[l], Ay = ay[l] - s.sy*az[l];
+        const float Bx = bx[l] - s.sx*bz[l], By = by[l] - s.sy*bz[l];
+        const float Cx = cx[l] - s.sx*cz[l], Cy = cy[l] - s.sy*cz[l];
+        const float U = Cx*By - Cy*Bx;
+        const float V = Ax*Cy - Ay*Cx;
+        const float W = Bx*Ay - By*Ax;
+        const float det = U + V + W;
+        const float T = s.sz * (U*az[l] + V*bz[l] + W*cz[l]);
+        const float d = T / det;
+        // Edge functions that are exactly zero count as inside for both triangles sharing
+        // the edge, so rays through edges and vertices cannot slip between them.
+        const int inside = ((U >= 0.0f) & (V >= 0.0f) & (W >= 0.0f)) | ((U <= 0.0f) & (V <= 0.0f) & (W <= 0.0f));
+        const int valid = inside & (det != 0.0f) & (d > t_min) & (d < t_max);
+        t[l] = valid ? d : FLT_MAX;
+        u[l] = U;
+        v[l] = V;
+        w[l] = W;
+    }
+}
+
+inline bool TriangleMesh::hit(const Ray& r, float t_min, float t_max, hit_record& rec) const {
+    if (nodes.empty())
+        return false;
+
+    const ShearedRay s = shear(r);
+    float closest_so_far = t_max;
+    int best = -1;
+    float best_u = 0.0f, best_v = 0.0f, best_w = 0.0f;
+    uint64_t tested = 0;
+    uint64_t visited = traverse_bvh(nodes.data(), r, t_min, closest_so_far, [&](const BVHNode& node) {
+        for (int first = node.offset; first < node.offset + node.count; first += lanes) {
+            const int n = std::min(int(lanes), node.offset + node.count - first);
+            float t[lanes], u[lanes], v[lanes], w[lanes];
+            intersect(r, s, first, n, t_min, closest_so_far, t, u, v, w);
+            for (int l = 0; l < n; l++) {
+                if (t[l] < closest_so_far) {
+                    closest_so_far = t[l];
+                    best = first + l;
+                    best_u = u[l];
+                    best_v = v[l];
+                    best_w = w[l];
+                }
+            }
+        }
+        tested += node.count;
+        return false;
+    });
+    PICORAY_COUNT(bvh_nodes_visited, visited);
+    PICORAY_COUNT(intersection_tests, tested);
+    if (best < 0)
+        return false;
+
+    const uint32_t* tri = &indices[3 * size_t(best)];
+    rec.t = closest_so_far;
+    rec.p = r.point_at_parameter(rec.t);
+    if (has_normals()) {
+        // Dividing by the determinant also undoes the barycentrics' sign.
+        const uint32_t* ni = normal_indices.empty() ? tri : &normal_indices[3 * size_t(best)];
+        float inv_det = 1.0f / (best_u + best_v + best_w);
+        rec.normal = unit_vector((best_u*inv_det) * normals[ni[0]] + (best_v*inv_det) * normals[ni[1]]
+                                 + (best_w*inv_det) * normals[ni[2]]);
+    }
+    else {
+        const Vector3& a = positions[tri[0]];
+        rec.normal = unit_vector(cross(positions[tri[1]] - a, positions[tri[2]] - a));
+    }
+    rec.material = material;
+    // Meshes carry no texture coordinates, so textures see the normal at the finest level.
+    rec.local_normal = rec.normal;
+    rec.size = 0.0f;
+    return true;
+}
+
+inline bool TriangleMesh::occluded(const Ray& r, float t_min, float t_max) const {
+    if (nodes.empty())
+        return false;
+
+    const ShearedRay s = shear(r);
+    bool blocked = false;
+    uint64_t tested = 0;
+    uint64_t visited = traverse_bvh(nodes.data(), r, t_min, t_max, [&](const BVHNode& node) {
+        for (int first = node.offset; first < node.offset + node.count && !blocked; first += lanes) {
+            const int n = std::min(int(lanes), node.offset + node.count - first);
+            float t[lanes], u[lanes], v[lanes], w[lanes];
+            intersect(r, s, first, n, t_min, t_max, t, u, v, w);
+            for (int l = 0; l < n; l++)
+                blocked |= t[l] < t_max;
+            tested += n;
+        }
+        return blocked;
+    });
+    PICORAY_COUNT(bvh_nodes_visited, visited);
+    PICORAY_COUNT(intersection_tests, tested);
+    return blocked;
+}
+
+#endif
@@ -5,136 +5,203 @@
 #include <stdlib.h>
 #include <iostream>
 
-class Vector3  {
-    public:
-        Vector3() {}
-        Vector3(float e0, float e1, float e2) { e[0] = e0; e[1] = e1; e[2] = e2; }
-        inline float x() const { return e[0]; }
-        inline float y() const { return e[1]; }
-        inline float z() const { return e[2]; }
-        inline float r() const { return e[0]; }
-        inline float g() const { return e[1]; }
-        inline float b() const { return e[2]; }
-        
-        inline const Vector3& operator+() const { return *this; }
-        inline Vector3 operator-() const { return Vector3(-e[0], -e[1], -e[2]); }
-        inline float operator[](int i) const { return e[i]; }
-        inline float& operator[](int i) { return e[i]; };
-        
-        inline Vector3& operator+=(const Vector3 &v2);
-        inline Vector3& operator-=(const Vector3 &v2);
-        inline Vector3& operator*=(const Vector3 &v2);
-        inline Vector3& operator/=(const Vector3 &v2);
-        inline Vector3& operator*=(const float t);
-        inline Vector3& operator/=(const float t);
-        
-        inline float length() const { return sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]); }
-        inline float squared_length() const { return e[0]*e[0] + e[1]*e[1] + e[2]*e[2]; }
-        inline void make_unit_vector();
-        
-        float e[3];
+// PICORAY_SIMD_VECTOR selects the Vector3 backend at compile time: 1 for the padded
+// 4-wide SSE one where the target has SSE2, 0 for three plain floats everywhere. The
+// SSE backend is faster on sphere tests but renders no faster overall, and costs a
+// third more memory for every stored vector, so it is not the default.
+#ifndef PICORAY_SIMD_VECTOR
+#define PICORAY_SIMD_VECTOR 0
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PICORAY_HAS_SSE2 1
+#include <emmintrin.h>
+#else
+#define PICORAY_HAS_SSE2 0
+#endif
+
+// 1/sqrt(x) from the hardware estimate refined by one Newton step, within a few ulp
+// of the exact value and cheaper than a square root and a division.
+inline float fast_rsqrt(float x) {
+#if PICORAY_HAS_SSE2
+    float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+    return y * (1.5f - 0.5f*x*y*y);
+#else
+    return 1.0f / sqrtf(x);
+#endif
+}
+
+// Backends provide the storage and the arithmetic on it; BasicVector3 puts the usual
+// operators on top. Everything is single precision.
+
+// Three packed floats, 12 bytes.
+struct ScalarVector3Ops {
+    struct Data { float e[3]; };
+    static const char* name() { return "scalar"; }
+
+    static Data make(float x, float y, float z) {
+        Data d = {{ x, y, z }};
+        return d;
+    }
+    static float get(const Data& d, int i) { return d.e[i]; }
+    static float& lane(Data& d, int i) { return d.e[i]; }
+
+    static Data add(const Data& a, const Data& b) { return make(a.e[0] + b.e[0], a.e[1] + b.e[1], a.e[2] + b.e[2]); }
+    static Data sub(const Data& a, const Data& b) { return make(a.e[0] - b.e[0], a.e[1] - b.e[1], a.e[2] - b.e[2]); }
+    static Data mul(const Data& a, const Data& b) { return make(a.e[0] * b.e[0], a.e[1] * b.e[1], a.e[2] * b.e[2]); }
+    static Data div(const Data& a, const Data& b) { return make(a.e[0] / b.e[0], a.e[1] / b.e[1], a.e[2] / b.e[2]); }
+    static Data scale(const Data& a, float t) { return make(t * a.e[0], t * a.e[1], t * a.e[2]); }
+    static Data neg(const Data& a) { return make(-a.e[0], -a.e[1], -a.e[2]); }
+    static float dot(const Data& a, const Data& b) { return a.e[0] * b.e[0] + a.e[1] * b.e[1] + a.e[2] * b.e[2]; }
+    static Data cross(const Data& a, const Data& b) {
+        return make(a.e[1] * b.e[2] - a.e[2] * b.e[1],
+                    a.e[2] * b.e[0] - a.e[0] * b.e[2],
+                    a.e[0] * b.e[1] - a.e[1] * b.e[0]);
+    }
 };
 
-inline std::istream& operator>>(std::istream &is, Vector3 &t) {
-    is >> t.e[0] >> t.e[1] >> t.e[2];
-    return is;
-}
-
-inline std::ostream& operator<<(std::ostream &os, const Vector3 &t) {
-    os << t.e[0] << " " << t.e[1] << " " << t.e[2];
-    return os;
-}
-
-inline void Vector3::make_unit_vector() {
-    float k = 1.0f / sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]);
-    e[0] *= k; e[1] *= k; e[2] *= k;
-}
-
-inline Vector3 operator+(const Vector3 &v1, const Vector3 &v2) {
-    return Vector3(v1.e[0] + v2.e[0], v1.e[1] + v2.e[1], v1.e[2] + v2.e[2]);
-}
-
-inline Vector3 operator-(const Vector3 &v1, const Vector3 &v2) {
-    return Vector3(v1.e[0] - v2.e[0], v1.e[1] - v2.e[1], v1.e[2] - v2.e[2]);
-}
+#if PICORAY_HAS_SSE2
+// One SSE register, 16 bytes, with an unused fourth lane. The lane is zero when made
+// from components but not kept so (a division leaves 0/0 there), so nothing reads it.
+struct SseVector3Ops {
+    typedef __m128 Data;
+    static const char* name() { return "sse"; }
+
+    static Data make(float x, float y, float z) { return _mm_set_ps(0.0f, z, y, x); }
+    // Reads go through the vector subscript, which compiles to a shuffle rather than a
+    // trip through memory when the index is a constant.
+#if defined(_MSC_VER) && !defined(__clang__)
+    static float get(Data d, int i) { return d.m128_f32[i]; }
+    static float& lane(Data& d, int i) { return d.m128_f32[i]; }
+#else
+    static float get(Data d, int i) { return d[i]; }
+    static float& lane(Data& d, int i) { return reinterpret_cast<float*>(&d)[i]; }
+#endif
+
+    static Data add(Data a, Data b) { return _mm_add_ps(a, b); }
+    static Data sub(Data a, Data b) { return _mm_sub_ps(a, b); }
+    static Data mul(Data a, Data b) { return _mm_mul_ps(a, b); }
+    static Data div(Data a, Data b) { return _mm_div_ps(a, b); }
+    static Data scale(Data a, float t) { return _mm_mul_ps(a, _mm_set1_ps(t)); }
+    static Data neg(Data a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+    // Summed as (x + y) + z, like the scalar backend, so both round the same way.
+    static float dot(Data a, Data b) {
+        __m128 m = _mm_mul_ps(a, b);
+        __m128 s = _mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1)));
+        return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehl_ps(m, m)));
+    }
+    // a * b.yzx - a.yzx * b is the cross product in yzx order.
+    static Data cross(Data a, Data b) {
+        __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+        return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+    }
+};
+#endif
 
-inline Vector3 operator*(const Vector3 &v1, const Vector3 &v2) {
-    return Vector3(v1.e[0] * v2.e[0], v1.e[1] * v2.e[1], v1.e[2] * v2.e[2]);
-}
+template <class Ops>
+class BasicVector3  {
+    public:
+        typedef typename Ops::Data Data;
+
+        BasicVector3() {}
+        BasicVector3(float e0, float e1, float e2) : d(Ops::make(e0, e1, e2)) {}
+        explicit BasicVector3(const Data& v) : d(v) {}
+        inline float x() const { return Ops::get(d, 0); }
+        inline float y() const { return Ops::get(d, 1); }
+        inline float z() const { return Ops::get(d, 2); }
+        inline float r() const { return Ops::get(d, 0); }
+        inline float g() const { return Ops::get(d, 1); }
+        inline float b() const { return Ops::get(d, 2); }
+
+        inline const BasicVector3& operator+() const { return *this; }
+        inline BasicVector3 operator-() const { return BasicVector3(Ops::neg(d)); }
+        inline float operator[](int i) const { return Ops::get(d, i); }
+        inline float& operator[](int i) { return Ops::lane(d, i); };
+
+        inline BasicVector3& operator+=(const BasicVector3 &v) { d = Ops::add(d, v.d); return *this; }
+        inline BasicVector3& operator-=(const BasicVector3 &v) { d = Ops::sub(d, v.d); return *this; }
+        inline BasicVector3& operator*=(const BasicVector3 &v) { d = Ops::mul(d, v.d); return *this; }
+        inline BasicVector3& operator/=(const BasicVector3 &v) { d = Ops::div(d, v.d); return *this; }
+        inline BasicVector3& operator*=(const float t) { d = Ops::scale(d, t); return *this; }
+        inline BasicVector3& operator/=(const float t) { d = Ops::scale(d, 1.0f/t); return *this; }
+
+        inline float length() const { return sqrtf(Ops::dot(d, d)); }
+        inline float squared_length() const { return Ops::dot(d, d); }
+        inline void make_unit_vector() { d = Ops::scale(d, fast_rsqrt(Ops::dot(d, d))); }
+
+        static const char* backend() { return Ops::name(); }
+
+        Data d;
+};
 
-inline Vector3 operator/(const Vector3 &v1, const Vector3 &v2) {
-    return Vector3(v1.e[0] / v2.e[0], v1.e[1] / v2.e[1], v1.e[2] / v2.e[2]);
-}
+#if PICORAY_SIMD_VECTOR && PICORAY_HAS_SSE2
+typedef BasicVector3<SseVector3Ops> Vector3;
+#else
+typedef BasicVector3<ScalarVector3Ops> Vector3;
+#endif
 
-inline Vector3 operator*(float t, const Vector3 &v) {
-    return Vector3(t*v.e[0], t*v.e[1], t*v.e[2]);
+template <class Ops>
+inline std::istream& operator>>(std::istream &is, BasicVector3<Ops> &t) {
+    is >> t[0] >> t[1] >> t[2];
+    return is;
 }
 
-inline Vector3 operator/(Vector3 v, float t) {
-    return Vector3(v.e[0]/t, v.e[1]/t, v.e[2]/t);
+template <class Ops>
+inline std::ostream& operator<<(std::ostream &os, const BasicVector3<Ops> &t) {
+    os << t[0] << " " << t[1] << " " << t[2];
+    return os;
 }
 
-inline Vector3 operator*(const Vector3 &v, float t) {
-    return Vector3(t*v.e[0], t*v.e[1], t*v.e[2]);
+template <class Ops>
+inline BasicVector3<Ops> operator+(const BasicVector3<Ops> &v1, const BasicVector3<Ops> &v2) {
+    return BasicVector3<Ops>(Ops::add(v1.d, v2.d));
 }
 
-inline float dot(const Vector3 &v1, const Vector3 &v2) {
-    return v1.e[0] *v2.e[0] + v1.e[1] *v2.e[1]  + v1.e[2] *v2.e[2];
+template <class Ops>
+inline BasicVector3<Ops> operator-(const BasicVector3<Ops> &v1, const BasicVector3<Ops> &v2) {
+    return BasicVector3<Ops>(Ops::sub(v1.d, v2.d));
 }
 
-inline Vector3 cross(const Vector3 &v1, const Vector3 &v2) {
-    return Vector3( (v1.e[1]*v2.e[2] - v1.e[2]*v2.e[1]),
-                (-(v1.e[0]*v2.e[2] - v1.e[2]*v2.e[0])),
-                (v1.e[0]*v2.e[1] - v1.e[1]*v2.e[0]));
+template <class Ops>
+inline BasicVector3<Ops> operator*(const BasicVector3<Ops> &v1, const BasicVector3<Ops> &v2) {
+    return BasicVector3<Ops>(Ops::mul(v1.d, v2.d));
 }
 
-
-inline Vector3& Vector3::operator+=(const Vector3 &v){
-    e[0]  += v.e[0];
-    e[1]  += v.e[1];
-    e[2]  += v.e[2];
-    return *this;
+template <class Ops>
+inline BasicVector3<Ops> operator/(const BasicVector3<Ops> &v1, const BasicVector3<Ops> &v2) {
+    return BasicVector3<Ops>(Ops::div(v1.d, v2.d));
 }
 
-inline Vector3& Vector3::operator*=(const Vector3 &v){
-    e[0]  *= v.e[0];
-    e[1]  *= v.e[1];
-    e[2]  *= v.e[2];
-    return *this;
+template <class Ops>
+inline BasicVector3<Ops> operator*(float t, const BasicVector3<Ops> &v) {
+    return BasicVector3<Ops>(Ops::scale(v.d, t));
 }
 
-inline Vector3& Vector3::operator/=(const Vector3 &v){
-    e[0]  /= v.e[0];
-    e[1]  /= v.e[1];
-    e[2]  /= v.e[2];
-    return *this;
+template <class Ops>
+inline BasicVector3<Ops> operator/(const BasicVector3<Ops> &v, float t) {
+    return BasicVector3<Ops>(Ops::scale(v.d, 1.0f/t));
 }
 
-inline Vector3& Vector3::operator-=(const Vector3& v) {
-    e[0]  -= v.e[0];
-    e[1]  -= v.e[1];
-    e[2]  -= v.e[2];
-    return *this;
+template <class Ops>
+inline BasicVector3<Ops> operator*(const BasicVector3<Ops> &v, float t) {
+    return BasicVector3<Ops>(Ops::scale(v.d, t));
 }
 
-inline Vector3& Vector3::operator*=(const float t) {
-    e[0]  *= t;
-    e[1]  *= t;
-    e[2]  *= t;
-    return *this;
+template <class Ops>
+inline float dot(const BasicVector3<Ops> &v1, const BasicVector3<Ops> &v2) {
+    return Ops::dot(v1.d, v2.d);
 }
 
-inline Vector3& Vector3::operator/=(const float t) {
-    float k = 1.0f/t;
-    
-    e[0]  *= k;
-    e[1]  *= k;
-    e[2]  *= k;
-    return *this;
+template <class Ops>
+inline BasicVector3<Ops> cross(const BasicVector3<Ops> &v1, const BasicVector3<Ops> &v2) {
+    return BasicVector3<Ops>(Ops::cross(v1.d, v2.d));
 }
 
-inline Vector3 unit_vector(Vector3 v) {
-    return v / v.length();
+template <class Ops>
+inline BasicVector3<Ops> unit_vector(const BasicVector3<Ops>& v) {
+    return v * fast_rsqrt(dot(v, v));
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,233 @@
+#include "Denoiser.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+
+namespace {
+
+// Planes of one image, a float array per channel so a row of any channel is contiguous.
+struct Planes {
+    Planes(size_t n) : r(n), g(n), b(n), variance(n) {}
+
+    std::vector<float> r, g, b;
+    std::vector<float> variance;    // of the pixel's mean luminance
+};
+
+struct Guides {
+    Guides(size_t n) : nx(n), ny(n), nz(n), z(n), dz(n), ar(n), ag(n), ab(n), emission(n) {}
+
+    std::vector<float> nx, ny, nz;
+    std::vector<float> z, dz;       // inverse depth and its largest screen-space step
+    std::vector<float> ar, ag, ab;  // albedo the colour was divided by
+    std::vector<Vector3> emission;  // taken out before filtering, added back after
+};
+
+const float b3[5] = { 1.0f/16.0f, 1.0f/4.0f, 3.0f/8.0f, 1.0f/4.0f, 1.0f/16.0f };
+
+// exp(x) for x <= 0 as (1 + x/256)^256: branch free, so the tap loops vectorize, and
+// within 0.2% of exp(x) where the weight matters.
+inline float weight_exp(float x) {
+    float t = 1.0f + x * (1.0f / 256.0f);
+    t = 0.5f * (t + fabsf(t));      // max(t, 0) without a compare
+    t *= t; t *= t; t *= t; t *= t;
+    t *= t; t *= t; t *= t; t *= t;
+    return t;
+}
+
+inline float albedo_floor(float a) { return a < 1e-3f ? 1e-3f : a; }
+
+void run_tiles(TileScheduler& scheduler, const std::function<void(const Tile&, int)>& fn) {
+    scheduler.start(fn);
+    scheduler.wait();
+}
+
+void demodulate(const Framebuffer& in, const AuxBuffers& aux, const Tile& tile, Planes& p, Guides& g) {
+    int w = in.width();
+    for (int y = tile.y0; y < tile.y1; y++) {
+        for (int x = tile.x0; x < tile.x1; x++) {
+            size_t i = size_t(y) * w + x;
+            Vector3 a = aux.albedo(x, y);
+            Vector3 n = aux.normal(x, y);
+            g.emission[i] = aux.emission(x, y);
+            Vector3 c = in.linear_pixel(x, y) - g.emission[i];
+            g.ar[i] = albedo_floor(a[0]);
+            g.ag[i] = albedo_floor(a[1]);
+            g.ab[i] = albedo_floor(a[2]);
+            g.nx[i] = n[0];
+            g.ny[i] = n[1];
+            g.nz[i] = n[2];
+            g.z[i] = aux.inverse_depth(x, y);
+            p.r[i] = c[0] / g.ar[i];
+            p.g[i] = c[1] / g.ag[i];
+            p.b[i] = c[2] / g.ab[i];
+
+            // Variance of the mean. A single sample says nothing about the noise, so it is
+            // taken to be all noise.
+            float count = float(in.sample_count(x, y));
+            float variance = luminance(c) * luminance(c);
+            if (count >= 2.0f) {
+                float mean = luminance(in.linear_pixel(x, y));
+                variance = fmaxf(0.0f, (in.luminance_sq_sum(x, y) / count - mean*mean) / (count - 1.0f));
+            }
+            variance /= count;
+            float a_lum = luminance(Vector3(g.ar[i], g.ag[i], g.ab[i]));
+            p.variance[i] = variance / (a_lum * a_lum);
+        }
+    }
+}
+
+void depth_gradient(const Tile& tile, int w, int h, Guides& g) {
+    for (int y = tile.y0; y < tile.y1; y++) {
+        for (int x = tile.x0; x < tile.x1; x++) {
+            size_t i = size_t(y) * w + x;
+            float z = g.z[i];
+            float d = 0.0f;
+            if (x > 0) d = fmaxf(d, fabsf(z - g.z[i - 1]));
+            if (x + 1 < w) d = fmaxf(d, fabsf(z - g.z[i + 1]));
+            if (y > 0) d = fmaxf(d, fabsf(z - g.z[i - w]));
+            if (y + 1 < h) d = fmaxf(d, fabsf(z - g.z[i + w]));
+            g.dz[i] = d;
+        }
+    }
+}
+
+// Per-pixel luminance scale of a pass, from the variance blurred over 3x3 since a few
+// samples give a noisy estimate of it.
+void luminance_scale(const Tile& tile, int w, int h, const DenoiseOptions& options, const Planes& src,
+                     std::vector<float>& scale) {
+    for (int y = tile.y0; y < tile.y1; y++) {
+        for (int x = tile.x0; x < tile.x1; x++) {
+            float variance = 0.0f, total = 0.0f;
+            for (int j = -1; j <= 1; j++) {
+                int yy = y + j;
+                if (yy < 0 || yy >= h)
+                    continue;
+                for (int i = -1; i <= 1; i++) {
+                    int xx = x + i;
+                    if (xx < 0 || xx >= w)
+                        continue;
+                    float f = (i ? 0.5f : 1.0f) * (j ? 0.5f : 1.0f);
+                    variance += f * src.variance[size_t(yy) * w + xx];
+                    total += f;
+                }
+            }
+            scale[size_t(y) * w + x] = 1.0f / (options.sigma_color * sqrtf(variance / total) + 1e-6f);
+        }
+    }
+}
+
+// One a-trous pass over the rows of 'tile', reading 'src' and writing 'dst'. Rows are
+// done in chunks of up to 'chunk' pixels whose centre values and sums live in local
+// arrays, which the compiler knows cannot alias the planes, so the tap loop vectorizes
+// without runtime overlap checks.
+void filter_tile(const Tile& tile, int w, int h, int step, const DenoiseOptions& options,
+                 const Guides& g, const Planes& src, const std::vector<float>& scales, Planes& dst) {
+    const int chunk = 64;
+    const float inv_sigma_n2 = 1.0f / (options.sigma_normal * options.sigma_normal);
+    float cl[chunk], cnx[chunk], cny[chunk], cnz[chunk], cz[chunk], cdz[chunk], scale[chunk];
+    float sw[chunk], sr[chunk], sg[chunk], sb[chunk], sv[chunk];
+
+    for (int y = tile.y0; y < tile.y1; y++) {
+        for (int x0 = tile.x0; x0 < tile.x1; x0 += chunk) {
+            const int n = std::min(chunk, tile.x1 - x0);
+            const size_t row = size_t(y) * w + x0;
+            for (int k = 0; k < n; k++) {
+                size_t c = row + k;
+                cl[k] = 0.2126f*src.r[c] + 0.7152f*src.g[c] + 0.0722f*src.b[c];
+                cnx[k] = g.nx[c];
+                cny[k] = g.ny[c];
+                cnz[k] = g.nz[c];
+                cz[k] = g.z[c];
+                cdz[k] = g.dz[c] * float(step) * options.sigma_depth;
+                scale[k] = scales[c];
+                sw[k] = sr[k] = sg[k] = sb[k] = sv[k] = 0.0f;
+            }
+
+            for (int j = -2; j <= 2; j++) {
+                int yy = y + j*step;
+                if (yy < 0 || yy >= h)
+                    continue;
+                for (int i = -2; i <= 2; i++) {
+                    const int offset = i*step;
+                    const int begin = std::max(0, -offset - x0);
+                    const int end = std::min(n, w - offset - x0);
+                    if (begin >= end)
+                        continue;
+                    const float kernel = b3[i + 2] * b3[j + 2];
+                    const float taps = float(std::max(abs(i), abs(j)));
+                    const size_t first = size_t(yy) * w + size_t(x0 + begin + offset);
+                    const float* qr = &src.r[first];
+                    const float* qg = &src.g[first];
+                    const float* qb = &src.b[first];
+                    const float* qv = &src.variance[first];
+                    const float* qnx = &g.nx[first];
+                    const float* qny = &g.ny[first];
+                    const float* qnz = &g.nz[first];
+                    const float* qz = &g.z[first];
+                    const float* qs = &scales[first];
+                    for (int q = 0; q < end - begin; q++) {
+                        const int k = begin + q;
+                        float l = 0.2126f*qr[q] + 0.7152f*qg[q] + 0.0722f*qb[q];
+                        float dnx = qnx[q] - cnx[k], dny = qny[q] - cny[k], dnz = qnz[q] - cnz[k];
+                        // The noisier of the two pixels sets the scale, so the weight is
+                        // symmetric and a bright pixel is not spread into neighbours that
+                        // refuse to give it any weight back, which would lose energy.
+                        float s = 0.5f * (scale[k] + qs[q] - fabsf(scale[k] - qs[q]));
+                        float e = fabsf(l - cl[k]) * s
+                                + (dnx*dnx + dny*dny + dnz*dnz) * inv_sigma_n2
+                                + fabsf(qz[q] - cz[k]) / (cdz[k] * taps + 1e-6f);
+                        float weight = kernel * weight_exp(-e);
+                        sw[k] += weight;
+                        sr[k] += weight * qr[q];
+                        sg[k] += weight * qg[q];
+                        sb[k] += weight * qb[q];
+                        sv[k] += weight * weight * qv[q];
+                    }
+                }
+            }
+
+            // The centre tap always has weight b3[2]^2, so the sums are never zero.
+            for (int k = 0; k < n; k++) {
+                float inv = 1.0f / sw[k];
+                dst.r[row + k] = sr[k] * inv;
+                dst.g[row + k] = sg[k] * inv;
+                dst.b[row + k] = sb[k] * inv;
+                dst.variance[row + k] = sv[k] * inv * inv;
+            }
+        }
+    }
+}
+
+}
+
+void denoise(const Framebuffer& in, const AuxBuffers& aux, const DenoiseOptions& options,
+             TileScheduler& scheduler, Framebuffer& out) {
+    const int w = in.width(), h = in.height();
+    const size_t pixels = size_t(w) * h;
+    Planes a(pixels), b(pixels);
+    Guides g(pixels);
+    std::vector<float> scales(pixels);
+
+    run_tiles(scheduler, [&](const Tile& tile, int) { demodulate(in, aux, tile, a, g); });
+    run_tiles(scheduler, [&](const Tile& tile, int) { depth_gradient(tile, w, h, g); });
+
+    Planes* src = &a;
+    Planes* dst = &b;
+    for (int pass = 0; pass < options.iterations; pass++) {
+        int step = 1 << pass;
+        run_tiles(scheduler, [&](const Tile& tile, int) { luminance_scale(tile, w, h, options, *src, scales); });
+        run_tiles(scheduler, [&](const Tile& tile, int) { filter_tile(tile, w, h, step, options, g, *src, scales, *dst); });
+        std::swap(src, dst);
+    }
+
+    run_tiles(scheduler, [&](const Tile& tile, int) {
+        for (int y = tile.y0; y < tile.y1; y++) {
+            for (int x = tile.x0; x < tile.x1; x++) {
+                size_t i = size_t(y) * w + x;
+                Vector3 c(src->r[i] * g.ar[i], src->g[i] * g.ag[i], src->b[i] * g.ab[i]);
+                out.set_pixel(x, y, c + g.emission[i]);
+            }
+        }
+    });
+}
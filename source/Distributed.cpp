@@ -0,0 +1,265 @@
+#include "Distributed.h"
+
+#include <string.h>
+#include <chrono>
+#include <iostream>
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const uint32_t job_magic = 0x504a4f42u;       // "PJOB"
+const uint32_t result_magic = 0x50524553u;    // "PRES"
+
+struct ResultHeader {
+    uint32_t magic;
+    int32_t frame;
+    int32_t tile;
+    int32_t pixels;
+    RenderCounters counters;
+};
+
+struct PixelResult {
+    float sum[3];
+    float luminance_sq;
+    uint32_t count;
+};
+
+static_assert(sizeof(TileJob) == 36, "tile job must be packed");
+static_assert(sizeof(PixelResult) == 20, "pixel result must be packed");
+
+#if !defined(_WIN32)
+
+bool write_all(int fd, const void* data, size_t n) {
+    const char* p = static_cast<const char*>(data);
+    while (n > 0) {
+        ssize_t k = write(fd, p, n);
+        if (k < 0 && errno == EINTR)
+            continue;
+        if (k <= 0)
+            return false;
+        p += k;
+        n -= size_t(k);
+    }
+    return true;
+}
+
+// Reads exactly n bytes. 'deadline' is in steady_clock seconds, 0 for none.
+bool read_all(int fd, void* data, size_t n, double deadline = 0.0) {
+    char* p = static_cast<char*>(data);
+    while (n > 0) {
+        if (deadline > 0.0) {
+            double now = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            if (now >= deadline)
+                return false;
+            pollfd pfd = { fd, POLLIN, 0 };
+            int r = poll(&pfd, 1, int((deadline - now) * 1000.0) + 1);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                return false;
+        }
+        ssize_t k = read(fd, p, n);
+        if (k < 0 && errno == EINTR)
+            continue;
+        if (k <= 0)
+            return false;
+        p += k;
+        n -= size_t(k);
+    }
+    return true;
+}
+
+#endif
+
+}
+
+#if defined(_WIN32)
+
+TileWorkerChannel::TileWorkerChannel() : in_fd(-1), out_fd(-1) {}
+bool TileWorkerChannel::next_job(TileJob&) { return false; }
+bool TileWorkerChannel::send_result(const TileJob&, const Framebuffer&) { return false; }
+
+TileCoordinator::TileCoordinator(const std::vector<std::string>& cmd, int num_workers)
+    : max_attempts(3), timeout_seconds(0.0), crash_after(0), command(cmd), workers(num_workers), restart_count(0) {}
+TileCoordinator::~TileCoordinator() {}
+
+bool TileCoordinator::run(int, const TileJob&, Framebuffer&) {
+    std::cout << "Distributed rendering is not supported on this platform" << std::endl;
+    return false;
+}
+
+#else
+
+TileWorkerChannel::TileWorkerChannel() : in_fd(0) {
+    out_fd = dup(1);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0) {
+        dup2(null_fd, 1);
+        close(null_fd);
+    }
+}
+
+bool TileWorkerChannel::next_job(TileJob& job) {
+    return read_all(in_fd, &job, sizeof(job)) && job.magic == job_magic;
+}
+
+bool TileWorkerChannel::send_result(const TileJob& job, const Framebuffer& fb) {
+    ResultHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = result_magic;
+    header.frame = job.frame;
+    header.tile = job.tile;
+    header.pixels = (job.x1 - job.x0) * (job.y1 - job.y0);
+    header.counters = render_stats.totals();
+    render_stats.reset();
+
+    std::vector<PixelResult> pixels;
+    pixels.reserve(header.pixels);
+    for (int y = job.y0; y < job.y1; y++) {
+        for (int x = job.x0; x < job.x1; x++) {
+            PixelResult p;
+            const Vector3& sum = fb.sample_sum(x, y);
+            p.sum[0] = sum[0];
+            p.sum[1] = sum[1];
+            p.sum[2] = sum[2];
+            p.luminance_sq = fb.luminance_sq_sum(x, y);
+            p.count = uint32_t(fb.sample_count(x, y));
+            pixels.push_back(p);
+        }
+    }
+    return write_all(out_fd, &header, sizeof(header))
+        && write_all(out_fd, pixels.data(), pixels.size() * sizeof(PixelResult));
+}
+
+TileCoordinator::TileCoordinator(const std::vector<std::string>& cmd, int num_workers)
+    : max_attempts(3), timeout_seconds(0.0), crash_after(0), command(cmd), restart_count(0) {
+    Worker idle = { -1, -1, -1, 0 };
+    workers.assign(num_workers, idle);
+    // A worker that dies while we write its job must not take the coordinator with it.
+    signal(SIGPIPE, SIG_IGN);
+}
+
+TileCoordinator::~TileCoordinator() {
+    for (int i = 0; i < num_workers(); i++)
+        stop(i, false);
+}
+
+bool TileCoordinator::spawn(int index) {
+    Worker& w = workers[index];
+    std::vector<std::string> args = command;
+    if (index == 0 && w.started == 0 && crash_after > 0) {
+        args.push_back("--crash-after");
+        args.push_back(std::to_string(crash_after));
+    }
+    std::vector<char*> argv;
+    for (std::string& a : args)
+        argv.push_back(&a[0]);
+    argv.push_back(nullptr);
+
+    // Close-on-exec everywhere, so no worker holds another worker's pipes open and
+    // closing the job pipe is always seen as end of input.
+    int jobs[2], results[2];
+    if (pipe2(jobs, O_CLOEXEC) != 0)
+        return false;
+    if (pipe2(results, O_CLOEXEC) != 0) {
+        close(jobs[0]);
+        close(jobs[1]);
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(jobs[0], 0);
+        dup2(results[1], 1);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    close(jobs[0]);
+    close(results[1]);
+    if (pid < 0) {
+        close(jobs[1]);
+        close(results[0]);
+        return false;
+    }
+    w.pid = int(pid);
+    w.job_fd = jobs[1];
+    w.result_fd = results[0];
+    w.started++;
+    return true;
+}
+
+void TileCoordinator::stop(int index, bool kill_process) {
+    Worker& w = workers[index];
+    if (w.pid < 0)
+        return;
+    if (kill_process)
+        kill(pid_t(w.pid), SIGKILL);
+    close(w.job_fd);        // a healthy worker exits at the end of its input
+    close(w.result_fd);
+    int status;
+    while (waitpid(pid_t(w.pid), &status, 0) < 0 && errno == EINTR) {}
+    w.pid = -1;
+    w.job_fd = -1;
+    w.result_fd = -1;
+}
+
+bool TileCoordinator::exchange(int index, const TileJob& job, Framebuffer& fb) {
+    Worker& w = workers[index];
+    TileJob request = job;
+    request.magic = job_magic;
+    if (!write_all(w.job_fd, &request, sizeof(request)))
+        return false;
+
+    double deadline = 0.0;
+    if (timeout_seconds > 0.0)
+        deadline = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count() + timeout_seconds;
+    ResultHeader header;
+    int pixels = (job.x1 - job.x0) * (job.y1 - job.y0);
+    if (!read_all(w.result_fd, &header, sizeof(header), deadline) || header.magic != result_magic
+        || header.frame != job.frame || header.tile != job.tile || header.pixels != pixels)
+        return false;
+    // The whole tile is read before any of it is used, so a worker failing halfway
+    // leaves the framebuffer untouched for the retry.
+    std::vector<PixelResult> result(pixels);
+    if (!read_all(w.result_fd, result.data(), result.size() * sizeof(PixelResult), deadline))
+        return false;
+
+    const PixelResult* p = result.data();
+    for (int y = job.y0; y < job.y1; y++) {
+        for (int x = job.x0; x < job.x1; x++, p++) {
+            if (p->count)
+                fb.add_samples(x, y, Vector3(p->sum[0], p->sum[1], p->sum[2]), p->luminance_sq, int(p->count));
+        }
+    }
+    render_stats.add(header.counters);
+    return true;
+}
+
+bool TileCoordinator::run(int index, const TileJob& job, Framebuffer& fb) {
+    for (int attempt = 0; attempt < max_attempts; attempt++) {
+        Worker& w = workers[index];
+        if (w.pid < 0) {
+            if (w.started > 0)
+                restart_count++;
+            if (!spawn(index)) {
+                std::cout << "Cannot start worker " << index << ": " << strerror(errno) << std::endl;
+                return false;
+            }
+        }
+        if (exchange(index, job, fb))
+            return true;
+        std::cout << "Worker " << index << " failed on tile " << job.tile << " of frame " << job.frame
+                  << ", restarting it" << std::endl;
+        stop(index, true);
+    }
+    return false;
+}
+
+#endif
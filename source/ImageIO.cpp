@@ -0,0 +1,168 @@
+#include "ImageIO.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+
+namespace {
+
+void to_rgb(uint32_t argb, uint8_t* rgb) {
+    rgb[0] = uint8_t(argb >> 16);
+    rgb[1] = uint8_t(argb >> 8);
+    rgb[2] = uint8_t(argb);
+}
+
+struct CrcTable {
+    uint32_t entries[256];
+    CrcTable() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            entries[i] = c;
+        }
+    }
+};
+
+uint32_t crc32(const uint8_t* data, size_t n, uint32_t crc = 0) {
+    static const CrcTable table;
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++)
+        crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+void put_u32(std::vector<uint8_t>& out, uint32_t v) {
+    out.push_back(uint8_t(v >> 24));
+    out.push_back(uint8_t(v >> 16));
+    out.push_back(uint8_t(v >> 8));
+    out.push_back(uint8_t(v));
+}
+
+void write_chunk(FILE* f, const char* type, const std::vector<uint8_t>& payload) {
+    std::vector<uint8_t> chunk;
+    put_u32(chunk, uint32_t(payload.size()));
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), payload.begin(), payload.end());
+    put_u32(chunk, crc32(&chunk[4], chunk.size() - 4));
+    fwrite(chunk.data(), 1, chunk.size(), f);
+}
+
+bool has_extension(const char* path, const char* ext) {
+    size_t n = strlen(path), m = strlen(ext);
+    if (n < m)
+        return false;
+    for (size_t i = 0; i < m; i++) {
+        char c = path[n - m + i];
+        if (c >= 'A' && c <= 'Z')
+            c = char(c - 'A' + 'a');
+        if (c != ext[i])
+            return false;
+    }
+    return true;
+}
+
+}
+
+bool write_ppm(const char* path, const Framebuffer& fb) {
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return false;
+    fprintf(f, "P6\n%d %d\n255\n", fb.width(), fb.height());
+    std::vector<uint8_t> row(size_t(fb.width()) * 3);
+    for (int y = 0; y < fb.height(); y++) {
+        for (int x = 0; x < fb.width(); x++)
+            to_rgb(*fb.pixel(x, y), &row[size_t(x) * 3]);
+        fwrite(row.data(), 1, row.size(), f);
+    }
+    return fclose(f) == 0;
+}
+
+bool write_pfm(const char* path, const Framebuffer& fb) {
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return false;
+    // A negative scale marks the samples as little endian.
+    uint16_t probe = 1;
+    bool little_endian = *reinterpret_cast<uint8_t*>(&probe) == 1;
+    fprintf(f, "PF\n%d %d\n%s\n", fb.width(), fb.height(), little_endian ? "-1.0" : "1.0");
+    std::vector<float> row(size_t(fb.width()) * 3);
+    for (int y = fb.height() - 1; y >= 0; y--) {
+        for (int x = 0; x < fb.width(); x++) {
+            Vector3 c = fb.linear_pixel(x, y);
+            row[size_t(x) * 3 + 0] = c[0];
+            row[size_t(x) * 3 + 1] = c[1];
+            row[size_t(x) * 3 + 2] = c[2];
+        }
+        fwrite(row.data(), sizeof(float), row.size(), f);
+    }
+    return fclose(f) == 0;
+}
+
+// Uncompressed PNG: the zlib stream uses stored deflate blocks, so there is no
+// dependency on zlib and the cost is a single pass over the pixels.
+bool write_png(const char* path, const Framebuffer& fb) {
+    size_t stride = size_t(fb.width()) * 3 + 1;
+    std::vector<uint8_t> raw(stride * fb.height());
+    for (int y = 0; y < fb.height(); y++) {
+        uint8_t* row = &raw[stride * y];
+        row[0] = 0;     // filter type: none
+        for (int x = 0; x < fb.width(); x++)
+            to_rgb(*fb.pixel(x, y), &row[1 + size_t(x) * 3]);
+    }
+
+    std::vector<uint8_t> idat;
+    idat.push_back(0x78);
+    idat.push_back(0x01);
+    size_t pos = 0;
+    do {
+        size_t len = raw.size() - pos;
+        if (len > 65535)
+            len = 65535;
+        bool last = pos + len == raw.size();
+        idat.push_back(last ? 1 : 0);
+        idat.push_back(uint8_t(len));
+        idat.push_back(uint8_t(len >> 8));
+        idat.push_back(uint8_t(~len));
+        idat.push_back(uint8_t(~len >> 8));
+        idat.insert(idat.end(), raw.begin() + pos, raw.begin() + pos + len);
+        pos += len;
+    } while (pos < raw.size());
+
+    uint32_t a = 1, b = 0;
+    for (size_t i = 0; i < raw.size(); i++) {
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    put_u32(idat, (b << 16) | a);
+
+    std::vector<uint8_t> ihdr;
+    put_u32(ihdr, uint32_t(fb.width()));
+    put_u32(ihdr, uint32_t(fb.height()));
+    ihdr.push_back(8);  // bit depth
+    ihdr.push_back(2);  // colour type: RGB
+    ihdr.push_back(0);
+    ihdr.push_back(0);
+    ihdr.push_back(0);
+
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return false;
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    fwrite(signature, 1, sizeof(signature), f);
+    write_chunk(f, "IHDR", ihdr);
+    write_chunk(f, "IDAT", idat);
+    write_chunk(f, "IEND", std::vector<uint8_t>());
+    return fclose(f) == 0;
+}
+
+bool write_image(const char* path, const Framebuffer& fb) {
+    if (has_extension(path, ".png"))
+        return write_png(path, fb);
+    if (has_extension(path, ".pfm"))
+        return write_pfm(path, fb);
+    if (has_extension(path, ".ppm"))
+        return write_ppm(path, fb);
+    return false;
+}
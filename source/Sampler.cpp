@@ -0,0 +1,116 @@
+#include "Sampler.h"
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+const int size = blue_noise_size;
+const int pixels = size * size;
+
+// Void and cluster over a torus. 'energy' holds, for every pixel, the sum of a Gaussian
+// of its distance to each set pixel; the tightest cluster is the set pixel with the most
+// energy and the largest void the unset one with the least.
+class VoidAndCluster {
+    public:
+        VoidAndCluster() : kernel(pixels), energy(pixels, 0.0f), set(pixels, 0) {
+            const float sigma = 1.5f;
+            for (int y = 0; y < size; y++) {
+                for (int x = 0; x < size; x++) {
+                    int dx = std::min(x, size - x), dy = std::min(y, size - y);
+                    kernel[y * size + x] = expf(-float(dx*dx + dy*dy) / (2.0f * sigma * sigma));
+                }
+            }
+        }
+
+        void flip(int p) {
+            float sign = set[p] ? -1.0f : 1.0f;
+            set[p] ^= 1;
+            int px = p % size, py = p / size;
+            for (int y = 0; y < size; y++) {
+                const float* row = &kernel[((y - py) & (size - 1)) * size];
+                float* e = &energy[y * size];
+                for (int x = 0; x < size; x++)
+                    e[x] += sign * row[(x - px) & (size - 1)];
+            }
+        }
+
+        // The set pixel with the most energy (value 1) or the unset one with the least (0).
+        int extreme(uint8_t value) const {
+            int best = -1;
+            for (int p = 0; p < pixels; p++) {
+                if (set[p] != value)
+                    continue;
+                if (best < 0 || (value ? energy[p] > energy[best] : energy[p] < energy[best]))
+                    best = p;
+            }
+            return best;
+        }
+
+        std::vector<float> kernel;
+        std::vector<float> energy;
+        std::vector<uint8_t> set;
+};
+
+std::vector<float> make_mask() {
+    // Initial pattern: a tenth of the pixels at random, then relaxed by moving the
+    // tightest cluster into the largest void until that changes nothing.
+    VoidAndCluster vc;
+    Pcg32 random(0x5eed);
+    int ones = 0;
+    while (ones < pixels / 10) {
+        int p = int(random.next_uint() % pixels);
+        if (!vc.set[p]) {
+            vc.flip(p);
+            ones++;
+        }
+    }
+    for (int i = 0; i < pixels; i++) {
+        int cluster = vc.extreme(1);
+        vc.flip(cluster);
+        int hole = vc.extreme(0);
+        vc.flip(hole);
+        if (hole == cluster)
+            break;
+    }
+
+    std::vector<int> rank(pixels);
+    // The initial points are ranked by taking out the tightest cluster each time,
+    VoidAndCluster first = vc;
+    for (int r = ones - 1; r >= 0; r--) {
+        int cluster = first.extreme(1);
+        first.flip(cluster);
+        rank[cluster] = r;
+    }
+    // then the rest by filling the largest void. Past half, the voids are better found
+    // as clusters of the unset pixels, so the roles swap.
+    int r = ones;
+    for (; r < pixels / 2; r++) {
+        int hole = vc.extreme(0);
+        vc.flip(hole);
+        rank[hole] = r;
+    }
+    VoidAndCluster rest;
+    for (int p = 0; p < pixels; p++) {
+        if (!vc.set[p])
+            rest.flip(p);
+    }
+    for (; r < pixels; r++) {
+        int cluster = rest.extreme(1);
+        rest.flip(cluster);
+        rank[cluster] = r;
+    }
+
+    std::vector<float> mask(pixels);
+    for (int p = 0; p < pixels; p++)
+        mask[p] = (float(rank[p]) + 0.5f) / float(pixels);
+    return mask;
+}
+
+}
+
+const float* blue_noise_mask() {
+    static const std::vector<float> mask = make_mask();
+    return mask.data();
+}
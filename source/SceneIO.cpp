@@ -0,0 +1,988 @@
+#include "SceneIO.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+bool has_extension(const char* path, const char* ext) {
+    size_t n = strlen(path), m = strlen(ext);
+    if (n < m)
+        return false;
+    for (size_t i = 0; i < m; i++) {
+        char c = path[n - m + i];
+        if (c >= 'A' && c <= 'Z')
+            c = char(c - 'A' + 'a');
+        if (c != ext[i])
+            return false;
+    }
+    return true;
+}
+
+const char binary_magic[8] = { 'P', 'I', 'C', 'O', 'S', 'C', 'N', '\0' };
+const uint32_t binary_version = 3;
+const uint32_t flag_no_sky = 1;
+const uint32_t byte_order_mark = 0x01020304u;
+
+struct BinaryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t num_materials;
+    uint32_t num_spheres;
+    float camera[12];       // lookfrom, lookat, vup, vfov, aperture, focus_dist
+    uint32_t flags;         // since version 2
+    uint32_t num_moving_spheres;    // since version 3
+    float shutter[2];
+};
+
+struct MaterialRecord {
+    uint32_t type;
+    float fuzz;
+    float ref_idx;
+    float albedo[3];
+};
+
+struct SphereRecord {
+    float center[3];
+    float radius;
+    int32_t material;
+};
+
+struct MovingSphereRecord {
+    float center0[3];
+    float center1[3];
+    float time0, time1;
+    float radius;
+    int32_t material;
+};
+
+static_assert(sizeof(BinaryHeader) == 88, "binary scene header must be packed");
+static_assert(sizeof(MaterialRecord) == 24, "binary material record must be packed");
+static_assert(sizeof(SphereRecord) == 20, "binary sphere record must be packed");
+static_assert(sizeof(MovingSphereRecord) == 40, "binary moving sphere record must be packed");
+
+// Read-only view of a whole file: mapped where the platform allows it, read otherwise.
+class FileView {
+    public:
+        FileView() : ptr(nullptr), length(0) {}
+        ~FileView();
+
+        bool open(const char* path);
+        const uint8_t* data() const { return ptr; }
+        size_t size() const { return length; }
+
+    private:
+        const uint8_t* ptr;
+        size_t length;
+        std::vector<uint8_t> buffer;
+};
+
+#if defined(_WIN32)
+
+FileView::~FileView() {}
+
+bool FileView::open(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f)
+        return false;
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buffer.resize(n > 0 ? size_t(n) : 0);
+    bool ok = n >= 0 && fread(buffer.data(), 1, buffer.size(), f) == buffer.size();
+    fclose(f);
+    ptr = buffer.data();
+    length = buffer.size();
+    return ok;
+}
+
+#else
+
+FileView::~FileView() {
+    if (ptr && length)
+        munmap(const_cast<uint8_t*>(ptr), length);
+}
+
+bool FileView::open(const char* path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    length = size_t(st.st_size);
+    if (length == 0) {
+        close(fd);
+        return true;
+    }
+    void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        length = 0;
+        return false;
+    }
+    madvise(p, length, MADV_SEQUENTIAL);
+    ptr = static_cast<const uint8_t*>(p);
+    return true;
+}
+
+#endif
+
+bool check_materials(const char* path, const Scene& scene) {
+    int num_materials = int(scene.materials.size());
+    for (size_t i = 0; i < scene.materials.size(); i++) {
+        int t = scene.materials[i].texture;
+        if (t < -1 || t >= int(scene.textures.size())) {
+            std::cout << path << ": material " << i << " uses undefined texture " << t << std::endl;
+            return false;
+        }
+    }
+    for (size_t i = 0; i < scene.spheres.size(); i++) {
+        int m = scene.spheres[i].material;
+        if (m < 0 || m >= num_materials) {
+            std::cout << path << ": sphere " << i << " uses undefined material " << m << std::endl;
+            return false;
+        }
+    }
+    for (size_t i = 0; i < scene.moving_spheres.size(); i++) {
+        int m = scene.moving_spheres[i].material;
+        if (m < 0 || m >= num_materials) {
+            std::cout << path << ": moving sphere " << i << " uses undefined material " << m << std::endl;
+            return false;
+        }
+    }
+    for (size_t i = 0; i < scene.meshes.size(); i++) {
+        int m = scene.meshes[i].material;
+        if (m < 0 || m >= num_materials) {
+            std::cout << path << ": mesh " << i << " uses undefined material " << m << std::endl;
+            return false;
+        }
+    }
+    for (size_t i = 0; i < scene.groups.size(); i++) {
+        const Group& g = *scene.groups[i];
+        for (const Sphere& s : g.spheres) {
+            if (s.material < 0 || s.material >= num_materials) {
+                std::cout << path << ": a sphere of group " << i << " uses undefined material " << s.material << std::endl;
+                return false;
+            }
+        }
+        for (const TriangleMesh& m : g.meshes) {
+            if (m.material < 0 || m.material >= num_materials) {
+                std::cout << path << ": a mesh of group " << i << " uses undefined material " << m.material << std::endl;
+                return false;
+            }
+        }
+    }
+    for (size_t i = 0; i < scene.instances.size(); i++) {
+        int m = scene.instances[i].material;
+        if (m < -1 || m >= num_materials) {
+            std::cout << path << ": instance " << i << " uses undefined material " << m << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Cursor over a NUL terminated text buffer. Numbers are read in place, so parsing a
+// line allocates nothing. std::from_chars is locale independent and several times
+// faster than strtof where the standard library has the floating point overloads.
+struct TextParser {
+    const char* p;
+    const char* end;
+    int line;
+
+    void skip_blanks() {
+        while (*p == ' ' || *p == '\t' || *p == '\r')
+            p++;
+    }
+
+    bool at_line_end() {
+        skip_blanks();
+        return *p == '\0' || *p == '\n' || *p == '#';
+    }
+
+    void next_line() {
+        while (*p && *p != '\n')
+            p++;
+        if (*p == '\n') {
+            p++;
+            line++;
+        }
+    }
+
+    bool keyword(const char*& word, size_t& n) {
+        skip_blanks();
+        word = p;
+        while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && *p != '#')
+            p++;
+        n = size_t(p - word);
+        return n > 0;
+    }
+
+    bool number(float& v) {
+        skip_blanks();
+#if defined(__cpp_lib_to_chars)
+        if (*p == '+')
+            p++;
+        std::from_chars_result r = std::from_chars(p, end, v);
+        if (r.ec != std::errc())
+            return false;
+        p = r.ptr;
+#else
+        char* next;
+        v = strtof(p, &next);
+        if (next == p)
+            return false;
+        p = next;
+#endif
+        return true;
+    }
+
+    bool integer(int& v) {
+        skip_blanks();
+        std::from_chars_result r = std::from_chars(p, end, v);
+        if (r.ec != std::errc())
+            return false;
+        p = r.ptr;
+        return true;
+    }
+
+    bool vector(Vector3& v) {
+        return number(v[0]) && number(v[1]) && number(v[2]);
+    }
+};
+
+bool is_keyword(const char* word, size_t n, const char* name) {
+    return strlen(name) == n && !memcmp(word, name, n);
+}
+
+// Cursor over one line of an OBJ file. OBJ files are parsed straight from their mapping,
+// which has no terminator, so every read is bounded by 'end', the line's end.
+struct ObjLine {
+    const char* p;
+    const char* end;
+
+    void skip_blanks() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+            p++;
+    }
+
+    bool at_end() {
+        skip_blanks();
+        return p == end || *p == '#';
+    }
+
+    bool number(float& v) {
+        skip_blanks();
+        if (p < end && *p == '+')
+            p++;
+#if defined(__cpp_lib_to_chars)
+        std::from_chars_result r = std::from_chars(p, end, v);
+        if (r.ec != std::errc())
+            return false;
+        p = r.ptr;
+#else
+        char token[64];
+        size_t n = 0;
+        while (p + n < end && n + 1 < sizeof(token) && p[n] != ' ' && p[n] != '\t' && p[n] != '\r')
+            n++;
+        memcpy(token, p, n);
+        token[n] = '\0';
+        char* next;
+        v = strtof(token, &next);
+        if (next == token)
+            return false;
+        p += next - token;
+#endif
+        return true;
+    }
+
+    bool vector(Vector3& v) {
+        return number(v[0]) && number(v[1]) && number(v[2]);
+    }
+
+    // A 1-based or negative (counted back from the last) reference to one of 'count'
+    // elements, as a 0-based index.
+    bool reference(size_t count, uint32_t& index) {
+        long long v;
+        std::from_chars_result r = std::from_chars(p, end, v);
+        if (r.ec != std::errc())
+            return false;
+        p = r.ptr;
+        long long i = v > 0 ? v - 1 : (long long)count + v;
+        if (v == 0 || i < 0 || i >= (long long)count)
+            return false;
+        index = uint32_t(i);
+        return true;
+    }
+
+    // One face corner: v, v/vt, v//vn or v/vt/vn. 'normal' is left alone if the corner
+    // has none.
+    bool corner(size_t num_positions, size_t num_normals, uint32_t& position, uint32_t& normal, bool& has_normal) {
+        skip_blanks();
+        has_normal = false;
+        if (!reference(num_positions, position))
+            return false;
+        if (p == end || *p != '/')
+            return true;
+        p++;
+        if (p < end && *p != '/') {
+            long long texcoord;
+            std::from_chars_result r = std::from_chars(p, end, texcoord);
+            if (r.ec != std::errc())
+                return false;
+            p = r.ptr;
+        }
+        if (p == end || *p != '/')
+            return true;
+        p++;
+        has_normal = true;
+        return reference(num_normals, normal);
+    }
+};
+
+// True if the line starts with 'word' followed by a blank.
+bool starts_with(const char* p, const char* end, const char* word) {
+    size_t n = strlen(word);
+    return size_t(end - p) > n && !memcmp(p, word, n) && (p[n] == ' ' || p[n] == '\t');
+}
+
+}
+
+bool load_scene_text(const char* path, Scene& scene) {
+    FileView file;
+    if (!file.open(path)) {
+        std::cout << "Cannot open " << path << std::endl;
+        return false;
+    }
+    std::vector<char> text(file.size() + 1);
+    if (file.size())
+        memcpy(text.data(), file.data(), file.size());
+    text[file.size()] = '\0';
+
+    // Sized up front, so these are the only allocations of the big arenas. Counting is
+    // much cheaper than parsing, and the arenas come out without spare capacity.
+    scene.clear();
+    size_t num_spheres = 0, num_instances = 0;
+    for (const char* p = text.data(); *p; p++) {
+        num_spheres += starts_with(p, text.data() + file.size(), "sphere");
+        num_instances += starts_with(p, text.data() + file.size(), "instance");
+        while (*p && *p != '\n')
+            p++;
+        if (!*p)
+            break;
+    }
+    scene.spheres.reserve(num_spheres);
+    scene.instances.reserve(num_instances);
+
+    // Entries between 'group' and 'end' go into the open group rather than the scene.
+    std::unique_ptr<Group> group;
+    // Textures of the same file share its image, and so its tiles.
+    std::map<std::string, int> images;
+    TextParser in = { text.data(), text.data() + file.size(), 1 };
+    while (*in.p) {
+        if (in.at_line_end()) {
+            in.next_line();
+            continue;
+        }
+        const char* word;
+        size_t len;
+        in.keyword(word, len);
+
+        bool ok;
+        if (is_keyword(word, len, "sphere")) {
+            Vector3 center;
+            float radius;
+            int material;
+            ok = in.vector(center) && in.number(radius) && in.integer(material);
+            if (ok && group)
+                group->add_sphere(center, radius, material);
+            else if (ok)
+                scene.add_sphere(center, radius, material);
+        }
+        else if (is_keyword(word, len, "moving_sphere") && !group) {
+            Vector3 center0, center1;
+            float time0, time1, radius;
+            int material;
+            ok = in.vector(center0) && in.vector(center1) && in.number(time0) && in.number(time1)
+                 && in.number(radius) && in.integer(material);
+            if (ok)
+                scene.add_moving_sphere(center0, center1, time0, time1, radius, material);
+        }
+        else if (is_keyword(word, len, "mesh")) {
+            const char* file;
+            size_t file_len;
+            int material;
+            ok = in.keyword(file, file_len) && in.integer(material);
+            if (ok) {
+                std::filesystem::path mesh_path = std::filesystem::path(path).parent_path() / std::string(file, file_len);
+                TriangleMesh mesh;
+                if (!load_obj(mesh_path.lexically_normal().string().c_str(), mesh))
+                    return false;
+                mesh.material = material;
+                if (group)
+                    group->add_mesh(std::move(mesh));
+                else
+                    scene.add_mesh(std::move(mesh));
+            }
+        }
+        else if (is_keyword(word, len, "group") && !group) {
+            group.reset(new Group());
+            ok = true;
+        }
+        else if (is_keyword(word, len, "end") && group) {
+            scene.add_group(group.release());
+            ok = true;
+        }
+        else if (is_keyword(word, len, "instance") && !group) {
+            int index, material;
+            Affine to_world;
+            ok = in.integer(index) && in.integer(material);
+            for (int i = 0; i < 12 && ok; i++)
+                ok = in.number(to_world.m[i / 4][i % 4]);
+            if (ok && (index < 0 || index >= int(scene.groups.size()))) {
+                std::cout << path << ":" << in.line << ": instance of undefined group " << index << std::endl;
+                return false;
+            }
+            if (ok && to_world.determinant() == 0.0f) {
+                std::cout << path << ":" << in.line << ": instance transform is singular" << std::endl;
+                return false;
+            }
+            if (ok)
+                scene.add_instance(index, to_world, material);
+        }
+        else if (is_keyword(word, len, "lambertian")) {
+            Vector3 albedo;
+            int texture = -1;
+            ok = in.vector(albedo) && (in.at_line_end() || in.integer(texture));
+            if (ok)
+                scene.add_material(lambertian(albedo, texture));
+        }
+        else if (is_keyword(word, len, "metal")) {
+            Vector3 albedo;
+            float fuzz;
+            int texture = -1;
+            ok = in.vector(albedo) && in.number(fuzz) && (in.at_line_end() || in.integer(texture));
+            if (ok)
+                scene.add_material(metal(albedo, fuzz, texture));
+        }
+        else if (is_keyword(word, len, "checker")) {
+            Vector3 color0, color1;
+            float scale;
+            ok = in.vector(color0) && in.vector(color1) && in.number(scale);
+            if (ok)
+                scene.add_texture(checker_texture(color0, color1, scale));
+        }
+        else if (is_keyword(word, len, "image")) {
+            const char* file;
+            size_t file_len;
+            ok = in.keyword(file, file_len);
+            if (ok) {
+                std::string image_path = (std::filesystem::path(path).parent_path() / std::string(file, file_len))
+                                         .lexically_normal().string();
+                auto found = images.find(image_path);
+                int image = found != images.end() ? found->second : scene.texture_cache.add_file(image_path);
+                if (image < 0)
+                    return false;
+                images[image_path] = image;
+                scene.add_texture(image_texture(image));
+            }
+        }
+        else if (is_keyword(word, len, "diffuse_light")) {
+            Vector3 radiance;
+            ok = in.vector(radiance);
+            if (ok)
+                scene.add_material(diffuse_light(radiance));
+        }
+        else if (is_keyword(word, len, "dielectric")) {
+            float ref_idx;
+            ok = in.number(ref_idx);
+            if (ok)
+                scene.add_material(dielectric(ref_idx));
+        }
+        else if (is_keyword(word, len, "sky")) {
+            int on;
+            ok = in.integer(on);
+            if (ok)
+                scene.sky = on != 0;
+        }
+        else if (is_keyword(word, len, "camera")) {
+            SceneCamera& c = scene.camera;
+            ok = in.vector(c.lookfrom) && in.vector(c.lookat) && in.vector(c.vup)
+                 && in.number(c.vfov) && in.number(c.aperture) && in.number(c.focus_dist);
+        }
+        else if (is_keyword(word, len, "shutter")) {
+            ok = in.number(scene.camera.time0) && in.number(scene.camera.time1);
+        }
+        else {
+            std::cout << path << ":" << in.line << ": unexpected entry '" << std::string(word, len) << "'"
+                      << (group ? " in a group" : "") << std::endl;
+            return false;
+        }
+
+        if (!ok || !in.at_line_end()) {
+            std::cout << path << ":" << in.line << ": malformed " << std::string(word, len) << std::endl;
+            return false;
+        }
+        in.next_line();
+    }
+    if (group) {
+        std::cout << path << ": group without end" << std::endl;
+        return false;
+    }
+    return check_materials(path, scene);
+}
+
+bool save_scene_text(const char* path, const Scene& scene) {
+    FILE* f = fopen(path, "w");
+    if (!f)
+        return false;
+    const SceneCamera& c = scene.camera;
+    fprintf(f, "# picoray scene: %d materials, %d spheres, %d meshes\n", int(scene.materials.size()),
+            int(scene.spheres.size() + scene.moving_spheres.size()), int(scene.meshes.size()));
+    fprintf(f, "camera %.9g %.9g %.9g  %.9g %.9g %.9g  %.9g %.9g %.9g  %.9g %.9g %.9g\n",
+            c.lookfrom[0], c.lookfrom[1], c.lookfrom[2], c.lookat[0], c.lookat[1], c.lookat[2],
+            c.vup[0], c.vup[1], c.vup[2], c.vfov, c.aperture, c.focus_dist);
+    if (c.time0 != 0.0f || c.time1 != 0.0f)
+        fprintf(f, "shutter %.9g %.9g\n", c.time0, c.time1);
+    if (!scene.sky)
+        fprintf(f, "sky 0\n");
+    std::filesystem::path dir = std::filesystem::path(path).parent_path();
+    auto relative_path = [&](const std::string& file) {
+        std::error_code error;
+        std::filesystem::path relative = std::filesystem::proximate(file, dir.empty() ? "." : dir, error);
+        return (error ? std::filesystem::path(file) : relative).generic_string();
+    };
+    bool ok = true;
+    for (const Texture& t : scene.textures) {
+        switch (t.type) {
+            case TEXTURE_CHECKER:
+                fprintf(f, "checker %.9g %.9g %.9g  %.9g %.9g %.9g  %.9g\n", t.color0[0], t.color0[1], t.color0[2],
+                        t.color1[0], t.color1[1], t.color1[2], t.scale);
+                break;
+            case TEXTURE_IMAGE:
+                if (!scene.texture_cache.has_file(t.image)) {
+                    std::cout << path << ": images built in code cannot be saved" << std::endl;
+                    ok = false;
+                    break;
+                }
+                fprintf(f, "image %s\n", relative_path(scene.texture_cache.path(t.image)).c_str());
+                break;
+        }
+    }
+    for (const Material& m : scene.materials) {
+        switch (m.type) {
+            case MATERIAL_LAMBERTIAN:
+                if (m.texture >= 0)
+                    fprintf(f, "lambertian %.9g %.9g %.9g %d\n", m.albedo[0], m.albedo[1], m.albedo[2], m.texture);
+                else
+                    fprintf(f, "lambertian %.9g %.9g %.9g\n", m.albedo[0], m.albedo[1], m.albedo[2]);
+                break;
+            case MATERIAL_METAL:
+                if (m.texture >= 0)
+                    fprintf(f, "metal %.9g %.9g %.9g %.9g %d\n", m.albedo[0], m.albedo[1], m.albedo[2], m.fuzz, m.texture);
+                else
+                    fprintf(f, "metal %.9g %.9g %.9g %.9g\n", m.albedo[0], m.albedo[1], m.albedo[2], m.fuzz);
+                break;
+            case MATERIAL_DIELECTRIC:
+                fprintf(f, "dielectric %.9g\n", m.ref_idx);
+                break;
+            case MATERIAL_DIFFUSE_LIGHT:
+                fprintf(f, "diffuse_light %.9g %.9g %.9g\n", m.albedo[0], m.albedo[1], m.albedo[2]);
+                break;
+        }
+    }
+    for (const Sphere& s : scene.spheres)
+        fprintf(f, "sphere %.9g %.9g %.9g %.9g %d\n", s.center[0], s.center[1], s.center[2], s.radius, s.material);
+    for (const MovingSphere& s : scene.moving_spheres)
+        fprintf(f, "moving_sphere %.9g %.9g %.9g  %.9g %.9g %.9g  %.9g %.9g %.9g %d\n",
+                s.center0[0], s.center0[1], s.center0[2], s.center1[0], s.center1[1], s.center1[2],
+                s.time0, s.time1, s.radius, s.material);
+    auto write_mesh = [&](const TriangleMesh& m) {
+        if (m.path.empty()) {
+            std::cout << path << ": meshes built in code cannot be saved" << std::endl;
+            return false;
+        }
+        fprintf(f, "mesh %s %d\n", relative_path(m.path).c_str(), m.material);
+        return true;
+    };
+    for (const TriangleMesh& m : scene.meshes)
+        ok = ok && write_mesh(m);
+    for (const std::unique_ptr<Group>& g : scene.groups) {
+        fprintf(f, "group\n");
+        for (const Sphere& s : g->spheres)
+            fprintf(f, "sphere %.9g %.9g %.9g %.9g %d\n", s.center[0], s.center[1], s.center[2], s.radius, s.material);
+        for (const TriangleMesh& m : g->meshes)
+            ok = ok && write_mesh(m);
+        fprintf(f, "end\n");
+    }
+    for (const Instance& inst : scene.instances) {
+        size_t index = 0;
+        while (scene.groups[index].get() != inst.group)
+            index++;
+        Affine m = inst.to_world();
+        fprintf(f, "instance %d %d  %.9g %.9g %.9g %.9g  %.9g %.9g %.9g %.9g  %.9g %.9g %.9g %.9g\n",
+                int(index), inst.material, m.m[0][0], m.m[0][1], m.m[0][2], m.m[0][3],
+                m.m[1][0], m.m[1][1], m.m[1][2], m.m[1][3], m.m[2][0], m.m[2][1], m.m[2][2], m.m[2][3]);
+    }
+    return fclose(f) == 0 && ok;
+}
+
+bool load_scene_binary(const char* path, Scene& scene) {
+    FileView file;
+    if (!file.open(path)) {
+        std::cout << "Cannot open " << path << std::endl;
+        return false;
+    }
+
+    // Version 1 headers end before 'flags', version 2 headers before the moving spheres.
+    const size_t v1_header_size = offsetof(BinaryHeader, flags);
+    const size_t v2_header_size = offsetof(BinaryHeader, num_moving_spheres);
+    BinaryHeader header;
+    if (file.size() < v1_header_size) {
+        std::cout << path << ": not a picoray binary scene" << std::endl;
+        return false;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(&header, file.data(), v1_header_size);
+    size_t header_size = header.version == 1 ? v1_header_size : header.version == 2 ? v2_header_size : sizeof(header);
+    if (file.size() >= header_size)
+        memcpy(&header, file.data(), header_size);
+    if (memcmp(header.magic, binary_magic, sizeof(binary_magic)) || header.version < 1 || header.version > binary_version) {
+        std::cout << path << ": not a picoray binary scene, or an unsupported version" << std::endl;
+        return false;
+    }
+    if (header.byte_order != byte_order_mark) {
+        std::cout << path << ": written on a machine with a different byte order" << std::endl;
+        return false;
+    }
+    uint64_t expected = header_size + uint64_t(header.num_materials) * sizeof(MaterialRecord)
+                      + uint64_t(header.num_spheres) * sizeof(SphereRecord)
+                      + uint64_t(header.num_moving_spheres) * sizeof(MovingSphereRecord);
+    if (file.size() != expected) {
+        std::cout << path << ": truncated or corrupt" << std::endl;
+        return false;
+    }
+
+    scene.clear();
+    const float* c = header.camera;
+    scene.camera.lookfrom = Vector3(c[0], c[1], c[2]);
+    scene.camera.lookat = Vector3(c[3], c[4], c[5]);
+    scene.camera.vup = Vector3(c[6], c[7], c[8]);
+    scene.camera.vfov = c[9];
+    scene.camera.aperture = c[10];
+    scene.camera.focus_dist = c[11];
+    scene.camera.time0 = header.shutter[0];
+    scene.camera.time1 = header.shutter[1];
+    scene.sky = !(header.flags & flag_no_sky);
+
+    const uint8_t* p = file.data() + header_size;
+    scene.materials.resize(header.num_materials);
+    for (uint32_t i = 0; i < header.num_materials; i++, p += sizeof(MaterialRecord)) {
+        MaterialRecord r;
+        memcpy(&r, p, sizeof(r));
+        if (r.type > MATERIAL_DIFFUSE_LIGHT) {
+            std::cout << path << ": material " << i << " has unknown type " << r.type << std::endl;
+            return false;
+        }
+        Material& m = scene.materials[i];
+        m.type = MaterialType(r.type);
+        m.fuzz = r.fuzz;
+        m.ref_idx = r.ref_idx;
+        m.albedo = Vector3(r.albedo[0], r.albedo[1], r.albedo[2]);
+        m.texture = -1;
+    }
+
+    scene.spheres.reserve(header.num_spheres);
+    for (uint32_t i = 0; i < header.num_spheres; i++, p += sizeof(SphereRecord)) {
+        SphereRecord r;
+        memcpy(&r, p, sizeof(r));
+        scene.add_sphere(Vector3(r.center[0], r.center[1], r.center[2]), r.radius, r.material);
+    }
+
+    scene.moving_spheres.reserve(header.num_moving_spheres);
+    for (uint32_t i = 0; i < header.num_moving_spheres; i++, p += sizeof(MovingSphereRecord)) {
+        MovingSphereRecord r;
+        memcpy(&r, p, sizeof(r));
+        scene.add_moving_sphere(Vector3(r.center0[0], r.center0[1], r.center0[2]),
+                                Vector3(r.center1[0], r.center1[1], r.center1[2]),
+                                r.time0, r.time1, r.radius, r.material);
+    }
+    return check_materials(path, scene);
+}
+
+bool save_scene_binary(const char* path, const Scene& scene) {
+    if (!scene.meshes.empty() || !scene.groups.empty()) {
+        std::cout << path << ": binary scenes cannot hold meshes or instances, save as .scene instead" << std::endl;
+        return false;
+    }
+    if (!scene.textures.empty()) {
+        std::cout << path << ": binary scenes cannot hold textures, save as .scene instead" << std::endl;
+        return false;
+    }
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return false;
+
+    BinaryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, binary_magic, sizeof(binary_magic));
+    header.version = binary_version;
+    header.byte_order = byte_order_mark;
+    header.num_materials = uint32_t(scene.materials.size());
+    header.num_spheres = uint32_t(scene.spheres.size());
+    const SceneCamera& c = scene.camera;
+    const Vector3* vectors[3] = { &c.lookfrom, &c.lookat, &c.vup };
+    for (int v = 0; v < 3; v++) {
+        for (int k = 0; k < 3; k++)
+            header.camera[v * 3 + k] = (*vectors[v])[k];
+    }
+    header.camera[9] = c.vfov;
+    header.camera[10] = c.aperture;
+    header.camera[11] = c.focus_dist;
+    header.flags = scene.sky ? 0 : flag_no_sky;
+    header.num_moving_spheres = uint32_t(scene.moving_spheres.size());
+    header.shutter[0] = c.time0;
+    header.shutter[1] = c.time1;
+    fwrite(&header, sizeof(header), 1, f);
+
+    std::vector<MaterialRecord> materials(scene.materials.size());
+    for (size_t i = 0; i < materials.size(); i++) {
+        const Material& m = scene.materials[i];
+        MaterialRecord& r = materials[i];
+        r.type = m.type;
+        r.fuzz = m.fuzz;
+        r.ref_idx = m.ref_idx;
+        for (int k = 0; k < 3; k++)
+            r.albedo[k] = m.albedo[k];
+    }
+    fwrite(materials.data(), sizeof(MaterialRecord), materials.size(), f);
+
+    // Written in blocks so huge scenes do not need a second full copy in memory.
+    const size_t block = 1 << 16;
+    std::vector<SphereRecord> spheres;
+    spheres.reserve(block);
+    for (size_t first = 0; first < scene.spheres.size(); first += block) {
+        size_t last = std::min(scene.spheres.size(), first + block);
+        spheres.clear();
+        for (size_t i = first; i < last; i++) {
+            const Sphere& s = scene.spheres[i];
+            SphereRecord r;
+            r.center[0] = s.center[0];
+            r.center[1] = s.center[1];
+            r.center[2] = s.center[2];
+            r.radius = s.radius;
+            r.material = s.material;
+            spheres.push_back(r);
+        }
+        fwrite(spheres.data(), sizeof(SphereRecord), spheres.size(), f);
+    }
+
+    std::vector<MovingSphereRecord> moving(scene.moving_spheres.size());
+    for (size_t i = 0; i < moving.size(); i++) {
+        const MovingSphere& s = scene.moving_spheres[i];
+        MovingSphereRecord& r = moving[i];
+        for (int k = 0; k < 3; k++) {
+            r.center0[k] = s.center0[k];
+            r.center1[k] = s.center1[k];
+        }
+        r.time0 = s.time0;
+        r.time1 = s.time1;
+        r.radius = s.radius;
+        r.material = s.material;
+    }
+    fwrite(moving.data(), sizeof(MovingSphereRecord), moving.size(), f);
+    return fclose(f) == 0;
+}
+
+bool load_camera_path(const char* path, CameraPath& camera_path) {
+    FileView file;
+    if (!file.open(path)) {
+        std::cout << "Cannot open " << path << std::endl;
+        return false;
+    }
+    std::vector<char> text(file.size() + 1);
+    if (file.size())
+        memcpy(text.data(), file.data(), file.size());
+    text[file.size()] = '\0';
+
+    camera_path.keys.clear();
+    TextParser in = { text.data(), text.data() + file.size(), 1 };
+    while (*in.p) {
+        if (in.at_line_end()) {
+            in.next_line();
+            continue;
+        }
+        const char* word;
+        size_t len;
+        in.keyword(word, len);
+        if (!is_keyword(word, len, "key")) {
+            std::cout << path << ":" << in.line << ": unknown entry '" << std::string(word, len) << "'" << std::endl;
+            return false;
+        }
+        CameraKey key;
+        if (!in.number(key.time) || !in.vector(key.lookfrom) || !in.vector(key.lookat) || !in.at_line_end()) {
+            std::cout << path << ":" << in.line << ": malformed key" << std::endl;
+            return false;
+        }
+        camera_path.add(key);
+        in.next_line();
+    }
+    if (camera_path.empty()) {
+        std::cout << path << ": no camera keys" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool load_obj(const char* path, TriangleMesh& mesh) {
+    auto start = std::chrono::steady_clock::now();
+    FileView file;
+    if (!file.open(path)) {
+        std::cout << "Cannot open " << path << std::endl;
+        return false;
+    }
+    const char* begin = reinterpret_cast<const char*>(file.data());
+    const char* end = begin + file.size();
+    auto line_end = [end](const char* p) {
+        const char* nl = static_cast<const char*>(memchr(p, '\n', size_t(end - p)));
+        return nl ? nl : end;
+    };
+
+    // Counting first lets every buffer be allocated once at its final size, which matters
+    // more than the extra pass for meshes of millions of triangles. Polygons with more
+    // than three corners still grow the index buffers.
+    size_t num_positions = 0, num_normals = 0, num_faces = 0;
+    for (const char* p = begin; p < end; p = line_end(p) + 1) {
+        if (starts_with(p, end, "v"))
+            num_positions++;
+        else if (starts_with(p, end, "vn"))
+            num_normals++;
+        else if (starts_with(p, end, "f"))
+            num_faces++;
+    }
+
+    mesh.positions.clear();
+    mesh.normals.clear();
+    mesh.indices.clear();
+    mesh.normal_indices.clear();
+    mesh.positions.reserve(num_positions);
+    mesh.normals.reserve(num_normals);
+    mesh.indices.reserve(3 * num_faces);
+    if (num_normals)
+        mesh.normal_indices.reserve(3 * num_faces);
+
+    bool all_normals = num_normals > 0;
+    int line = 1;
+    for (const char* p = begin; p < end; p = line_end(p) + 1, line++) {
+        ObjLine in = { p, line_end(p) };
+        in.skip_blanks();
+        const char* word = in.p;
+        while (in.p < in.end && *in.p != ' ' && *in.p != '\t' && *in.p != '\r')
+            in.p++;
+        size_t len = size_t(in.p - word);
+
+        bool ok = true;
+        if (is_keyword(word, len, "v")) {
+            Vector3 v;
+            float weight;
+            ok = in.vector(v) && (in.at_end() || in.number(weight));
+            mesh.positions.push_back(v);
+        }
+        else if (is_keyword(word, len, "vn")) {
+            Vector3 n;
+            ok = in.vector(n);
+            mesh.normals.push_back(unit_vector(n));
+        }
+        else if (is_keyword(word, len, "f")) {
+            uint32_t first[2] = { 0, 0 }, prev[2] = { 0, 0 }, cur[2] = { 0, 0 };
+            bool has_normal;
+            int corners = 0;
+            while (ok && !in.at_end()) {
+                ok = in.corner(mesh.positions.size(), mesh.normals.size(), cur[0], cur[1], has_normal);
+                all_normals = all_normals && has_normal;
+                if (corners == 0) {
+                    first[0] = cur[0];
+                    first[1] = cur[1];
+                }
+                else if (corners >= 2) {
+                    mesh.indices.insert(mesh.indices.end(), { first[0], prev[0], cur[0] });
+                    if (all_normals)
+                        mesh.normal_indices.insert(mesh.normal_indices.end(), { first[1], prev[1], cur[1] });
+                }
+                prev[0] = cur[0];
+                prev[1] = cur[1];
+                corners++;
+            }
+            ok = ok && corners >= 3;
+            if (!ok) {
+                std::cout << path << ":" << line << ": malformed face" << std::endl;
+                return false;
+            }
+            continue;
+        }
+        else {
+            continue;   // comments, texture coordinates, groups, materials, ...
+        }
+        if (!ok || !in.at_end()) {
+            std::cout << path << ":" << line << ": malformed " << std::string(word, len) << std::endl;
+            return false;
+        }
+    }
+    if (mesh.indices.empty()) {
+        std::cout << path << ": no faces" << std::endl;
+        return false;
+    }
+    if (!all_normals) {
+        std::vector<Vector3>().swap(mesh.normals);
+        std::vector<uint32_t>().swap(mesh.normal_indices);
+    }
+
+    mesh.build();
+    mesh.path = path;
+    mesh.load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+bool is_scene_file(const char* path) {
+    return has_extension(path, ".scene") || has_extension(path, ".pscn");
+}
+
+bool load_scene(const char* path, Scene& scene) {
+    if (has_extension(path, ".pscn"))
+        return load_scene_binary(path, scene);
+    if (has_extension(path, ".scene"))
+        return load_scene_text(path, scene);
+    std::cout << path << ": unknown scene format, expected .scene or .pscn" << std::endl;
+    return false;
+}
+
+bool save_scene(const char* path, const Scene& scene) {
+    if (has_extension(path, ".pscn"))
+        return save_scene_binary(path, scene);
+    if (has_extension(path, ".scene"))
+        return save_scene_text(path, scene);
+    std::cout << path << ": unknown scene format, expected .scene or .pscn" << std::endl;
+    return false;
+}
@@ -0,0 +1,270 @@
+#include "SphereSoA.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PICORAY_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Same arithmetic as Sphere::hit, so every kernel agrees with the scalar path bit for bit
+// (ties between equally distant spheres go to the lower index).
+int hit_scalar(const float* cx, const float* cy, const float* cz, const float* radius,
+               int begin, int end, const Ray& r, float t_min, float t_max, float& t) {
+    const Vector3 o = r.origin();
+    const Vector3 d = r.direction();
+    const float a = dot(d, d);
+    int best = -1;
+    for (int i = begin; i < end; i++) {
+        float ocx = o[0] - cx[i], ocy = o[1] - cy[i], ocz = o[2] - cz[i];
+        float b = ocx*d[0] + ocy*d[1] + ocz*d[2];
+        float c = (ocx*ocx + ocy*ocy + ocz*ocz) - radius[i]*radius[i];
+        float discriminant = b*b - a*c;
+        if (discriminant > 0) {
+            float sq = sqrtf(discriminant);
+            float temp = (-b - sq)/a;
+            if (!(temp < t_max && temp > t_min))
+                temp = (-b + sq)/a;
+            if (temp < t_max && temp > t_min) {
+                t_max = temp;
+                best = i;
+            }
+        }
+    }
+    t = t_max;
+    return best;
+}
+
+#ifdef PICORAY_X86_KERNELS
+
+// Folds per-lane candidates into one, then finishes the range with the scalar kernel.
+template <int W>
+int reduce_lanes(const float* lane_t, const int* lane_i, float t_max, float& t) {
+    int best = -1;
+    for (int k = 0; k < W; k++) {
+        if (lane_i[k] >= 0 && (lane_t[k] < t_max || (lane_t[k] == t_max && lane_i[k] < best))) {
+            t_max = lane_t[k];
+            best = lane_i[k];
+        }
+    }
+    t = t_max;
+    return best;
+}
+
+__attribute__((target("sse2")))
+int hit_sse(const float* cx, const float* cy, const float* cz, const float* radius,
+            int begin, int end, const Ray& r, float t_min, float t_max, float& t) {
+    const Vector3 o = r.origin();
+    const Vector3 d = r.direction();
+    const float a = dot(d, d);
+    const __m128 ox = _mm_set1_ps(o[0]), oy = _mm_set1_ps(o[1]), oz = _mm_set1_ps(o[2]);
+    const __m128 dx = _mm_set1_ps(d[0]), dy = _mm_set1_ps(d[1]), dz = _mm_set1_ps(d[2]);
+    const __m128 va = _mm_set1_ps(a), vtmin = _mm_set1_ps(t_min), zero = _mm_setzero_ps();
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 best_t = _mm_set1_ps(t_max);
+    __m128i best_i = _mm_set1_epi32(-1);
+    __m128i index = _mm_add_epi32(_mm_set1_epi32(begin), _mm_setr_epi32(0, 1, 2, 3));
+    const __m128i step = _mm_set1_epi32(4);
+
+    int i = begin;
+    for (; i + 4 <= end; i += 4, index = _mm_add_epi32(index, step)) {
+        __m128 ocx = _mm_sub_ps(ox, _mm_loadu_ps(cx + i));
+        __m128 ocy = _mm_sub_ps(oy, _mm_loadu_ps(cy + i));
+        __m128 ocz = _mm_sub_ps(oz, _mm_loadu_ps(cz + i));
+        __m128 rad = _mm_loadu_ps(radius + i);
+        __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)), _mm_mul_ps(ocz, dz));
+        __m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz)),
+                              _mm_mul_ps(rad, rad));
+        __m128 disc = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(va, c));
+        __m128 valid = _mm_cmpgt_ps(disc, zero);
+        if (!_mm_movemask_ps(valid))
+            continue;
+        __m128 sq = _mm_sqrt_ps(disc);
+        __m128 nb = _mm_xor_ps(b, sign);
+        __m128 t0 = _mm_div_ps(_mm_sub_ps(nb, sq), va);
+        __m128 t1 = _mm_div_ps(_mm_add_ps(nb, sq), va);
+        __m128 ok0 = _mm_and_ps(valid, _mm_and_ps(_mm_cmplt_ps(t0, best_t), _mm_cmpgt_ps(t0, vtmin)));
+        __m128 ok1 = _mm_andnot_ps(ok0, _mm_and_ps(valid, _mm_and_ps(_mm_cmplt_ps(t1, best_t), _mm_cmpgt_ps(t1, vtmin))));
+        __m128 cand = _mm_or_ps(_mm_and_ps(ok0, t0), _mm_and_ps(ok1, t1));
+        __m128 ok = _mm_or_ps(ok0, ok1);
+        best_t = _mm_or_ps(_mm_and_ps(ok, cand), _mm_andnot_ps(ok, best_t));
+        __m128i oki = _mm_castps_si128(ok);
+        best_i = _mm_or_si128(_mm_and_si128(oki, index), _mm_andnot_si128(oki, best_i));
+    }
+
+    alignas(16) float lane_t[4];
+    alignas(16) int lane_i[4];
+    _mm_store_ps(lane_t, best_t);
+    _mm_store_si128(reinterpret_cast<__m128i*>(lane_i), best_i);
+    int best = reduce_lanes<4>(lane_t, lane_i, t_max, t);
+    int tail = hit_scalar(cx, cy, cz, radius, i, end, r, t_min, t, t);
+    return tail >= 0 ? tail : best;
+}
+
+__attribute__((target("avx2")))
+int hit_avx2(const float* cx, const float* cy, const float* cz, const float* radius,
+             int begin, int end, const Ray& r, float t_min, float t_max, float& t) {
+    const Vector3 o = r.origin();
+    const Vector3 d = r.direction();
+    const float a = dot(d, d);
+    const __m256 ox = _mm256_set1_ps(o[0]), oy = _mm256_set1_ps(o[1]), oz = _mm256_set1_ps(o[2]);
+    const __m256 dx = _mm256_set1_ps(d[0]), dy = _mm256_set1_ps(d[1]), dz = _mm256_set1_ps(d[2]);
+    const __m256 va = _mm256_set1_ps(a), vtmin = _mm256_set1_ps(t_min), zero = _mm256_setzero_ps();
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 best_t = _mm256_set1_ps(t_max);
+    __m256i best_i = _mm256_set1_epi32(-1);
+    __m256i index = _mm256_add_epi32(_mm256_set1_epi32(begin), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    const __m256i step = _mm256_set1_epi32(8);
+
+    int i = begin;
+    for (; i + 8 <= end; i += 8, index = _mm256_add_epi32(index, step)) {
+        __m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(cx + i));
+        __m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(cy + i));
+        __m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(cz + i));
+        __m256 rad = _mm256_loadu_ps(radius + i);
+        __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)), _mm256_mul_ps(ocz, dz));
+        __m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)),
+                                               _mm256_mul_ps(ocz, ocz)),
+                                 _mm256_mul_ps(rad, rad));
+        __m256 disc = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(va, c));
+        __m256 valid = _mm256_cmp_ps(disc, zero, _CMP_GT_OQ);
+        if (!_mm256_movemask_ps(valid))
+            continue;
+        __m256 sq = _mm256_sqrt_ps(disc);
+        __m256 nb = _mm256_xor_ps(b, sign);
+        __m256 t0 = _mm256_div_ps(_mm256_sub_ps(nb, sq), va);
+        __m256 t1 = _mm256_div_ps(_mm256_add_ps(nb, sq), va);
+        __m256 ok0 = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t0, best_t, _CMP_LT_OQ),
+                                                        _mm256_cmp_ps(t0, vtmin, _CMP_GT_OQ)));
+        __m256 ok1 = _mm256_andnot_ps(ok0, _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t1, best_t, _CMP_LT_OQ),
+                                                                              _mm256_cmp_ps(t1, vtmin, _CMP_GT_OQ))));
+        __m256 ok = _mm256_or_ps(ok0, ok1);
+        best_t = _mm256_blendv_ps(best_t, _mm256_blendv_ps(t1, t0, ok0), ok);
+        best_i = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(best_i), _mm256_castsi256_ps(index), ok));
+    }
+
+    alignas(32) float lane_t[8];
+    alignas(32) int lane_i[8];
+    _mm256_store_ps(lane_t, best_t);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lane_i), best_i);
+    int best = reduce_lanes<8>(lane_t, lane_i, t_max, t);
+    int tail = hit_scalar(cx, cy, cz, radius, i, end, r, t_min, t, t);
+    return tail >= 0 ? tail : best;
+}
+
+// The remainder is handled with masked loads rather than a scalar tail. AVX-512 implies
+// FMA, so contraction is turned off to keep the results identical to the other kernels.
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+int hit_avx512(const float* cx, const float* cy, const float* cz, const float* radius,
+               int begin, int end, const Ray& r, float t_min, float t_max, float& t) {
+    const Vector3 o = r.origin();
+    const Vector3 d = r.direction();
+    const float a = dot(d, d);
+    const __m512 ox = _mm512_set1_ps(o[0]), oy = _mm512_set1_ps(o[1]), oz = _mm512_set1_ps(o[2]);
+    const __m512 dx = _mm512_set1_ps(d[0]), dy = _mm512_set1_ps(d[1]), dz = _mm512_set1_ps(d[2]);
+    const __m512 va = _mm512_set1_ps(a), vtmin = _mm512_set1_ps(t_min), zero = _mm512_setzero_ps();
+    __m512 best_t = _mm512_set1_ps(t_max);
+    __m512i best_i = _mm512_set1_epi32(-1);
+    __m512i index = _mm512_add_epi32(_mm512_set1_epi32(begin),
+                                     _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    const __m512i step = _mm512_set1_epi32(16);
+
+    for (int i = begin; i < end; i += 16, index = _mm512_add_epi32(index, step)) {
+        int remaining = end - i;
+        __mmask16 live = remaining >= 16 ? __mmask16(0xffff) : __mmask16((1u << remaining) - 1);
+        __m512 ocx = _mm512_sub_ps(ox, _mm512_maskz_loadu_ps(live, cx + i));
+        __m512 ocy = _mm512_sub_ps(oy, _mm512_maskz_loadu_ps(live, cy + i));
+        __m512 ocz = _mm512_sub_ps(oz, _mm512_maskz_loadu_ps(live, cz + i));
+        __m512 rad = _mm512_maskz_loadu_ps(live, radius + i);
+        __m512 b = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ocx, dx), _mm512_mul_ps(ocy, dy)), _mm512_mul_ps(ocz, dz));
+        __m512 c = _mm512_sub_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ocx, ocx), _mm512_mul_ps(ocy, ocy)),
+                                               _mm512_mul_ps(ocz, ocz)),
+                                 _mm512_mul_ps(rad, rad));
+        __m512 disc = _mm512_sub_ps(_mm512_mul_ps(b, b), _mm512_mul_ps(va, c));
+        __mmask16 valid = _mm512_mask_cmp_ps_mask(live, disc, zero, _CMP_GT_OQ);
+        if (!valid)
+            continue;
+        __m512 sq = _mm512_sqrt_ps(disc);
+        __m512 nb = _mm512_sub_ps(zero, b);
+        __m512 t0 = _mm512_div_ps(_mm512_sub_ps(nb, sq), va);
+        __m512 t1 = _mm512_div_ps(_mm512_add_ps(nb, sq), va);
+        __mmask16 ok0 = _mm512_mask_cmp_ps_mask(valid, t0, best_t, _CMP_LT_OQ) &
+                        _mm512_mask_cmp_ps_mask(valid, t0, vtmin, _CMP_GT_OQ);
+        __mmask16 ok1 = _mm512_mask_cmp_ps_mask(valid & ~ok0, t1, best_t, _CMP_LT_OQ) &
+                        _mm512_mask_cmp_ps_mask(valid & ~ok0, t1, vtmin, _CMP_GT_OQ);
+        best_t = _mm512_mask_mov_ps(best_t, ok0, t0);
+        best_t = _mm512_mask_mov_ps(best_t, ok1, t1);
+        best_i = _mm512_mask_mov_epi32(best_i, ok0 | ok1, index);
+    }
+
+    alignas(64) float lane_t[16];
+    alignas(64) int lane_i[16];
+    _mm512_store_ps(lane_t, best_t);
+    _mm512_store_si512(lane_i, best_i);
+    return reduce_lanes<16>(lane_t, lane_i, t_max, t);
+}
+
+#endif
+
+const SphereKernelInfo kernels[] = {
+    { "scalar", 1, hit_scalar },
+#ifdef PICORAY_X86_KERNELS
+    { "sse", 4, hit_sse },
+    { "avx2", 8, hit_avx2 },
+    { "avx512", 16, hit_avx512 },
+#endif
+};
+
+bool supported(const SphereKernelInfo& k) {
+#ifdef PICORAY_X86_KERNELS
+    __builtin_cpu_init();
+    if (!strcmp(k.name, "sse"))
+        return __builtin_cpu_supports("sse2");
+    if (!strcmp(k.name, "avx2"))
+        return __builtin_cpu_supports("avx2");
+    if (!strcmp(k.name, "avx512"))
+        return __builtin_cpu_supports("avx512f");
+#endif
+    return !strcmp(k.name, "scalar");
+}
+
+const SphereKernelInfo* widest_kernel() {
+    const SphereKernelInfo* best = &kernels[0];
+    for (const SphereKernelInfo& k : kernels) {
+        if (supported(k) && k.width > best->width)
+            best = &k;
+    }
+    return best;
+}
+
+const SphereKernelInfo* active_kernel = widest_kernel();
+
+}
+
+const SphereKernelInfo& sphere_kernel() {
+    return *active_kernel;
+}
+
+int intersect_spheres(const float* cx, const float* cy, const float* cz, const float* radius,
+                      int begin, int end, const Ray& r, float t_min, float t_max, float& t) {
+    const SphereKernelInfo& k = *active_kernel;
+    if (end - begin < k.width)
+        return hit_scalar(cx, cy, cz, radius, begin, end, r, t_min, t_max, t);
+    return k.fn(cx, cy, cz, radius, begin, end, r, t_min, t_max, t);
+}
+
+bool set_sphere_kernel(const char* name) {
+    if (!strcmp(name, "auto")) {
+        active_kernel = widest_kernel();
+        return true;
+    }
+    for (const SphereKernelInfo& k : kernels) {
+        if (!strcmp(k.name, name) && supported(k)) {
+            active_kernel = &k;
+            return true;
+        }
+    }
+    return false;
+}
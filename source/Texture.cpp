@@ -0,0 +1,22 @@
+#include "Texture.h"
+
+#include <math.h>
+
+Vector3 texture_value(const Texture& t, const TextureCache& cache, const Ray& r, const hit_record& rec) {
+    float footprint = r.footprint(rec.t);
+    if (t.type == TEXTURE_CHECKER) {
+        Vector3 p = t.scale * rec.p;
+        int parity = int(floorf(p.x()) + floorf(p.y()) + floorf(p.z())) & 1;
+        Vector3 c = parity ? t.color1 : t.color0;
+        float blur = fminf(fmaxf(2.0f * footprint * t.scale - 1.0f, 0.0f), 1.0f);
+        return (1.0f - blur) * c + (0.5f * blur) * (t.color0 + t.color1);
+    }
+    float u, v;
+    sphere_uv(rec.local_normal, u, v);
+    float width = 0.0f;
+    if (rec.size > 0.0f) {
+        float cosine = fabsf(dot(unit_vector(r.direction()), rec.normal));
+        width = footprint / (3.14159265f * rec.size * fmaxf(cosine, 0.05f));
+    }
+    return cache.lookup(t.image, u, v, width);
+}
@@ -0,0 +1,480 @@
+#include "TextureCache.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+#include "Random.h"
+#include "Stats.h"
+
+// Definitions for the class constants, which std::min() and friends take by reference.
+const int TextureCache::tile_size;
+const int TextureCache::thread_tiles;
+const size_t TextureCache::tile_bytes;
+const size_t TextureCache::min_budget;
+
+namespace {
+
+std::atomic<uint64_t> next_cache_id(1);
+
+enum PixelFormat { PIXELS_MEMORY, PIXELS_PPM8, PIXELS_PPM16, PIXELS_PFM };
+
+// Tiles are keyed by image, level and tile coordinates packed into 16, 5, 21 and 21 bits.
+const int max_images = 1 << 16;
+const int max_tiles = 1 << 21;
+
+uint64_t tile_key(int image, int level, int tx, int ty) {
+    return uint64_t(image) << 47 | uint64_t(level) << 42 | uint64_t(ty) << 21 | uint64_t(tx);
+}
+
+// Tiles a mip tile stands for at 'level', and so, roughly, the work of making it again.
+double rebuild_cost(int level) {
+    return ldexp(1.0, 2 * level);
+}
+
+float srgb_to_linear(float c) {
+    return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+const float* srgb8_table() {
+    static float table[256];
+    static bool filled = [] {
+        for (int i = 0; i < 256; i++)
+            table[i] = srgb_to_linear(float(i) / 255.0f);
+        return true;
+    }();
+    (void)filled;
+    return table;
+}
+
+bool seek(FILE* f, uint64_t offset) {
+#if defined(_WIN32)
+    return _fseeki64(f, int64_t(offset), SEEK_SET) == 0;
+#else
+    return fseeko(f, off_t(offset), SEEK_SET) == 0;
+#endif
+}
+
+uint64_t tell(FILE* f) {
+#if defined(_WIN32)
+    return uint64_t(_ftelli64(f));
+#else
+    return uint64_t(ftello(f));
+#endif
+}
+
+// Next whitespace separated header token, skipping '#' comments. The single whitespace
+// character after the token is consumed, so after the last one the file is at the data.
+bool header_token(FILE* f, std::string& token) {
+    token.clear();
+    int c = fgetc(f);
+    for (;;) {
+        if (c == '#') {
+            while (c != EOF && c != '\n')
+                c = fgetc(f);
+        }
+        else if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+            c = fgetc(f);
+        else
+            break;
+    }
+    while (c != EOF && c != ' ' && c != '\t' && c != '\r' && c != '\n' && c != '#') {
+        token += char(c);
+        c = fgetc(f);
+    }
+    return !token.empty() && c != EOF;
+}
+
+bool host_little_endian() {
+    uint32_t one = 1;
+    uint8_t first;
+    memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+}
+
+struct TextureCache::Image {
+    Image() : width(0), height(0), format(PIXELS_MEMORY), channels(3), swap_bytes(false),
+              file(nullptr), data_offset(0) {}
+    ~Image() {
+        if (file)
+            fclose(file);
+    }
+
+    std::string path;
+    int width, height;
+    std::vector<int> level_width, level_height;
+
+    PixelFormat format;
+    int channels;           // 1 for greyscale PFM
+    bool swap_bytes;        // PFM stored in the other byte order
+    FILE* file;             // read under file_mutex
+    uint64_t data_offset;
+    mutable std::mutex file_mutex;
+    std::vector<float> pixels;  // PIXELS_MEMORY
+
+    void set_size(int w, int h) {
+        width = w;
+        height = h;
+        level_width.assign(1, w);
+        level_height.assign(1, h);
+        while (w > 1 || h > 1) {
+            w = std::max(1, (w + 1) / 2);
+            h = std::max(1, (h + 1) / 2);
+            level_width.push_back(w);
+            level_height.push_back(h);
+        }
+    }
+};
+
+TextureCache::TextureCache(size_t budget_bytes) : id(next_cache_id++), clock(0.0), counters() {
+    counters.budget_bytes = budget_bytes;
+}
+
+TextureCache::~TextureCache() {}
+
+int TextureCache::add_file(const std::string& path) {
+    if (int(images.size()) >= max_images) {
+        std::cout << path << ": too many images" << std::endl;
+        return -1;
+    }
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        std::cout << "Cannot open " << path << std::endl;
+        return -1;
+    }
+    std::unique_ptr<Image> im(new Image());
+    im->path = path;
+    im->file = f;
+
+    std::string magic, w, h, last;
+    if (!header_token(f, magic) || !header_token(f, w) || !header_token(f, h) || !header_token(f, last)) {
+        std::cout << path << ": truncated image header" << std::endl;
+        return -1;
+    }
+    int width = atoi(w.c_str()), height = atoi(h.c_str());
+    int bytes_per_sample;
+    if (magic == "P6") {
+        int maxval = atoi(last.c_str());
+        if (maxval <= 0 || maxval > 65535) {
+            std::cout << path << ": bad maximum value " << last << std::endl;
+            return -1;
+        }
+        im->format = maxval < 256 ? PIXELS_PPM8 : PIXELS_PPM16;
+        bytes_per_sample = maxval < 256 ? 1 : 2;
+    }
+    else if (magic == "PF" || magic == "Pf") {
+        im->format = PIXELS_PFM;
+        im->channels = magic == "PF" ? 3 : 1;
+        // A negative scale marks little endian data.
+        im->swap_bytes = (atof(last.c_str()) < 0.0) != host_little_endian();
+        bytes_per_sample = 4;
+    }
+    else {
+        std::cout << path << ": only binary PPM (P6) and PFM textures can be read" << std::endl;
+        return -1;
+    }
+    if (width <= 0 || height <= 0 || (width - 1) / tile_size >= max_tiles || (height - 1) / tile_size >= max_tiles) {
+        std::cout << path << ": bad image size " << w << " x " << h << std::endl;
+        return -1;
+    }
+
+    im->data_offset = tell(f);
+    uint64_t size = uint64_t(width) * height * im->channels * bytes_per_sample;
+    if (fseek(f, 0, SEEK_END) != 0 || tell(f) < im->data_offset + size) {
+        std::cout << path << ": image data is truncated" << std::endl;
+        return -1;
+    }
+    im->set_size(width, height);
+    images.push_back(std::move(im));
+    return int(images.size()) - 1;
+}
+
+int TextureCache::add_image(int width, int height, std::vector<float> rgb, const std::string& name) {
+    if (int(images.size()) >= max_images || width <= 0 || height <= 0
+        || (width - 1) / tile_size >= max_tiles || (height - 1) / tile_size >= max_tiles
+        || rgb.size() != size_t(width) * height * 3) {
+        std::cout << name << ": cannot add a " << width << " x " << height << " image" << std::endl;
+        return -1;
+    }
+    std::unique_ptr<Image> im(new Image());
+    im->path = name;
+    im->pixels = std::move(rgb);
+    im->set_size(width, height);
+    images.push_back(std::move(im));
+    return int(images.size()) - 1;
+}
+
+const std::string& TextureCache::path(int image) const { return images[image]->path; }
+bool TextureCache::has_file(int image) const { return images[image]->format != PIXELS_MEMORY; }
+int TextureCache::width(int image) const { return images[image]->width; }
+int TextureCache::height(int image) const { return images[image]->height; }
+int TextureCache::levels(int image) const { return int(images[image]->level_width.size()); }
+
+Vector3 TextureCache::lookup(int image, float u, float v, float width) const {
+    PICORAY_COUNT(texture_lookups, 1);
+    const Image& im = *images[image];
+    int top = int(im.level_width.size()) - 1;
+    float texels = width * float(im.height);
+    float level = texels > 1.0f ? log2f(texels) : 0.0f;
+    if (!(level < float(top)))
+        return bilinear(image, top, u, v);
+    int l = int(level);
+    float f = level - float(l);
+    Vector3 c = bilinear(image, l, u, v);
+    if (f > 0.0f)
+        c = (1.0f - f) * c + f * bilinear(image, l + 1, u, v);
+    return c;
+}
+
+Vector3 TextureCache::bilinear(int image, int level, float u, float v) const {
+    const Image& im = *images[image];
+    int w = im.level_width[level], h = im.level_height[level];
+    // fmaxf() also turns a NaN coordinate into a usable one.
+    float x = fmaxf(u - floorf(u), 0.0f) * float(w) - 0.5f;
+    float y = fminf(fmaxf(v, 0.0f), 1.0f) * float(h) - 0.5f;
+    int x0 = int(floorf(x)), y0 = int(floorf(y));
+    float fx = x - float(x0), fy = y - float(y0);
+    int x1 = x0 + 1, y1 = std::min(y0 + 1, h - 1);
+    if (x0 < 0)
+        x0 += w;
+    if (x1 >= w)
+        x1 -= w;
+    y0 = std::max(y0, 0);
+    Vector3 c00, c10, c01, c11;
+    int tx = x0 / tile_size, ty = y0 / tile_size;
+    if (x1 / tile_size == tx && y1 / tile_size == ty) {
+        // The usual case, all four in one tile.
+        const Tile& t = thread_tile(image, level, tx, ty);
+        c00 = t.texel(x0 - tx * tile_size, y0 - ty * tile_size);
+        c10 = t.texel(x1 - tx * tile_size, y0 - ty * tile_size);
+        c01 = t.texel(x0 - tx * tile_size, y1 - ty * tile_size);
+        c11 = t.texel(x1 - tx * tile_size, y1 - ty * tile_size);
+    }
+    else {
+        c00 = texel(image, level, x0, y0);
+        c10 = texel(image, level, x1, y0);
+        c01 = texel(image, level, x0, y1);
+        c11 = texel(image, level, x1, y1);
+    }
+    return (1.0f - fy) * ((1.0f - fx) * c00 + fx * c10) + fy * ((1.0f - fx) * c01 + fx * c11);
+}
+
+Vector3 TextureCache::texel(int image, int level, int x, int y) const {
+    int tx = x / tile_size, ty = y / tile_size;
+    return thread_tile(image, level, tx, ty).texel(x - tx * tile_size, y - ty * tile_size);
+}
+
+const TextureCache::Tile& TextureCache::thread_tile(int image, int level, int tx, int ty) const {
+    struct ThreadTile {
+        uint64_t cache;
+        uint64_t key;
+        TilePtr tile;
+    };
+    // Two-way set associative, the most recent tile of a set first, so a hit costs no
+    // lock. Slots left by a cleared or destroyed cache never match again since cache ids
+    // are not reused. The slots live on the heap: as a thread_local array they would more
+    // than double every thread's static TLS block, which sits at the top of its stack and
+    // shifts the hot frames of the whole renderer.
+    thread_local std::vector<ThreadTile> slots(thread_tiles);
+
+    uint64_t key = tile_key(image, level, tx, ty);
+    ThreadTile* set = &slots[2 * (mix64(key) & (thread_tiles / 2 - 1))];
+    if (set[0].cache != id || set[0].key != key) {
+        if (set[1].cache == id && set[1].key == key)
+            std::swap(set[0], set[1]);
+        else {
+            set[1] = std::move(set[0]);
+            set[0].tile = tile(image, level, tx, ty);
+            set[0].cache = id;
+            set[0].key = key;
+        }
+    }
+    return *set[0].tile;
+}
+
+TextureCache::TilePtr TextureCache::tile(int image, int level, int tx, int ty) const {
+    uint64_t key = tile_key(image, level, tx, ty);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        counters.requests++;
+        auto found = resident.find(key);
+        if (found != resident.end()) {
+            counters.hits++;
+            Entry& e = found->second;
+            order.erase(e.order);
+            e.order = order.insert(std::make_pair(clock + rebuild_cost(level), key)).first;
+            return e.tile;
+        }
+    }
+
+    // Loaded without the lock, so other threads keep hitting meanwhile. Two threads may
+    // load the same tile; the second to finish uses the first one's.
+    TilePtr loaded = load_tile(image, level, tx, ty);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = resident.find(key);
+    if (found != resident.end())
+        return found->second.tile;
+    Entry& e = resident[key];
+    e.tile = loaded;
+    e.order = order.insert(std::make_pair(clock + rebuild_cost(level), key)).first;
+    counters.resident_bytes += sizeof(Tile) + loaded->rgb.capacity() * sizeof(float);
+    counters.peak_bytes = std::max(counters.peak_bytes, counters.resident_bytes);
+    evict_locked(key);
+    return loaded;
+}
+
+TextureCache::TilePtr TextureCache::load_tile(int image, int level, int tx, int ty) const {
+    const Image& im = *images[image];
+    if (level == 0) {
+        auto start = std::chrono::steady_clock::now();
+        TilePtr t = read_tile(im, tx, ty);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::lock_guard<std::mutex> lock(mutex);
+        counters.tiles_loaded++;
+        counters.load_seconds += seconds;
+        return t;
+    }
+
+    // Each texel averages the 2 x 2 below it, repeating the last row or column of a level
+    // with an odd size.
+    std::shared_ptr<Tile> t(new Tile());
+    int w = im.level_width[level], h = im.level_height[level];
+    int below_w = im.level_width[level - 1], below_h = im.level_height[level - 1];
+    t->width = std::min(tile_size, w - tx * tile_size);
+    t->height = std::min(tile_size, h - ty * tile_size);
+    t->rgb.resize(size_t(t->width) * t->height * 3);
+
+    TilePtr below[2][2];
+    for (int j = 0; j < 2; j++) {
+        for (int i = 0; i < 2; i++) {
+            if ((2 * tx + i) * tile_size < below_w && (2 * ty + j) * tile_size < below_h)
+                below[j][i] = tile(image, level - 1, 2 * tx + i, 2 * ty + j);
+        }
+    }
+    for (int y = 0; y < t->height; y++) {
+        for (int x = 0; x < t->width; x++) {
+            float sum[3] = { 0.0f, 0.0f, 0.0f };
+            for (int dy = 0; dy < 2; dy++) {
+                int by = std::min(2 * (ty * tile_size + y) + dy, below_h - 1) - 2 * ty * tile_size;
+                for (int dx = 0; dx < 2; dx++) {
+                    int bx = std::min(2 * (tx * tile_size + x) + dx, below_w - 1) - 2 * tx * tile_size;
+                    const Tile& b = *below[by / tile_size][bx / tile_size];
+                    const float* p = &b.rgb[3 * (size_t(by % tile_size) * b.width + bx % tile_size)];
+                    sum[0] += p[0];
+                    sum[1] += p[1];
+                    sum[2] += p[2];
+                }
+            }
+            float* out = &t->rgb[3 * (size_t(y) * t->width + x)];
+            out[0] = 0.25f * sum[0];
+            out[1] = 0.25f * sum[1];
+            out[2] = 0.25f * sum[2];
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    counters.tiles_built++;
+    return t;
+}
+
+TextureCache::TilePtr TextureCache::read_tile(const Image& im, int tx, int ty) const {
+    std::shared_ptr<Tile> t(new Tile());
+    int x0 = tx * tile_size, y0 = ty * tile_size;
+    t->width = std::min(tile_size, im.width - x0);
+    t->height = std::min(tile_size, im.height - y0);
+    t->rgb.resize(size_t(t->width) * t->height * 3);
+
+    if (im.format == PIXELS_MEMORY) {
+        for (int y = 0; y < t->height; y++)
+            memcpy(&t->rgb[size_t(y) * t->width * 3], &im.pixels[3 * (size_t(y0 + y) * im.width + x0)],
+                   size_t(t->width) * 3 * sizeof(float));
+        std::lock_guard<std::mutex> lock(mutex);
+        counters.bytes_loaded += t->rgb.size() * sizeof(float);
+        return t;
+    }
+
+    int bytes_per_sample = im.format == PIXELS_PPM8 ? 1 : im.format == PIXELS_PPM16 ? 2 : 4;
+    size_t row_bytes = size_t(t->width) * im.channels * bytes_per_sample;
+    std::vector<uint8_t> row(row_bytes);
+    const float* srgb8 = srgb8_table();
+    std::lock_guard<std::mutex> lock(im.file_mutex);
+    for (int y = 0; y < t->height; y++) {
+        // PFM rows run bottom to top.
+        int file_row = im.format == PIXELS_PFM ? im.height - 1 - (y0 + y) : y0 + y;
+        uint64_t offset = im.data_offset + (uint64_t(file_row) * im.width + x0) * im.channels * bytes_per_sample;
+        if (!seek(im.file, offset) || fread(row.data(), 1, row_bytes, im.file) != row_bytes)
+            memset(row.data(), 0, row_bytes);   // checked when added, so only a file changed since
+        float* out = &t->rgb[size_t(y) * t->width * 3];
+        for (int x = 0; x < t->width * 3; x++) {
+            if (im.format == PIXELS_PPM8)
+                out[x] = srgb8[row[x]];
+            else if (im.format == PIXELS_PPM16)
+                out[x] = srgb_to_linear(float(row[2 * x] << 8 | row[2 * x + 1]) / 65535.0f);
+            else {
+                const uint8_t* b = &row[4 * (im.channels == 3 ? x : x / 3)];
+                uint8_t v[4] = { b[0], b[1], b[2], b[3] };
+                if (im.swap_bytes) {
+                    std::swap(v[0], v[3]);
+                    std::swap(v[1], v[2]);
+                }
+                memcpy(&out[x], v, 4);
+            }
+        }
+    }
+    std::lock_guard<std::mutex> stats_lock(mutex);
+    counters.bytes_loaded += uint64_t(row_bytes) * t->height;
+    return t;
+}
+
+void TextureCache::evict_locked(uint64_t keep) const {
+    while (counters.resident_bytes > counters.budget_bytes && order.size() > 1) {
+        auto victim = order.begin();
+        if (victim->second == keep)
+            ++victim;
+        clock = victim->first;
+        auto found = resident.find(victim->second);
+        counters.resident_bytes -= sizeof(Tile) + found->second.tile->rgb.capacity() * sizeof(float);
+        resident.erase(found);
+        order.erase(victim);
+        counters.evictions++;
+    }
+}
+
+void TextureCache::set_budget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    counters.budget_bytes = bytes;
+    evict_locked(~uint64_t(0));
+}
+
+TextureCacheStats TextureCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+}
+
+void TextureCache::reset_stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t budget = counters.budget_bytes;
+    size_t bytes = counters.resident_bytes;
+    memset(&counters, 0, sizeof(counters));
+    counters.budget_bytes = budget;
+    counters.resident_bytes = bytes;
+    counters.peak_bytes = bytes;
+}
+
+void TextureCache::clear() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        resident.clear();
+        order.clear();
+        clock = 0.0;
+        counters.resident_bytes = 0;
+    }
+    images.clear();
+    id = next_cache_id++;
+    reset_stats();
+}
@@ -0,0 +1,402 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "Camera.h"
+#include "Scenes.h"
+#include "Renderer.h"
+
+void print_usage() {
+    std::cout << "usage: picoray-bench [options]" << std::endl
+              << "  --reps <n>        timed repetitions per benchmark, after one warm-up (default 5)" << std::endl
+              << "  --filter <text>   only run benchmarks whose name contains text" << std::endl
+              << "  --kernel <name>   sphere kernel: auto, scalar, sse, avx2 or avx512 (default auto)" << std::endl
+              << "  -t <threads>      render benchmark threads, 0 = hardware concurrency (default 0)" << std::endl
+              << "  --quick           smaller workloads, for smoke testing" << std::endl
+              << "  --json <file>     write the results as JSON" << std::endl
+              << "  --csv <file>      write the results as CSV" << std::endl;
+}
+
+// A benchmark runs 'ops' operations of one kind per repetition; 'unit' names them
+// (rays, samples, ...). Times are wall clock seconds per repetition.
+struct Benchmark {
+    std::string name;
+    std::string unit;
+    double ops;
+    std::function<void()> run;
+
+    std::vector<double> seconds;
+};
+
+struct Summary {
+    double min, median, mean, stddev;
+};
+
+Summary summarize(std::vector<double> v) {
+    Summary s;
+    std::sort(v.begin(), v.end());
+    s.min = v.front();
+    s.median = v.size() % 2 ? v[v.size() / 2] : 0.5 * (v[v.size() / 2 - 1] + v[v.size() / 2]);
+    s.mean = 0.0;
+    for (double x : v)
+        s.mean += x;
+    s.mean /= v.size();
+    s.stddev = 0.0;
+    for (double x : v)
+        s.stddev += (x - s.mean) * (x - s.mean);
+    s.stddev = v.size() > 1 ? sqrt(s.stddev / (v.size() - 1)) : 0.0;
+    return s;
+}
+
+// Results feed this so the compiler cannot drop the work being timed.
+volatile float bench_sink;
+
+// Camera rays through random pixels of the random scene's default view, generated
+// from a fixed seed so every run and build traces the same rays.
+std::vector<Ray> make_rays(const Scene& scene, int n) {
+    const SceneCamera& view = scene.camera;
+    Camera cam(view.lookfrom, view.lookat, view.vup, view.vfov, 16.0f / 9.0f, view.aperture, view.focus_dist,
+               view.time0, view.time1);
+    seed_random(0, 0, 0);
+    std::vector<Ray> rays(n);
+    for (int i = 0; i < n; i++) {
+        float u = random_float();
+        float v = random_float();
+        rays[i] = cam.getRay(u, v);
+    }
+    return rays;
+}
+
+void add_hit_benchmark(std::vector<Benchmark>& benchmarks, const char* name, const Hitable* world,
+                       const std::vector<Ray>& rays) {
+    Benchmark b;
+    b.name = name;
+    b.unit = "rays";
+    b.ops = double(rays.size());
+    b.run = [world, &rays]() {
+        hit_record rec;
+        float sum = 0.0f;
+        for (const Ray& r : rays) {
+            if (world->hit(r, 0.001f, FLT_MAX, rec))
+                sum += rec.t;
+        }
+        bench_sink = sum;
+    };
+    benchmarks.push_back(b);
+}
+
+// Shadow rays from the first hit of each camera ray towards a fixed sun direction.
+std::vector<Ray> make_shadow_rays(const Hitable* world, const std::vector<Ray>& rays) {
+    Vector3 sun = unit_vector(Vector3(0.5f, 1.0f, 0.3f));
+    std::vector<Ray> shadow;
+    hit_record rec;
+    for (const Ray& r : rays) {
+        if (world->hit(r, 0.001f, FLT_MAX, rec))
+            shadow.push_back(Ray(rec.p, sun));
+    }
+    return shadow;
+}
+
+// Ambient occlusion rays as AOIntegrator traces them: from the first hit of each camera
+// ray, one cosine-weighted direction about the normal, tested out to a short distance.
+// Unlike the sun rays, many of these end on a nearby sphere or the ground.
+std::vector<Ray> make_ao_rays(const Hitable* world, const std::vector<Ray>& rays) {
+    seed_random(1, 0, 0);
+    std::vector<Ray> ao;
+    hit_record rec;
+    for (const Ray& r : rays) {
+        if (world->hit(r, 0.001f, FLT_MAX, rec))
+            ao.push_back(Ray(rec.p, unit_vector(sample_cosine_hemisphere(sample_2d(), rec.normal))));
+    }
+    return ao;
+}
+
+// The same visibility test answered by a closest-hit query and by an any-hit query.
+void add_shadow_benchmarks(std::vector<Benchmark>& benchmarks, const char* name, const Hitable* world,
+                           const std::vector<Ray>& rays, float t_max = FLT_MAX) {
+    Benchmark b;
+    b.name = std::string(name) + "_shadow_hit";
+    b.unit = "rays";
+    b.ops = double(rays.size());
+    b.run = [world, &rays, t_max]() {
+        hit_record rec;
+        int blocked = 0;
+        for (const Ray& r : rays)
+            blocked += world->hit(r, 0.001f, t_max, rec);
+        bench_sink = float(blocked);
+    };
+    benchmarks.push_back(b);
+
+    b.name = std::string(name) + "_occluded";
+    b.run = [world, &rays, t_max]() {
+        int blocked = 0;
+        for (const Ray& r : rays)
+            blocked += world->occluded(r, 0.001f, t_max);
+        bench_sink = float(blocked);
+    };
+    benchmarks.push_back(b);
+}
+
+void add_scatter_benchmark(std::vector<Benchmark>& benchmarks, const char* name, const Material& material, int n) {
+    Benchmark b;
+    b.name = name;
+    b.unit = "scatters";
+    b.ops = double(n);
+    b.run = [material, n]() {
+        hit_record rec;
+        rec.t = 1.0f;
+        rec.p = Vector3(0.0f, 0.0f, 0.0f);
+        rec.normal = Vector3(0.0f, 1.0f, 0.0f);
+        rec.material = 0;
+        Ray r_in(Vector3(-1.0f, 1.0f, 0.0f), Vector3(1.0f, -1.0f, 0.0f));
+        Vector3 attenuation;
+        Ray scattered;
+        float sum = 0.0f;
+        seed_random(0, 0, 0);
+        for (int i = 0; i < n; i++) {
+            if (scatter(material, r_in, rec, attenuation, scattered))
+                sum += scattered.direction()[0];
+        }
+        bench_sink = sum;
+    };
+    benchmarks.push_back(b);
+}
+
+// 'n' 2D draws, eight per pixel sample, through the sampler named 'sampler' (see
+// make_sampler), over the samples of a 64x64 pixel block.
+void add_sampler_benchmark(std::vector<Benchmark>& benchmarks, const char* sampler, int n) {
+    Benchmark b;
+    b.name = std::string("sample_") + sampler;
+    b.unit = "draws";
+    b.ops = double(n);
+    b.run = [sampler, n]() {
+        bool known;
+        std::unique_ptr<Sampler> s(make_sampler(sampler, n / (8 * 4096), known));
+        set_sampler(s.get());
+        float sum = 0.0f;
+        for (int i = 0; i < n / 8; i++) {
+            SampleKey key = { i & 63, (i >> 6) & 63, 0, uint32_t(i >> 12) };
+            start_sample(key);
+            for (int d = 0; d < 8; d++) {
+                Sample2D u = sample_2d();
+                sum += u.u + u.v;
+            }
+        }
+        set_sampler(nullptr);
+        bench_sink = sum;
+    };
+    benchmarks.push_back(b);
+}
+
+// Filtered lookups into the cache's first image along a path that winds across it in
+// small steps, with a footprint growing from one texel to sixteen, as a run of
+// neighbouring pixels would look it up.
+void add_texture_benchmark(std::vector<Benchmark>& benchmarks, const char* name, const TextureCache& cache, int n) {
+    Benchmark b;
+    b.name = name;
+    b.unit = "lookups";
+    b.ops = double(n);
+    b.run = [&cache, n]() {
+        float texel = 1.0f / float(cache.height(0));
+        Vector3 sum(0.0f, 0.0f, 0.0f);
+        for (int i = 0; i < n; i++) {
+            float t = float(i) / float(n);
+            float v = 0.5f + 0.45f * sinf(40.0f * t);
+            sum += cache.lookup(0, 7.0f * t, v, texel * (1.0f + 15.0f * t));
+        }
+        bench_sink = sum[0];
+    };
+    benchmarks.push_back(b);
+}
+
+void write_json(const char* path, const std::vector<Benchmark>& benchmarks, int reps, int threads) {
+    std::ofstream out(path);
+    out << "{" << std::endl
+        << "  \"kernel\": \"" << sphere_kernel().name << "\"," << std::endl
+        << "  \"vector\": \"" << Vector3::backend() << "\"," << std::endl
+        << "  \"threads\": " << threads << "," << std::endl
+        << "  \"reps\": " << reps << "," << std::endl
+        << "  \"benchmarks\": [" << std::endl;
+    for (size_t i = 0; i < benchmarks.size(); i++) {
+        const Benchmark& b = benchmarks[i];
+        Summary s = summarize(b.seconds);
+        out << "    {\"name\": \"" << b.name << "\", \"unit\": \"" << b.unit << "\", \"ops\": " << b.ops
+            << ", \"min_s\": " << s.min << ", \"median_s\": " << s.median << ", \"mean_s\": " << s.mean
+            << ", \"stddev_s\": " << s.stddev << ", \"ns_per_op\": " << s.median / b.ops * 1e9
+            << ", \"ops_per_s\": " << b.ops / s.median << ", \"seconds\": [";
+        for (size_t k = 0; k < b.seconds.size(); k++)
+            out << (k ? ", " : "") << b.seconds[k];
+        out << "]}" << (i + 1 < benchmarks.size() ? "," : "") << std::endl;
+    }
+    out << "  ]" << std::endl << "}" << std::endl;
+}
+
+void write_csv(const char* path, const std::vector<Benchmark>& benchmarks) {
+    std::ofstream out(path);
+    out << "name,unit,ops,reps,min_s,median_s,mean_s,stddev_s,ns_per_op,ops_per_s" << std::endl;
+    for (const Benchmark& b : benchmarks) {
+        Summary s = summarize(b.seconds);
+        out << b.name << "," << b.unit << "," << b.ops << "," << b.seconds.size() << "," << s.min << ","
+            << s.median << "," << s.mean << "," << s.stddev << "," << s.median / b.ops * 1e9 << ","
+            << b.ops / s.median << std::endl;
+    }
+}
+
+int main(int argc, char* args[]) {
+    int reps = 5;
+    const char* filter = "";
+    const char* kernel = "auto";
+    int num_threads = 0;
+    bool quick = false;
+    const char* json = nullptr;
+    const char* csv = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = args[i];
+        bool has_value = i + 1 < argc;
+        if (!strcmp(arg, "--reps") && has_value) reps = atoi(args[++i]);
+        else if (!strcmp(arg, "--filter") && has_value) filter = args[++i];
+        else if (!strcmp(arg, "--kernel") && has_value) kernel = args[++i];
+        else if (!strcmp(arg, "-t") && has_value) num_threads = atoi(args[++i]);
+        else if (!strcmp(arg, "--quick")) quick = true;
+        else if (!strcmp(arg, "--json") && has_value) json = args[++i];
+        else if (!strcmp(arg, "--csv") && has_value) csv = args[++i];
+        else {
+            print_usage();
+            return -1;
+        }
+    }
+    if (reps < 1) {
+        print_usage();
+        return -1;
+    }
+    if (!set_sphere_kernel(kernel)) {
+        std::cout << "Sphere kernel not available: " << kernel << std::endl;
+        return -1;
+    }
+
+    int num_rays = quick ? 1 << 12 : 1 << 16;
+    int num_scatters = quick ? 1 << 14 : 1 << 20;
+    int render_width = quick ? 160 : 320;
+    int render_height = quick ? 90 : 180;
+    int render_spp = quick ? 1 : 4;
+
+    Scene scene;
+    random_scene(scene);
+    std::vector<Ray> rays = make_rays(scene, num_rays);
+
+    // The camera is inside this sphere, so every ray hits it.
+    Sphere sphere(Vector3(0.0f, 0.0f, 0.0f), 1000.0f, 0);
+    HitableList list(scene.primitives(), scene.num_primitives());
+    SphereSoA soa(scene.primitives(), scene.num_primitives());
+    BVH bvh(scene.primitives(), scene.num_primitives(), 8, false);
+    BVH bvh_simd(scene.primitives(), scene.num_primitives(), 8, true);
+    // The same scene with the small spheres as instances of one shared sphere.
+    Scene instanced;
+    instanced_scene(instanced);
+    BVH bvh_instanced(instanced.primitives(), instanced.num_primitives(), 8, true);
+    // Around the camera's look-at point, so most rays hit it.
+    TriangleMesh mesh = quick ? torus_mesh(Vector3(0.0f, 0.0f, 0.0f), 2.0f, 0.8f, 256, 128, true, 0)
+                              : torus_mesh(Vector3(0.0f, 0.0f, 0.0f), 2.0f, 0.8f, 1024, 512, true, 0);
+
+    std::vector<Benchmark> benchmarks;
+    add_hit_benchmark(benchmarks, "sphere_hit", &sphere, rays);
+    add_hit_benchmark(benchmarks, "list_hit", &list, rays);
+    add_hit_benchmark(benchmarks, "soa_hit", &soa, rays);
+    add_hit_benchmark(benchmarks, "bvh_hit", &bvh, rays);
+    add_hit_benchmark(benchmarks, "bvh_simd_hit", &bvh_simd, rays);
+    add_hit_benchmark(benchmarks, "bvh_instanced_hit", &bvh_instanced, rays);
+    std::vector<Ray> shadow_rays = make_shadow_rays(&bvh, rays);
+    add_shadow_benchmarks(benchmarks, "list", &list, shadow_rays);
+    add_shadow_benchmarks(benchmarks, "bvh", &bvh, shadow_rays);
+    add_shadow_benchmarks(benchmarks, "bvh_simd", &bvh_simd, shadow_rays);
+    std::vector<Ray> ao_rays = make_ao_rays(&bvh, rays);
+    AOIntegrator ao;
+    add_shadow_benchmarks(benchmarks, "list_ao", &list, ao_rays, ao.distance);
+    add_shadow_benchmarks(benchmarks, "bvh_ao", &bvh, ao_rays, ao.distance);
+    add_shadow_benchmarks(benchmarks, "bvh_simd_ao", &bvh_simd, ao_rays, ao.distance);
+    add_hit_benchmark(benchmarks, "mesh_hit", &mesh, rays);
+    std::vector<Ray> mesh_shadow_rays = make_shadow_rays(&mesh, rays);
+    add_shadow_benchmarks(benchmarks, "mesh", &mesh, mesh_shadow_rays);
+    add_scatter_benchmark(benchmarks, "scatter_lambertian", lambertian(Vector3(0.5f, 0.5f, 0.5f)), num_scatters);
+    add_scatter_benchmark(benchmarks, "scatter_metal", metal(Vector3(0.7f, 0.6f, 0.5f), 0.3f), num_scatters);
+    add_scatter_benchmark(benchmarks, "scatter_dielectric", dielectric(1.5f), num_scatters);
+    for (int i = 0; sampler_names[i]; i++)
+        add_sampler_benchmark(benchmarks, sampler_names[i], num_scatters * 8);
+    // The same image with room for every tile, and with 1 MiB, about twenty tiles.
+    TextureCache textures, small_textures(size_t(1) << 20);
+    textures.add_image(2048, 1024, grid_image(2048, 1024), "grid");
+    small_textures.add_image(2048, 1024, grid_image(2048, 1024), "grid");
+    add_texture_benchmark(benchmarks, "texture_lookup", textures, num_scatters);
+    add_texture_benchmark(benchmarks, "texture_lookup_1mb", small_textures, num_scatters);
+
+    scene.set_accelerator(new BVH(scene.primitives(), scene.num_primitives(), 8, true));
+    const SceneCamera& view = scene.camera;
+    Camera cam(view.lookfrom, view.lookat, view.vup, view.vfov, float(render_width) / float(render_height),
+               view.aperture, view.focus_dist, view.time0, view.time1);
+    PathIntegrator integrator;
+    TileScheduler scheduler(render_width, render_height, 32, num_threads);
+    Framebuffer framebuffer(render_width, render_height, scheduler.get_tiles());
+
+    worker_data data;
+    data.full_width = render_width;
+    data.full_height = render_height;
+    data.samples = render_spp;
+    data.sample_offset = 0;
+    data.frame = 0;
+    data.camera = &cam;
+    data.scene = &scene;
+    data.integrator = &integrator;
+    data.sampler = nullptr;
+    data.framebuffer = &framebuffer;
+    data.adaptive = nullptr;
+    data.profile = nullptr;
+    data.aux = nullptr;
+
+    Benchmark render;
+    render.name = "render_path";
+    render.unit = "samples";
+    render.ops = double(render_width) * render_height * render_spp;
+    render.run = [&]() {
+        framebuffer.clear();
+        scheduler.start([&data](const Tile& tile, int) { render_tile(data, tile); });
+        scheduler.wait();
+    };
+    benchmarks.push_back(render);
+
+    std::vector<Benchmark> selected;
+    for (const Benchmark& b : benchmarks) {
+        if (strstr(b.name.c_str(), filter))
+            selected.push_back(b);
+    }
+
+    std::cout << "Sphere kernel " << sphere_kernel().name << ", " << Vector3::backend() << " vectors, "
+              << scheduler.num_threads() << " render threads, "
+              << reps << " repetitions" << std::endl;
+    for (Benchmark& b : selected) {
+        b.run();
+        for (int r = 0; r < reps; r++) {
+            auto start = std::chrono::steady_clock::now();
+            b.run();
+            b.seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+        Summary s = summarize(b.seconds);
+        std::cout << "  " << b.name << ": " << s.median / b.ops * 1e9 << " ns/" << b.unit.substr(0, b.unit.size() - 1)
+                  << ", " << b.ops / s.median / 1e6 << " M" << b.unit << "/s (+-"
+                  << (s.mean > 0.0 ? 100.0 * s.stddev / s.mean : 0.0) << "%)" << std::endl;
+    }
+
+    if (json)
+        write_json(json, selected, reps, scheduler.num_threads());
+    if (csv)
+        write_csv(csv, selected);
+    return 0;
+}
@@ -0,0 +1,609 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string.h>
+#include <stdlib.h>
+
+#include "Animation.h"
+#include "Camera.h"
+#include "Denoiser.h"
+#include "Distributed.h"
+#include "Scenes.h"
+#include "Renderer.h"
+#include "ImageIO.h"
+#include "SceneIO.h"
+
+void print_usage() {
+    std::cout << "usage: picoray-cli [options] -o <output.ppm|.png|.pfm>" << std::endl
+              << "       picoray-cli --frames <n> [options] -o <frame_%04d.png>" << std::endl
+              << "  -w <width>        image width (default 640)" << std::endl
+              << "  -h <height>       image height (default 360)" << std::endl
+              << "  -s <spp>          samples per pixel, the maximum when progressive (default 10)" << std::endl
+              << "  -t <threads>      worker threads, 0 = hardware concurrency (default 0)" << std::endl
+              << "  --tile <size>     tile size in pixels (default 32)" << std::endl
+              << "  --scene <name>    random, simple, lights, textured, motion, mesh, instanced," << std::endl
+              << "                    forest or a .scene/.pscn file (default random)" << std::endl
+              << "  --texture-cache <MB> memory for image texture tiles, at least 1.5 (default 256)" << std::endl
+              << "  --accel <name>    bvh, bvh-scalar, soa or list (default bvh)" << std::endl
+              << "  --leaf <size>     maximum primitives per BVH leaf (default 8)" << std::endl
+              << "  --kernel <name>   sphere kernel: auto, scalar, sse, avx2 or avx512 (default auto)" << std::endl
+              << "  --shutter <a> <b> camera shutter open and close times, overrides the scene's" << std::endl
+              << "  --integrator <n>  path, stream, recursive or ao (default path)" << std::endl
+              << "  --max-depth <n>   maximum bounces for the path integrator (default 50)" << std::endl
+              << "  --rr-depth <n>    bounces before Russian roulette starts (default 3)" << std::endl
+              << "  --no-nee          path integrator: no direct light sampling" << std::endl
+              << "  --ao-samples <n>  occlusion rays per sample for the ao integrator (default 8)" << std::endl
+              << "  --ao-distance <d> ao integrator occlusion distance (default 1)" << std::endl
+              << "  --sampler <name>  independent, stratified, halton, sobol or bluenoise (default independent)" << std::endl
+              << "  --progressive     render 1 spp passes into the accumulation buffer" << std::endl
+              << "  --time-budget <s> progressive, stop before the pass that would exceed s seconds" << std::endl
+              << "  --adaptive <err>  progressive, stop sampling pixels below this relative error" << std::endl
+              << "  --min-spp <n>     samples before a pixel may be considered converged (default 8)" << std::endl
+              << "  --tile-stats <f>  write samples taken per tile as CSV (adaptive only)" << std::endl
+              << "  --stats <file>    write render counters and per-tile times as JSON" << std::endl
+              << "  --heatmap <file>  write the time spent per pixel as an image" << std::endl
+              << "  --denoise         filter the image guided by first-hit albedo, normal and depth" << std::endl
+              << "  --denoise-passes <n> denoiser filter passes, each doubling its reach (default 3)" << std::endl
+              << "  --denoise-sigma <s> luminance noise the denoiser blurs over, in std devs (default 8)" << std::endl
+              << "  --frames <n>      render an animation of n frames, -o then needs a %d pattern" << std::endl
+              << "  --duration <t>    scene time the animation spans (default 1)" << std::endl
+              << "  --frame-shutter <f> fraction of each frame the shutter is open (default 0.5)" << std::endl
+              << "  --camera-path <f> keyframed lookfrom/lookat file for the camera" << std::endl
+              << "  --turntable       orbit the camera once around lookat over the animation" << std::endl
+              << "  --workers <n>     render tiles in n local worker processes (fixed spp only)" << std::endl
+              << "  --worker-timeout <s> restart a worker that spends longer than s seconds on a tile" << std::endl
+              << "  --worker-crash <n> testing: the first worker process exits after n tiles" << std::endl;
+}
+
+// One pass of 'data' with the tiles rendered by the coordinator's workers. Tiles that a
+// worker could not finish, even after restarts, are re-issued to the other workers.
+bool render_distributed(TileCoordinator& coordinator, TileScheduler& scheduler, const worker_data& data) {
+    auto make_job = [&data](const Tile& tile) {
+        TileJob job;
+        job.magic = 0;
+        job.frame = data.frame;
+        job.tile = tile.index;
+        job.x0 = tile.x0;
+        job.y0 = tile.y0;
+        job.x1 = tile.x1;
+        job.y1 = tile.y1;
+        job.samples = data.samples;
+        job.sample_offset = data.sample_offset;
+        return job;
+    };
+
+    std::mutex failed_lock;
+    std::vector<Tile> failed;
+    scheduler.start([&](const Tile& tile, int thread_index) {
+        auto start = std::chrono::steady_clock::now();
+        if (!coordinator.run(thread_index, make_job(tile), *data.framebuffer)) {
+            std::lock_guard<std::mutex> guard(failed_lock);
+            failed.push_back(tile);
+            return;
+        }
+        if (data.profile)
+            data.profile->tile_seconds[tile.index] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        data.framebuffer->publish(tile);
+    });
+    scheduler.wait();
+
+    for (const Tile& tile : failed) {
+        bool done = false;
+        for (int w = 0; w < coordinator.num_workers() && !done; w++)
+            done = coordinator.run(w, make_job(tile), *data.framebuffer);
+        if (!done) {
+            std::cout << "Tile " << tile.index << " of frame " << data.frame << " could not be rendered" << std::endl;
+            return false;
+        }
+        data.framebuffer->publish(tile);
+    }
+    return true;
+}
+
+int main(int argc, char* args[]) {
+    int nx = 640;
+    int ny = 360;
+    int ns = 10;
+    int tile_size = 32;
+    int num_threads = 0;
+    const char* scene = "random";
+    const char* accel = "bvh";
+    const char* kernel = "auto";
+    int leaf_size = 8;
+    const char* integrator_name = "path";
+    int max_depth = 50;
+    int rr_depth = 3;
+    bool nee = true;
+    bool shutter = false;
+    float shutter_open = 0.0f, shutter_close = 0.0f;
+    int ao_samples = 8;
+    float ao_distance = 1.0f;
+    const char* sampler_name = "independent";
+    bool progressive = false;
+    double time_budget = 0.0;
+    float adaptive_threshold = 0.0f;
+    int min_spp = 8;
+    const char* tile_stats = nullptr;
+    const char* stats_json = nullptr;
+    double texture_cache_mb = 256.0;
+    const char* heatmap = nullptr;
+    bool denoising = false;
+    DenoiseOptions denoise_options;
+    const char* output = nullptr;
+    int frames = 1;
+    float duration = 1.0f;
+    float frame_shutter = 0.5f;
+    const char* camera_path_file = nullptr;
+    bool turntable = false;
+    int num_workers = 0;
+    double worker_timeout = 0.0;
+    int worker_crash = 0;
+    bool worker = false;        // started by a coordinator, see Distributed.h
+    int crash_after = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = args[i];
+        bool has_value = i + 1 < argc;
+        if (!strcmp(arg, "-w") && has_value) nx = atoi(args[++i]);
+        else if (!strcmp(arg, "-h") && has_value) ny = atoi(args[++i]);
+        else if (!strcmp(arg, "-s") && has_value) ns = atoi(args[++i]);
+        else if (!strcmp(arg, "-t") && has_value) num_threads = atoi(args[++i]);
+        else if (!strcmp(arg, "--tile") && has_value) tile_size = atoi(args[++i]);
+        else if (!strcmp(arg, "--scene") && has_value) scene = args[++i];
+        else if (!strcmp(arg, "--accel") && has_value) accel = args[++i];
+        else if (!strcmp(arg, "--leaf") && has_value) leaf_size = atoi(args[++i]);
+        else if (!strcmp(arg, "--kernel") && has_value) kernel = args[++i];
+        else if (!strcmp(arg, "--shutter") && i + 2 < argc) {
+            shutter = true;
+            shutter_open = float(atof(args[++i]));
+            shutter_close = float(atof(args[++i]));
+        }
+        else if (!strcmp(arg, "--integrator") && has_value) integrator_name = args[++i];
+        else if (!strcmp(arg, "--max-depth") && has_value) max_depth = atoi(args[++i]);
+        else if (!strcmp(arg, "--rr-depth") && has_value) rr_depth = atoi(args[++i]);
+        else if (!strcmp(arg, "--no-nee")) nee = false;
+        else if (!strcmp(arg, "--ao-samples") && has_value) ao_samples = atoi(args[++i]);
+        else if (!strcmp(arg, "--ao-distance") && has_value) ao_distance = float(atof(args[++i]));
+        else if (!strcmp(arg, "--sampler") && has_value) sampler_name = args[++i];
+        else if (!strcmp(arg, "--progressive")) progressive = true;
+        else if (!strcmp(arg, "--time-budget") && has_value) { time_budget = atof(args[++i]); progressive = true; }
+        else if (!strcmp(arg, "--adaptive") && has_value) { adaptive_threshold = float(atof(args[++i])); progressive = true; }
+        else if (!strcmp(arg, "--min-spp") && has_value) min_spp = atoi(args[++i]);
+        else if (!strcmp(arg, "--tile-stats") && has_value) tile_stats = args[++i];
+        else if (!strcmp(arg, "--stats") && has_value) stats_json = args[++i];
+        else if (!strcmp(arg, "--texture-cache") && has_value) texture_cache_mb = atof(args[++i]);
+        else if (!strcmp(arg, "--heatmap") && has_value) heatmap = args[++i];
+        else if (!strcmp(arg, "--denoise")) denoising = true;
+        else if (!strcmp(arg, "--denoise-passes") && has_value) { denoise_options.iterations = atoi(args[++i]); denoising = true; }
+        else if (!strcmp(arg, "--denoise-sigma") && has_value) { denoise_options.sigma_color = float(atof(args[++i])); denoising = true; }
+        else if (!strcmp(arg, "-o") && has_value) output = args[++i];
+        else if (!strcmp(arg, "--frames") && has_value) frames = atoi(args[++i]);
+        else if (!strcmp(arg, "--duration") && has_value) duration = float(atof(args[++i]));
+        else if (!strcmp(arg, "--frame-shutter") && has_value) frame_shutter = float(atof(args[++i]));
+        else if (!strcmp(arg, "--camera-path") && has_value) camera_path_file = args[++i];
+        else if (!strcmp(arg, "--turntable")) turntable = true;
+        else if (!strcmp(arg, "--workers") && has_value) num_workers = atoi(args[++i]);
+        else if (!strcmp(arg, "--worker-timeout") && has_value) worker_timeout = atof(args[++i]);
+        else if (!strcmp(arg, "--worker-crash") && has_value) worker_crash = atoi(args[++i]);
+        else if (!strcmp(arg, "--worker")) worker = true;
+        else if (!strcmp(arg, "--crash-after") && has_value) crash_after = atoi(args[++i]);
+        else {
+            print_usage();
+            return -1;
+        }
+    }
+
+    if (!output || nx <= 0 || ny <= 0 || ns <= 0 || texture_cache_mb * 1024.0 * 1024.0 < double(TextureCache::min_budget) || ao_samples <= 0 || frames <= 0 || denoise_options.iterations < 0) {
+        print_usage();
+        return -1;
+    }
+    bool animation = frames > 1;
+    if (animation && !is_frame_pattern(output)) {
+        std::cout << "With --frames, -o needs one frame number pattern such as frame_%04d.png" << std::endl;
+        return -1;
+    }
+    bool distributed = num_workers > 0 && !worker;
+    if (distributed && (progressive || heatmap || denoising)) {
+        std::cout << "--workers renders a fixed sample count, without --progressive, --adaptive, "
+                  << "--time-budget, --heatmap or --denoise" << std::endl;
+        return -1;
+    }
+    // Taken over before anything is logged: a worker's stdout is the result stream.
+    std::unique_ptr<TileWorkerChannel> channel;
+    if (worker)
+        channel.reset(new TileWorkerChannel());
+
+    Scene world;
+    if (!strcmp(scene, "random"))
+        random_scene(world);
+    else if (!strcmp(scene, "simple"))
+        simple_scene(world);
+    else if (!strcmp(scene, "lights"))
+        lights_scene(world);
+    else if (!strcmp(scene, "textured"))
+        textured_scene(world);
+    else if (!strcmp(scene, "motion"))
+        motion_scene(world);
+    else if (!strcmp(scene, "mesh"))
+        mesh_scene(world);
+    else if (!strcmp(scene, "instanced"))
+        instanced_scene(world);
+    else if (!strcmp(scene, "forest"))
+        forest_scene(world);
+    else if (is_scene_file(scene)) {
+        auto load_start = std::chrono::steady_clock::now();
+        if (!load_scene(scene, world))
+            return -1;
+        std::cout << "Loaded " << scene << " in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_start).count()
+                  << " ms" << std::endl;
+    }
+    else {
+        std::cout << "Unknown scene: " << scene << std::endl;
+        return -1;
+    }
+    for (const TriangleMesh& mesh : world.meshes) {
+        std::cout << "Mesh " << (mesh.path.empty() ? "(built in)" : mesh.path) << ": " << mesh.num_triangles()
+                  << " triangles, " << mesh.num_vertices() << " vertices, "
+                  << double(mesh.memory_bytes()) / std::max(1, mesh.num_triangles()) << " bytes/triangle";
+        if (!mesh.path.empty())
+            std::cout << ", loaded in " << mesh.load_ms << " ms";
+        std::cout << " (BVH " << mesh.stats().build_ms << " ms)" << std::endl;
+    }
+    if (shutter) {
+        world.camera.time0 = shutter_open;
+        world.camera.time1 = shutter_close;
+    }
+
+    CameraPath camera_path;
+    if (camera_path_file) {
+        if (!load_camera_path(camera_path_file, camera_path))
+            return -1;
+    }
+    else if (turntable) {
+        camera_path = turntable_path(world.camera, duration);
+    }
+
+    // Frame k of an animation covers scene time [k, k + 1) * duration / frames, with the
+    // shutter open for the first frame_shutter of it. A still keeps the scene's shutter.
+    float frame_length = duration / float(frames);
+    auto frame_view = [&](int frame) {
+        SceneCamera v = camera_path.at(float(frame) * frame_length, world.camera);
+        if (animation) {
+            v.time0 = float(frame) * frame_length;
+            v.time1 = v.time0 + frame_shutter * frame_length;
+        }
+        return v;
+    };
+    const SceneCamera view = frame_view(0);
+
+    if (!set_sphere_kernel(kernel)) {
+        std::cout << "Sphere kernel not available: " << kernel << std::endl;
+        return -1;
+    }
+    std::cout << "Sphere kernel: " << sphere_kernel().name << std::endl;
+
+    BVH* bvh = nullptr;
+    if (!strcmp(accel, "bvh") || !strcmp(accel, "bvh-scalar")) {
+        bvh = new BVH(world.primitives(), world.num_primitives(), leaf_size, !strcmp(accel, "bvh"),
+                           view.time0, view.time1);
+        const BVHBuildStats& stats = bvh->stats();
+        std::cout << "BVH: " << stats.primitives << " primitives, " << stats.nodes << " nodes, "
+                  << stats.leaves << " leaves, depth " << stats.max_depth << ", "
+                  << stats.bytes / 1024.0 << " KiB, built in " << stats.build_ms << " ms" << std::endl;
+        world.set_accelerator(bvh);
+    }
+    else if (!strcmp(accel, "soa")) {
+        if (world.num_primitives() != int(world.spheres.size())) {
+            std::cout << "The soa accelerator only holds static spheres" << std::endl;
+            return -1;
+        }
+        world.set_accelerator(new SphereSoA(world.primitives(), world.num_primitives()));
+    }
+    else if (!strcmp(accel, "list")) {
+        world.set_accelerator(new HitableList(world.primitives(), world.num_primitives()));
+    }
+    else {
+        std::cout << "Unknown acceleration structure: " << accel << std::endl;
+        return -1;
+    }
+    std::cout << "Scene: " << world.spheres.size() + world.moving_spheres.size() << " spheres, ";
+    if (world.num_triangles())
+        std::cout << world.num_triangles() << " triangles, ";
+    if (!world.instances.empty())
+        std::cout << world.instances.size() << " instances of " << world.groups.size() << " groups, ";
+    if (!world.textures.empty())
+        std::cout << world.textures.size() << " textures over " << world.texture_cache.num_images() << " images, ";
+    std::cout << world.materials.size() << " materials, " << world.memory_bytes() / 1024.0 << " KiB" << std::endl;
+    world.texture_cache.set_budget(size_t(texture_cache_mb * 1024.0 * 1024.0));
+
+    std::unique_ptr<Integrator> integrator;
+    if (!strcmp(integrator_name, "path"))
+        integrator.reset(new PathIntegrator(max_depth, rr_depth, nee));
+    else if (!strcmp(integrator_name, "stream"))
+        integrator.reset(new StreamIntegrator(max_depth, rr_depth));
+    else if (!strcmp(integrator_name, "recursive"))
+        integrator.reset(new RecursiveIntegrator());
+    else if (!strcmp(integrator_name, "ao"))
+        integrator.reset(new AOIntegrator(ao_samples, ao_distance));
+    else {
+        std::cout << "Unknown integrator: " << integrator_name << std::endl;
+        return -1;
+    }
+
+    // Stratification is over the full sample count, which progressive passes add up to.
+    bool known_sampler;
+    std::unique_ptr<Sampler> sampler(make_sampler(sampler_name, ns, known_sampler));
+    if (!known_sampler) {
+        std::cout << "Unknown sampler: " << sampler_name << std::endl;
+        return -1;
+    }
+
+    // The scene and accelerator are shared by all frames. Only moving primitives need
+    // the BVH refitted to the next frame's shutter interval; camera moves need nothing.
+    bool refit = animation && bvh && !world.moving_spheres.empty();
+
+    if (worker) {
+        // Worker process: render the coordinator's tiles until it closes the job stream.
+        std::vector<Tile> tiles = TileScheduler::make_tiles(nx, ny, tile_size);
+        Framebuffer framebuffer(nx, ny, tiles);
+        std::unique_ptr<Camera> cam;
+        worker_data data;
+        data.full_width = nx;
+        data.full_height = ny;
+        data.scene = &world;
+        data.integrator = integrator.get();
+        data.sampler = sampler.get();
+        data.framebuffer = &framebuffer;
+        data.adaptive = nullptr;
+        data.profile = nullptr;
+        data.aux = nullptr;
+        int jobs = 0;
+        TileJob job;
+        while (channel->next_job(job)) {
+            if (crash_after > 0 && jobs++ == crash_after)
+                _Exit(1);
+            if (job.tile < 0 || job.tile >= int(tiles.size()) || tiles[job.tile].x0 != job.x0 || tiles[job.tile].y0 != job.y0
+                || tiles[job.tile].x1 != job.x1 || tiles[job.tile].y1 != job.y1)
+                return -1;
+            if (!cam || job.frame != data.frame) {
+                SceneCamera v = frame_view(job.frame);
+                if (refit)
+                    bvh->refit(v.time0, v.time1);
+                cam.reset(new Camera(v.lookfrom, v.lookat, v.vup, v.vfov, float(nx)/float(ny), v.aperture, v.focus_dist,
+                                     v.time0, v.time1));
+            }
+            data.frame = job.frame;
+            data.camera = cam.get();
+            data.samples = job.samples;
+            data.sample_offset = job.sample_offset;
+            framebuffer.clear(tiles[job.tile]);
+            render_tile(data, tiles[job.tile]);
+            if (!channel->send_result(job, framebuffer))
+                return -1;
+        }
+        return 0;
+    }
+
+    // A coordinator runs one scheduler thread per worker process.
+    TileScheduler scheduler(nx, ny, tile_size, distributed ? num_workers : num_threads);
+    std::unique_ptr<TileCoordinator> coordinator;
+    if (distributed) {
+        std::vector<std::string> command(args, args + argc);
+        command.push_back("--worker");
+        coordinator.reset(new TileCoordinator(command, num_workers));
+        coordinator->timeout_seconds = worker_timeout;
+        coordinator->crash_after = worker_crash;
+    }
+
+    // An animation renders into one framebuffer while the other is written out. With the
+    // denoiser on, the filtered copies are the ones written.
+    std::unique_ptr<Framebuffer> framebuffers[2], denoised[2];
+    for (int i = 0; i < (animation ? 2 : 1); i++) {
+        framebuffers[i].reset(new Framebuffer(nx, ny, scheduler.get_tiles()));
+        if (denoising)
+            denoised[i].reset(new Framebuffer(nx, ny, std::vector<Tile>()));
+    }
+    std::unique_ptr<AuxBuffers> aux;
+    if (denoising)
+        aux.reset(new AuxBuffers(nx, ny));
+
+    worker_data data;
+    data.full_width = nx;
+    data.full_height = ny;
+    data.samples = progressive ? 1 : ns;
+    data.sample_offset = 0;
+    data.frame = 0;
+    data.scene = &world;
+    data.integrator = integrator.get();
+    data.sampler = sampler.get();
+
+    AdaptiveSampling adaptive(adaptive_threshold, std::max(2, min_spp), scheduler.num_tiles());
+    data.adaptive = adaptive_threshold > 0.0f ? &adaptive : nullptr;
+
+    RenderProfile profile(nx, ny, scheduler.num_tiles());
+    data.profile = stats_json || heatmap ? &profile : nullptr;
+    data.aux = aux.get();
+
+    std::cout << "Rendering ";
+    if (animation)
+        std::cout << frames << " frames of ";
+    std::cout << nx << "x" << ny << " at " << ns << " spp with the " << integrator->name() << " integrator and "
+              << (sampler ? sampler->name() : "independent") << " samples, "
+              << scheduler.num_tiles() << " tiles on " << scheduler.num_threads()
+              << (distributed ? " worker processes" : " threads") << std::endl;
+
+    FrameWriter writer;
+
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&start]() { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); };
+    double trace_seconds = 0.0;
+    double refit_seconds = 0.0;
+    double denoise_seconds = 0.0;
+    int passes = 0;
+    uint64_t samples_taken = 0;
+    for (int frame = 0; frame < frames; frame++) {
+        SceneCamera v = frame_view(frame);
+        if (refit && frame > 0 && !distributed) {
+            double refit_start = elapsed();
+            bvh->refit(v.time0, v.time1);
+            refit_seconds += elapsed() - refit_start;
+        }
+        Camera cam(v.lookfrom, v.lookat, v.vup, v.vfov, float(nx)/float(ny), v.aperture, v.focus_dist, v.time0, v.time1);
+        Framebuffer& framebuffer = *framebuffers[frame % 2];
+        if (frame >= 2)
+            framebuffer.clear();
+        if (aux && frame > 0)
+            aux->clear();
+        data.frame = frame;
+        data.camera = &cam;
+        data.framebuffer = &framebuffer;
+
+        double frame_start = elapsed();
+        double last_pass = 0.0;
+        int spp = 0;
+        while (spp < ns) {
+            if (time_budget > 0.0 && spp > 0 && elapsed() - frame_start + last_pass > time_budget)
+                break;
+            double pass_start = elapsed();
+            data.sample_offset = spp;
+            if (distributed) {
+                if (!render_distributed(*coordinator, scheduler, data))
+                    return -1;
+            }
+            else {
+                scheduler.start([&data](const Tile& tile, int) { render_tile(data, tile); });
+                scheduler.wait();
+            }
+            last_pass = elapsed() - pass_start;
+            spp += data.samples;
+            passes++;
+
+            if (data.adaptive) {
+                uint64_t total = 0;
+                for (uint64_t n : adaptive.tile_samples)
+                    total += n;
+                bool converged = total == samples_taken;
+                samples_taken = total;
+                if (converged)
+                    break;
+            }
+            else {
+                samples_taken += uint64_t(nx) * ny * data.samples;
+            }
+        }
+        trace_seconds += elapsed() - frame_start;
+
+        Framebuffer* image = &framebuffer;
+        if (denoising) {
+            double denoise_start = elapsed();
+            image = denoised[frame % 2].get();
+            denoise(framebuffer, *aux, denoise_options, scheduler, *image);
+            denoise_seconds += elapsed() - denoise_start;
+        }
+        if (animation && !writer.submit(frame_path(output, frame), *image))
+            return -1;
+    }
+    if (!writer.finish())
+        return -1;
+    double seconds = elapsed();
+
+    double samples = double(samples_taken);
+    std::cout << "Rendered " << passes << (passes == 1 ? " pass, " : " passes, ") << samples / (double(nx) * ny * frames) << " spp average, in " << seconds << " s, "
+              << samples / seconds / 1e6 << " Msamples/s" << std::endl;
+    if (denoising)
+        std::cout << "Denoised in " << denoise_seconds / frames * 1e3 << " ms" << (animation ? " per frame, " : ", ")
+                  << denoise_options.iterations << " passes" << std::endl;
+    if (animation) {
+        std::cout << "Animation: " << seconds / frames * 1e3 << " ms per frame, "
+                  << (seconds - trace_seconds) / frames * 1e3 << " ms of it outside tracing (refit "
+                  << refit_seconds / frames * 1e3 << " ms, waiting for output " << writer.wait_seconds / frames * 1e3
+                  << " ms)" << std::endl;
+    }
+#if PICORAY_STATS
+    RenderCounters counters = render_stats.totals();
+    uint64_t rays = counters.primary_rays + counters.secondary_rays + counters.shadow_rays;
+    std::cout << "Rays: " << counters.primary_rays << " primary, " << counters.secondary_rays << " secondary, "
+              << counters.shadow_rays << " shadow, "
+              << rays / seconds / 1e6 << " Mrays/s, " << double(counters.intersection_tests) / rays << " tests/ray" << std::endl;
+    if (counters.bvh_traversals > 0)
+        std::cout << "BVH traversal: " << double(counters.bvh_nodes_visited) / counters.bvh_traversals << " nodes/ray, "
+                  << double(counters.intersection_tests) / counters.bvh_traversals << " primitives/ray" << std::endl;
+    std::cout << "Scatters:";
+    for (int m = 0; material_type_names[m]; m++)
+        std::cout << " " << material_type_names[m] << " " << counters.scatters[m];
+    std::cout << std::endl;
+#endif
+    TextureCacheStats texture_stats = world.texture_cache.stats();
+    if (world.texture_cache.num_images()) {
+        std::cout << "Texture cache: " << texture_stats.requests << " tile requests, "
+                  << 100.0 * texture_stats.hits / std::max<uint64_t>(texture_stats.requests, 1) << "% hits, "
+                  << texture_stats.tiles_loaded << " tiles loaded (" << texture_stats.bytes_loaded / 1048576.0 << " MiB in "
+                  << texture_stats.load_seconds * 1e3 << " ms), " << texture_stats.tiles_built << " mip tiles built, "
+                  << texture_stats.evictions << " evicted, peak " << texture_stats.peak_bytes / 1048576.0 << " of "
+                  << texture_stats.budget_bytes / 1048576.0 << " MiB" << std::endl;
+    }
+
+    if (stats_json) {
+        std::ofstream json(stats_json);
+        json << "{" << std::endl
+             << "  \"width\": " << nx << ", \"height\": " << ny << ", \"passes\": " << passes
+             << ", \"samples\": " << samples_taken << ", \"seconds\": " << seconds << "," << std::endl;
+#if PICORAY_STATS
+        json << "  \"counters\": ";
+        write_counters_json(json, render_stats.totals(), material_type_names);
+        json << "," << std::endl;
+#endif
+        if (world.texture_cache.num_images()) {
+            json << "  \"texture_cache\": {\"requests\": " << texture_stats.requests << ", \"hits\": " << texture_stats.hits
+                 << ", \"tiles_loaded\": " << texture_stats.tiles_loaded << ", \"tiles_built\": " << texture_stats.tiles_built
+                 << ", \"evictions\": " << texture_stats.evictions << ", \"bytes_loaded\": " << texture_stats.bytes_loaded
+                 << ", \"load_ms\": " << texture_stats.load_seconds * 1e3 << ", \"peak_bytes\": " << texture_stats.peak_bytes
+                 << ", \"budget_bytes\": " << texture_stats.budget_bytes << "}," << std::endl;
+        }
+        json << "  \"tiles\": [" << std::endl;
+        const std::vector<Tile>& tiles = scheduler.get_tiles();
+        for (size_t i = 0; i < tiles.size(); i++) {
+            const Tile& t = tiles[i];
+            json << "    {\"x0\": " << t.x0 << ", \"y0\": " << t.y0 << ", \"x1\": " << t.x1 << ", \"y1\": " << t.y1
+                 << ", \"ms\": " << profile.tile_seconds[t.index] * 1e3 << "}" << (i + 1 < tiles.size() ? "," : "") << std::endl;
+        }
+        json << "  ]" << std::endl << "}" << std::endl;
+    }
+
+    if (heatmap) {
+        Framebuffer image(nx, ny, std::vector<Tile>());
+        make_heatmap(profile, image);
+        if (!write_image(heatmap, image)) {
+            std::cout << "Failed to write " << heatmap << std::endl;
+            return -1;
+        }
+    }
+
+    if (data.adaptive) {
+        const std::vector<uint64_t>& per_tile = adaptive.tile_samples;
+        uint64_t lo = *std::min_element(per_tile.begin(), per_tile.end());
+        uint64_t hi = *std::max_element(per_tile.begin(), per_tile.end());
+        std::cout << "Adaptive: " << lo << " to " << hi << " samples per tile, "
+                  << samples / double(per_tile.size()) << " on average" << std::endl;
+        if (tile_stats) {
+            std::ofstream csv(tile_stats);
+            csv << "tile,x0,y0,x1,y1,samples,spp" << std::endl;
+            for (const Tile& t : scheduler.get_tiles()) {
+                csv << t.index << "," << t.x0 << "," << t.y0 << "," << t.x1 << "," << t.y1 << ","
+                    << per_tile[t.index] << "," << double(per_tile[t.index]) / ((t.x1 - t.x0) * (t.y1 - t.y0)) << std::endl;
+            }
+        }
+    }
+
+    if (!animation && !write_image(output, denoising ? *denoised[0] : *framebuffers[0])) {
+        std::cout << "Failed to write " << output << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,47 @@
+#include <iostream>
+#include <chrono>
+#include <string.h>
+
+#include "Scenes.h"
+#include "SceneIO.h"
+
+void print_usage() {
+    std::cout << "usage: picoray-convert <input> <output>" << std::endl
+              << "  converts between text (.scene) and binary (.pscn) scene files; the input" << std::endl
+              << "  may also be a built-in scene: random, simple, lights or motion" << std::endl;
+}
+
+int main(int argc, char* args[]) {
+    if (argc != 3) {
+        print_usage();
+        return -1;
+    }
+    const char* input = args[1];
+    const char* output = args[2];
+
+    Scene scene;
+    auto start = std::chrono::steady_clock::now();
+    if (!strcmp(input, "random"))
+        random_scene(scene);
+    else if (!strcmp(input, "simple"))
+        simple_scene(scene);
+    else if (!strcmp(input, "lights"))
+        lights_scene(scene);
+    else if (!strcmp(input, "motion"))
+        motion_scene(scene);
+    else if (!load_scene(input, scene))
+        return -1;
+    auto loaded = std::chrono::steady_clock::now();
+
+    if (!save_scene(output, scene)) {
+        std::cout << "Failed to write " << output << std::endl;
+        return -1;
+    }
+    auto saved = std::chrono::steady_clock::now();
+
+    std::cout << scene.materials.size() << " materials, " << scene.spheres.size() + scene.moving_spheres.size()
+              << " spheres, " << scene.meshes.size() << " meshes: read in "
+              << std::chrono::duration<double, std::milli>(loaded - start).count() << " ms, written in "
+              << std::chrono::duration<double, std::milli>(saved - loaded).count() << " ms" << std::endl;
+    return 0;
+}